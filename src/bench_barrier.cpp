@@ -0,0 +1,190 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Scaling of the topology-shaped barrier and all-reduce against a
+// centralized sense-reversing barrier. The harness thread is rank 0
+// and times the episodes; the other ranks are workers that run the
+// same number of episodes each time the harness asks.
+
+#include <pthread.h>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "bench_cases.h"
+#include "cpuid_os.h"
+#include "cpuid_sync.h"
+
+struct central_barrier {
+  int count   __attribute__((aligned(128)));
+  int sense   __attribute__((aligned(128)));
+  int threads;
+};
+
+void central_wait(central_barrier& b, int& local_sense) {
+  local_sense = !local_sense;
+  if (__atomic_add_fetch(&b.count, 1, __ATOMIC_ACQ_REL) == b.threads) {
+    b.count = 0;
+    __atomic_store_n(&b.sense, local_sense, __ATOMIC_RELEASE);
+  } else {
+    while (__atomic_load_n(&b.sense, __ATOMIC_ACQUIRE) != local_sense) {
+      __asm__ __volatile__("pause" ::: "memory");
+    }
+  }
+}
+
+enum barrier_kind { CENTRAL_BARRIER, TREE_BARRIER, TREE_ALLREDUCE };
+
+struct barrier_bench;
+
+struct barrier_rank {
+  barrier_bench* bench;
+  int rank;
+  int local_sense;
+  cpuid_sync_thread sync;
+  pthread_t thread;
+};
+
+struct barrier_bench {
+  barrier_kind kind;
+  const cpuid_info* info;
+  std::vector<int> allowed;
+  int threads;
+  std::vector<int> cpus;          // cpus[0] is the harness's CPU
+
+  central_barrier central;
+  cpuid_sync_tree tree;
+  std::vector<barrier_rank> ranks;
+
+  // Commands to the workers: a new sequence number means "run
+  // `iterations` episodes"; quit means exit.
+  uint64 sequence __attribute__((aligned(128)));
+  uint64 iterations;
+  int quit;
+  int64 checksum_errors;
+};
+
+void barrier_episodes(barrier_rank& self, uint64 iterations) {
+  barrier_bench& b = *self.bench;
+  int64 n = b.cpus.size();
+  for (uint64 e = 0; e < iterations; ++e) {
+    switch (b.kind) {
+      case CENTRAL_BARRIER: central_wait(b.central, self.local_sense); break;
+      case TREE_BARRIER:    cpuid_barrier(self.sync); break;
+      case TREE_ALLREDUCE:
+        if (cpuid_allreduce(self.sync, self.rank, CPUID_REDUCE_SUM) != n * (n - 1) / 2) {
+          __atomic_add_fetch(&b.checksum_errors, 1, __ATOMIC_RELAXED);
+        }
+        break;
+    }
+  }
+}
+
+void* barrier_worker(void* arg) {
+  barrier_rank& self = *(barrier_rank*) arg;
+  barrier_bench& b = *self.bench;
+  cpuid_os_pin_current_thread(b.cpus[self.rank]);
+
+  uint64 seen = 0;
+  for (;;) {
+    uint64 seq;
+    while ((seq = __atomic_load_n(&b.sequence, __ATOMIC_ACQUIRE)) == seen) {
+      __asm__ __volatile__("pause" ::: "memory");
+    }
+    seen = seq;
+    if (b.quit) return NULL;
+    barrier_episodes(self, b.iterations);
+  }
+}
+
+void barrier_stop_workers(barrier_bench& b) {
+  b.quit = 1;
+  __atomic_add_fetch(&b.sequence, 1, __ATOMIC_RELEASE);
+  for (size_t r = 1; r < b.ranks.size(); ++r) {
+    pthread_join(b.ranks[r].thread, NULL);
+  }
+  cpuid_sync_tree_free(b.tree);
+}
+
+bool barrier_setup(cpuid_bench_context&, void* arg) {
+  barrier_bench& b = *(barrier_bench*) arg;
+  int harness_cpu = cpuid_os_current_cpu();
+  b.cpus.assign(1, harness_cpu);
+  for (size_t i = 0; i < b.allowed.size() && int(b.cpus.size()) < b.threads; ++i) {
+    if (b.allowed[i] != harness_cpu) b.cpus.push_back(b.allowed[i]);
+  }
+
+  memset(&b.central, 0, sizeof(b.central));
+  b.central.threads = b.cpus.size();
+  if (!cpuid_sync_tree_init(b.tree, *b.info, b.cpus)) return false;
+
+  b.sequence = 0;
+  b.quit = 0;
+  b.checksum_errors = 0;
+  b.ranks.resize(b.cpus.size());
+  for (size_t r = 0; r < b.ranks.size(); ++r) {
+    b.ranks[r].bench = &b;
+    b.ranks[r].rank = r;
+    b.ranks[r].local_sense = 0;
+    cpuid_sync_thread_init(b.ranks[r].sync, b.tree, r);
+  }
+  for (size_t r = 1; r < b.ranks.size(); ++r) {
+    if (pthread_create(&b.ranks[r].thread, NULL, barrier_worker, &b.ranks[r]) != 0) {
+      // Stop the workers already running; the case is skipped.
+      b.ranks.resize(r);
+      barrier_stop_workers(b);
+      return false;
+    }
+  }
+  return true;
+}
+
+void barrier_body(void* arg, uint64 iterations) {
+  barrier_bench& b = *(barrier_bench*) arg;
+  b.iterations = iterations;
+  __atomic_add_fetch(&b.sequence, 1, __ATOMIC_RELEASE);
+  barrier_episodes(b.ranks[0], iterations);
+}
+
+void barrier_teardown(void* arg) {
+  barrier_bench& b = *(barrier_bench*) arg;
+  barrier_stop_workers(b);
+  if (b.checksum_errors) {
+    fprintf(stderr, "allreduce: %lld wrong results\n", (long long) b.checksum_errors);
+  }
+}
+
+void barrier_release(void* arg) {
+  delete (barrier_bench*) arg;
+}
+
+void bench_barrier_register(cpuid_bench_registry& registry, const cpuid_info& info) {
+  std::vector<int> allowed;
+  for (size_t i = 0; i < info.logical_processors.size(); ++i) {
+    allowed.push_back(info.logical_processors[i].os_cpu);
+  }
+
+  std::vector<int> counts;
+  for (int t = 1; t < int(allowed.size()); t *= 2) counts.push_back(t);
+  counts.push_back(allowed.size());
+
+  const char* names[] = { "barrier/central/", "barrier/tree/", "allreduce/tree/" };
+  for (size_t c = 0; c < counts.size(); ++c) {
+    for (int k = 0; k < 3; ++k) {
+      barrier_bench* b = new barrier_bench;
+      b->kind = barrier_kind(k);
+      b->info = &info;
+      b->allowed = allowed;
+      b->threads = counts[c];
+
+      std::stringstream name;
+      name << names[k] << counts[c];
+      cpuid_bench_case bc = cpuid_bench_make_case(name.str(), barrier_body, b);
+      bc.setup = barrier_setup;
+      bc.teardown = barrier_teardown;
+      bc.release = barrier_release;
+      registry.push_back(bc);
+    }
+  }
+}
@@ -0,0 +1,229 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Core-to-core cache line transfer latency. Two threads pinned to a
+// pair of CPUs bounce a counter on one cache line; half the round trip
+// time is the one-way transfer cost. The initiator times round trips
+// with the cpuid_bench harness. Pairs run concurrently only when they
+// touch disjoint LLC domains, so that no two pairs contend for the same
+// cache or ring stop (--serial turns that off).
+
+#include <pthread.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include "cpuid_bench.h"
+#include "cpuid_os.h"
+#include "json/json.h"
+
+using Json::Value;
+
+// Two lines per slot so the adjacent-line prefetcher stays out of it.
+const int kSlotBytes = 256;
+const uint64 kStop = ~0ULL;
+
+cpuid_info* g_info;
+cpuid_bench_options g_options;
+cpuid_bench_context g_context;   // calibrated once; holds no counters
+
+struct c2c_pair {
+  int a, b;               // indices into the CPU list
+  int cpu_a, cpu_b;
+  volatile uint64* line;
+  uint64 sent;
+  double one_way_cycles;  // median over harness samples
+};
+
+// Answers every odd value with the next even one until told to stop.
+void* c2c_responder(void* arg) {
+  c2c_pair* p = (c2c_pair*) arg;
+  cpuid_os_pin_current_thread(p->cpu_b);
+  for (;;) {
+    uint64 v;
+    while (((v = __atomic_load_n(p->line, __ATOMIC_ACQUIRE)) & 1) == 0) {}
+    if (v == kStop) return NULL;
+    __atomic_store_n(p->line, v + 1, __ATOMIC_RELEASE);
+  }
+}
+
+void c2c_round_trips(void* arg, uint64 iterations) {
+  c2c_pair* p = (c2c_pair*) arg;
+  for (uint64 k = 0; k < iterations; ++k) {
+    uint64 send = p->sent + 1;
+    __atomic_store_n(p->line, send, __ATOMIC_RELEASE);
+    while (__atomic_load_n(p->line, __ATOMIC_ACQUIRE) != send + 1) {}
+    p->sent = send + 1;
+  }
+}
+
+void* c2c_initiator(void* arg) {
+  c2c_pair* p = (c2c_pair*) arg;
+
+  // Without use_pmu the context is only the clock and fences, so each
+  // initiator can run from its own copy.
+  cpuid_bench_context ctx = g_context;
+  ctx.options.cpu = p->cpu_a;
+  p->one_way_cycles = -1;
+  if (cpuid_os_pin_current_thread(p->cpu_a)) {
+    cpuid_bench_result r;
+    cpuid_bench_measure(ctx, "c2c", c2c_round_trips, p, r);
+    p->one_way_cycles = r.tsc_cycles_per_iteration.median / 2;
+  }
+  __atomic_store_n(p->line, kStop, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+void c2c_run_batch(std::vector<c2c_pair>& batch) {
+  char* mem = NULL;
+  if (posix_memalign((void**) &mem, kSlotBytes, kSlotBytes * batch.size()) != 0) {
+    return;
+  }
+  memset(mem, 0, kSlotBytes * batch.size());
+
+  std::vector<pthread_t> threads(batch.size() * 2);
+  for (size_t i = 0; i < batch.size(); ++i) {
+    batch[i].line = (volatile uint64*) (mem + kSlotBytes * i);
+    pthread_create(&threads[2 * i],     NULL, c2c_responder, &batch[i]);
+    pthread_create(&threads[2 * i + 1], NULL, c2c_initiator, &batch[i]);
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  free(mem);
+}
+
+// Round-robin tournament: every round pairs each CPU with one other.
+std::vector<std::vector<std::pair<int, int> > > c2c_rounds(int n) {
+  std::vector<int> ring;
+  for (int i = 0; i < n; ++i) ring.push_back(i);
+  if (n % 2) ring.push_back(-1);
+
+  int m = ring.size();
+  std::vector<std::vector<std::pair<int, int> > > rounds;
+  for (int r = 0; r + 1 < m; ++r) {
+    std::vector<std::pair<int, int> > round;
+    for (int i = 0; i < m / 2; ++i) {
+      int x = ring[i], y = ring[m - 1 - i];
+      if (x >= 0 && y >= 0) round.push_back(std::make_pair(std::min(x, y), std::max(x, y)));
+    }
+    rounds.push_back(round);
+    std::rotate(ring.begin() + 1, ring.begin() + m - 1, ring.end());
+  }
+  return rounds;
+}
+
+const char* c2c_relation(const tag_logical_processor& x, const tag_logical_processor& y) {
+  if (x.package_id != y.package_id) return "cross_socket";
+  if (x.die_id != y.die_id)         return "cross_die";
+  if (x.core_id == y.core_id)       return "smt";
+  if (x.l2_id == y.l2_id)           return "same_l2";
+  if (x.llc_id == y.llc_id)         return "same_l3";
+  return "same_die";
+}
+
+Value c2c_summary(std::vector<double> v) {
+  Value root;
+  std::sort(v.begin(), v.end());
+  double sum = 0;
+  for (size_t i = 0; i < v.size(); ++i) sum += v[i];
+  root["pairs"]  = Value(int(v.size()));
+  root["min"]    = Value(v.front());
+  root["median"] = Value(v[v.size() / 2]);
+  root["mean"]   = Value(sum / v.size());
+  root["max"]    = Value(v.back());
+  return root;
+}
+
+int main(int argc, char** argv) {
+  // Many pairs to get through; keep each one short.
+  cpuid_bench_default_options(g_options);
+  g_options.warmup_ms = 5;
+  g_options.target_sample_us = 50;
+  g_options.max_seconds = 0.2;
+  g_options.use_pmu = false;
+
+  bool serial = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--serial")) serial = true;
+    else if (!strncmp(argv[i], "--max-seconds=", 14)) g_options.max_seconds = atof(argv[i] + 14);
+    else {
+      fprintf(stderr, "usage: %s [--serial] [--max-seconds=S]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  cpuid_info info;
+  cpuid_introspect(info);
+  cpuid_enumerate_logical_processors(info);
+  g_info = &info;
+  if (!cpuid_bench_init(g_context, info, g_options)) {
+    fprintf(stderr, "%s: could not set up the benchmark harness\n", argv[0]);
+    return 1;
+  }
+
+  const cpuid_info::logical_processor_list& cpus = info.logical_processors;
+  int n = cpus.size();
+  std::vector<std::vector<double> > matrix(n, std::vector<double>(n, 0.0));
+
+  std::vector<std::vector<std::pair<int, int> > > rounds = c2c_rounds(n);
+  for (size_t r = 0; r < rounds.size(); ++r) {
+    std::vector<std::pair<int, int> > pending = rounds[r];
+    while (!pending.empty()) {
+      // Greedily batch pairs that share no LLC domain.
+      std::vector<c2c_pair> batch;
+      std::vector<uint> busy_llcs;
+      std::vector<std::pair<int, int> > deferred;
+      for (size_t i = 0; i < pending.size(); ++i) {
+        int a = pending[i].first, b = pending[i].second;
+        uint la = cpus[a].llc_id, lb = cpus[b].llc_id;
+        bool clash = std::find(busy_llcs.begin(), busy_llcs.end(), la) != busy_llcs.end()
+                  || std::find(busy_llcs.begin(), busy_llcs.end(), lb) != busy_llcs.end();
+        if ((serial && !batch.empty()) || clash) {
+          deferred.push_back(pending[i]);
+          continue;
+        }
+        busy_llcs.push_back(la);
+        busy_llcs.push_back(lb);
+        c2c_pair p = { a, b, cpus[a].os_cpu, cpus[b].os_cpu, NULL, 0, -1 };
+        batch.push_back(p);
+      }
+      c2c_run_batch(batch);
+      for (size_t i = 0; i < batch.size(); ++i) {
+        matrix[batch[i].a][batch[i].b] = batch[i].one_way_cycles;
+        matrix[batch[i].b][batch[i].a] = batch[i].one_way_cycles;
+      }
+      pending = deferred;
+    }
+  }
+
+  Value root;
+  root["unit"] = Value("tsc_cycles_one_way");
+  root["max_seconds_per_pair"] = Value(g_options.max_seconds);
+  root["cpus"] = Value(Json::arrayValue);
+  root["matrix"] = Value(Json::arrayValue);
+  std::map<std::string, std::vector<double> > by_relation;
+  for (int i = 0; i < n; ++i) {
+    root["cpus"].append(Value(cpus[i].os_cpu));
+    Value row(Json::arrayValue);
+    for (int k = 0; k < n; ++k) {
+      row.append(Value(matrix[i][k]));
+      if (k > i) by_relation[c2c_relation(cpus[i], cpus[k])].push_back(matrix[i][k]);
+    }
+    root["matrix"].append(row);
+  }
+
+  Value summary(Json::objectValue);
+  std::map<std::string, std::vector<double> >::iterator it;
+  for (it = by_relation.begin(); it != by_relation.end(); ++it) {
+    summary[it->first] = c2c_summary(it->second);
+  }
+  root["summary"] = summary;
+
+  cpuid_bench_free(g_context);
+  std::cout << root.toStyledString() << std::endl;
+  return 0;
+}
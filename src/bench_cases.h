@@ -0,0 +1,15 @@
+#ifndef BENCH_CASES_H
+#define BENCH_CASES_H
+
+// Benchmarks compiled into the cpuid_bench target. Each module adds
+// its cases for this host; cases that cannot run here are left out.
+
+#include "cpuid_bench.h"
+
+void bench_locate_register(cpuid_bench_registry&, const cpuid_info&);
+void bench_barrier_register(cpuid_bench_registry&, const cpuid_info&);
+void bench_hist_register(cpuid_bench_registry&, const cpuid_info&);
+void bench_isa_register(cpuid_bench_registry&, const cpuid_info&);
+void bench_json_register(cpuid_bench_registry&, const cpuid_info&);
+
+#endif
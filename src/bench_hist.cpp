@@ -0,0 +1,75 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Cost of recording into a latency histogram, with each MSB method,
+// and of a whole unfenced rdtsc-delta-and-record step.
+
+#include "bench_cases.h"
+#include "cpuid_hist.h"
+
+#define HIST_BENCH_DELTAS 1024   // a power of two
+
+struct hist_bench {
+  cpuid_latency_histogram hist;
+  uint64 deltas[HIST_BENCH_DELTAS];
+};
+
+void hist_record_body(void* arg, uint64 iterations) {
+  hist_bench* b = (hist_bench*) arg;
+  for (uint64 i = 0; i < iterations; ++i) {
+    cpuid_hist_record(b->hist, b->deltas[i & (HIST_BENCH_DELTAS - 1)]);
+  }
+}
+
+void hist_timed_record_body(void* arg, uint64 iterations) {
+  hist_bench* b = (hist_bench*) arg;
+  uint64 last = cpuid_rdtsc();
+  for (uint64 i = 0; i < iterations; ++i) {
+    uint64 now = cpuid_rdtsc();
+    cpuid_hist_record(b->hist, now - last);
+    last = now;
+  }
+}
+
+hist_bench* hist_bench_new(const cpuid_info& info, cpuid_hist_msb_method msb) {
+  hist_bench* b = new hist_bench;
+  cpuid_hist_init(b->hist, info);
+  b->hist.msb = msb;
+
+  // Latency-like spread: mostly tens to thousands of cycles with a
+  // long tail, so the bucket index is not predictable.
+  uint64 x = 88172645463325252ULL;
+  for (int i = 0; i < HIST_BENCH_DELTAS; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    b->deltas[i] = (x & 0xFFFF) >> ((x >> 16) & 15);
+  }
+  return b;
+}
+
+void hist_bench_release(void* arg) {
+  delete (hist_bench*) arg;
+}
+
+void hist_bench_add(cpuid_bench_registry& registry, const char* name,
+                    cpuid_bench_body body, hist_bench* b) {
+  cpuid_bench_case c = cpuid_bench_make_case(name, body, b);
+  c.release = hist_bench_release;
+  registry.push_back(c);
+}
+
+void bench_hist_register(cpuid_bench_registry& registry, const cpuid_info& info) {
+  cpuid_latency_histogram probe;
+  cpuid_hist_init(probe, info);
+
+  if (probe.msb == CPUID_HIST_MSB_LZCNT) {
+    hist_bench_add(registry, "hist/record/lzcnt", hist_record_body,
+                   hist_bench_new(info, CPUID_HIST_MSB_LZCNT));
+  }
+  hist_bench_add(registry, "hist/record/bsr", hist_record_body,
+                 hist_bench_new(info, CPUID_HIST_MSB_BSR));
+  hist_bench_add(registry, "hist/timed_record", hist_timed_record_body,
+                 hist_bench_new(info, probe.msb));
+}
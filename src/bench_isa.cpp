@@ -0,0 +1,255 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Latency and reciprocal throughput of individual instructions, for
+// the instruction classes the CPU enumerates. One iteration is one
+// instruction: a latency kernel chains each result into the next
+// instruction, a throughput kernel interleaves eight independent
+// chains, which is enough to saturate every port on current cores.
+//
+// Each kernel is a single asm statement, so register setup survives
+// into the loop and the compiler cannot move anything into it.
+// Operands are constant or converge (1.0 * 1.0, x / (1 + 2^-52), zero
+// gather indices) so no kernel wanders into slow data-dependent paths.
+// AVX kernels end with VZEROUPPER to keep SSE code after them at full
+// speed.
+
+#include <cstring>
+
+#include "bench_cases.h"
+
+#define X2(s) s s
+#define X4(s) X2(s) X2(s)
+#define X8(s) X4(s) X4(s)
+
+#define ISA_KERNEL(attr, name, setup, body, tail, ...)                       \
+  attr void isa_##name(void* arg, uint64 iterations) {                       \
+    uint64 n = (iterations + 7) / 8;                                          \
+    if (n == 0) return;                                                       \
+    __asm__ __volatile__(setup "1:\n\t" body "dec %0\n\tjnz 1b\n\t" tail      \
+                         : "+r"(n) : "r"(arg) : "cc", "memory", __VA_ARGS__); \
+  }
+
+#define ISA_AVX512 __attribute__((target("avx512f")))
+
+#define ISA_R8_R15 "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+#define ISA_XMM0_7 "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+
+#define ISA_EACH_R8_R15(op)                                                  \
+  op("r8") op("r9") op("r10") op("r11") op("r12") op("r13") op("r14") op("r15")
+#define ISA_EACH_V0_7(op)                                                    \
+  op("0") op("1") op("2") op("3") op("4") op("5") op("6") op("7")
+
+#define ISA_SET_R(r) "mov %%rax, %%" r "\n\t"
+#define ISA_ONES_TO_R8_R15 "mov $-1, %%rax\n\t" ISA_EACH_R8_R15(ISA_SET_R)
+
+// The reference: one core cycle per add, whatever the TSC says.
+ISA_KERNEL(, add64_latency, "xor %%r8d, %%r8d\n\t", X8("add %%r8, %%r8\n\t"), "", "r8")
+
+#define ISA_IMUL(r) "imul %%" r ", %%" r "\n\t"
+ISA_KERNEL(, imul64_latency, "mov $3, %%r8\n\t", X8("imul %%r8, %%r8\n\t"), "", "r8")
+ISA_KERNEL(, imul64_throughput, ISA_ONES_TO_R8_R15, ISA_EACH_R8_R15(ISA_IMUL), "",
+           "rax", ISA_R8_R15)
+
+// Dividing by one keeps a full 64-bit quotient and a zero remainder.
+#define ISA_DIV_SETUP "mov $1, %%rcx\n\tmovabs $0x123456789abcdef, %%r8\n\t" \
+                      "mov %%r8, %%rax\n\txor %%edx, %%edx\n\t"
+ISA_KERNEL(, div64_latency, ISA_DIV_SETUP, X8("div %%rcx\n\t"), "", "rax", "rcx", "rdx", "r8")
+ISA_KERNEL(, div64_throughput, ISA_DIV_SETUP,
+           X8("mov %%r8, %%rax\n\txor %%edx, %%edx\n\tdiv %%rcx\n\t"), "",
+           "rax", "rcx", "rdx", "r8")
+
+#define ISA_ONE_TO_XMM0_7 "mov $0x3ff0000000000000, %%rax\n\tmovq %%rax, %%xmm0\n\t" \
+  "movapd %%xmm0, %%xmm1\n\tmovapd %%xmm0, %%xmm2\n\tmovapd %%xmm0, %%xmm3\n\t"        \
+  "movapd %%xmm0, %%xmm4\n\tmovapd %%xmm0, %%xmm5\n\tmovapd %%xmm0, %%xmm6\n\t"        \
+  "movapd %%xmm0, %%xmm7\n\t"
+#define ISA_DIVISOR_TO_XMM8 "mov $0x3ff0000000000001, %%rax\n\tmovq %%rax, %%xmm8\n\t"
+
+#define ISA_MULSD(v) "mulsd %%xmm" v ", %%xmm" v "\n\t"
+#define ISA_DIVSD(v) "divsd %%xmm8, %%xmm" v "\n\t"
+ISA_KERNEL(, mulsd_latency, ISA_ONE_TO_XMM0_7, X8("mulsd %%xmm0, %%xmm0\n\t"), "",
+           "rax", ISA_XMM0_7)
+ISA_KERNEL(, mulsd_throughput, ISA_ONE_TO_XMM0_7, ISA_EACH_V0_7(ISA_MULSD), "",
+           "rax", ISA_XMM0_7)
+ISA_KERNEL(, divsd_latency, ISA_ONE_TO_XMM0_7 ISA_DIVISOR_TO_XMM8,
+           X8("divsd %%xmm8, %%xmm0\n\t"), "", "rax", ISA_XMM0_7, "xmm8")
+ISA_KERNEL(, divsd_throughput, ISA_ONE_TO_XMM0_7 ISA_DIVISOR_TO_XMM8,
+           ISA_EACH_V0_7(ISA_DIVSD), "", "rax", ISA_XMM0_7, "xmm8")
+
+#define ISA_POPCNT(r) "popcnt %%" r ", %%" r "\n\t"
+#define ISA_LZCNT(r)  "lzcnt %%" r ", %%" r "\n\t"
+ISA_KERNEL(, popcnt64_latency, ISA_ONES_TO_R8_R15, X8("popcnt %%r8, %%r8\n\t"), "",
+           "rax", ISA_R8_R15)
+ISA_KERNEL(, popcnt64_throughput, ISA_ONES_TO_R8_R15, ISA_EACH_R8_R15(ISA_POPCNT), "",
+           "rax", ISA_R8_R15)
+ISA_KERNEL(, lzcnt64_latency, ISA_ONES_TO_R8_R15, X8("lzcnt %%r8, %%r8\n\t"), "",
+           "rax", ISA_R8_R15)
+ISA_KERNEL(, lzcnt64_throughput, ISA_ONES_TO_R8_R15, ISA_EACH_R8_R15(ISA_LZCNT), "",
+           "rax", ISA_R8_R15)
+
+// Half the mask bits set; microcoded implementations scale with them.
+#define ISA_PDEP_SETUP ISA_ONES_TO_R8_R15 "movabs $0x5555555555555555, %%rax\n\t"
+#define ISA_PDEP(r) "pdep %%rax, %%" r ", %%" r "\n\t"
+#define ISA_PEXT(r) "pext %%rax, %%" r ", %%" r "\n\t"
+ISA_KERNEL(, pdep64_latency, ISA_PDEP_SETUP, X8("pdep %%rax, %%r8, %%r8\n\t"), "",
+           "rax", ISA_R8_R15)
+ISA_KERNEL(, pdep64_throughput, ISA_PDEP_SETUP, ISA_EACH_R8_R15(ISA_PDEP), "",
+           "rax", ISA_R8_R15)
+ISA_KERNEL(, pext64_latency, ISA_PDEP_SETUP, X8("pext %%rax, %%r8, %%r8\n\t"), "",
+           "rax", ISA_R8_R15)
+ISA_KERNEL(, pext64_throughput, ISA_PDEP_SETUP, ISA_EACH_R8_R15(ISA_PEXT), "",
+           "rax", ISA_R8_R15)
+
+// Vector kernels start from all-zero registers.
+#define ISA_ZERO_X(v) "vpxor %%xmm" v ", %%xmm" v ", %%xmm" v "\n\t"
+#define ISA_ZERO_VEC ISA_EACH_V0_7(ISA_ZERO_X) ISA_ZERO_X("8") ISA_ZERO_X("9")
+#define ISA_ZERO_XMM_SSE(v) "pxor %%xmm" v ", %%xmm" v "\n\t"
+#define ISA_ZERO_SSE ISA_EACH_V0_7(ISA_ZERO_XMM_SSE) ISA_ZERO_XMM_SSE("8")
+#define ISA_VZEROUPPER "vzeroupper\n\t"
+#define ISA_VEC_CLOBBERS ISA_XMM0_7, "xmm8", "xmm9"
+
+#define ISA_FMA(w) "vfmadd231ps %%" w "8, %%" w "9, %%" w
+#define ISA_FMA_X(v) ISA_FMA("xmm") v "\n\t"
+#define ISA_FMA_Y(v) ISA_FMA("ymm") v "\n\t"
+#define ISA_FMA_Z(v) ISA_FMA("zmm") v "\n\t"
+ISA_KERNEL(, fma_xmm_latency, ISA_ZERO_VEC, X8(ISA_FMA_X("0")), ISA_VZEROUPPER, ISA_VEC_CLOBBERS)
+ISA_KERNEL(, fma_xmm_throughput, ISA_ZERO_VEC, ISA_EACH_V0_7(ISA_FMA_X), ISA_VZEROUPPER,
+           ISA_VEC_CLOBBERS)
+ISA_KERNEL(, fma_ymm_latency, ISA_ZERO_VEC, X8(ISA_FMA_Y("0")), ISA_VZEROUPPER, ISA_VEC_CLOBBERS)
+ISA_KERNEL(, fma_ymm_throughput, ISA_ZERO_VEC, ISA_EACH_V0_7(ISA_FMA_Y), ISA_VZEROUPPER,
+           ISA_VEC_CLOBBERS)
+ISA_KERNEL(ISA_AVX512, fma_zmm_latency, ISA_ZERO_VEC, X8(ISA_FMA_Z("0")), ISA_VZEROUPPER,
+           ISA_VEC_CLOBBERS)
+ISA_KERNEL(ISA_AVX512, fma_zmm_throughput, ISA_ZERO_VEC, ISA_EACH_V0_7(ISA_FMA_Z),
+           ISA_VZEROUPPER, ISA_VEC_CLOBBERS)
+
+#define ISA_PSHUFB_X(v) "pshufb %%xmm8, %%xmm" v "\n\t"
+#define ISA_PSHUFB_Y(v) "vpshufb %%ymm8, %%ymm" v ", %%ymm" v "\n\t"
+#define ISA_VPERMPS_Y(v) "vpermps %%ymm" v ", %%ymm8, %%ymm" v "\n\t"
+#define ISA_VPERMPS_Z(v) "vpermps %%zmm" v ", %%zmm8, %%zmm" v "\n\t"
+ISA_KERNEL(, pshufb_xmm_latency, ISA_ZERO_SSE, X8(ISA_PSHUFB_X("0")), "",
+           ISA_XMM0_7, "xmm8")
+ISA_KERNEL(, pshufb_xmm_throughput, ISA_ZERO_SSE, ISA_EACH_V0_7(ISA_PSHUFB_X), "",
+           ISA_XMM0_7, "xmm8")
+ISA_KERNEL(, pshufb_ymm_latency, ISA_ZERO_VEC, X8(ISA_PSHUFB_Y("0")), ISA_VZEROUPPER,
+           ISA_VEC_CLOBBERS)
+ISA_KERNEL(, pshufb_ymm_throughput, ISA_ZERO_VEC, ISA_EACH_V0_7(ISA_PSHUFB_Y), ISA_VZEROUPPER,
+           ISA_VEC_CLOBBERS)
+ISA_KERNEL(, vpermps_ymm_latency, ISA_ZERO_VEC, X8(ISA_VPERMPS_Y("0")), ISA_VZEROUPPER,
+           ISA_VEC_CLOBBERS)
+ISA_KERNEL(, vpermps_ymm_throughput, ISA_ZERO_VEC, ISA_EACH_V0_7(ISA_VPERMPS_Y),
+           ISA_VZEROUPPER, ISA_VEC_CLOBBERS)
+ISA_KERNEL(ISA_AVX512, vpermps_zmm_latency, ISA_ZERO_VEC, X8(ISA_VPERMPS_Z("0")),
+           ISA_VZEROUPPER, ISA_VEC_CLOBBERS)
+ISA_KERNEL(ISA_AVX512, vpermps_zmm_throughput, ISA_ZERO_VEC, ISA_EACH_V0_7(ISA_VPERMPS_Z),
+           ISA_VZEROUPPER, ISA_VEC_CLOBBERS)
+
+// Gathers from a zeroed table (the kernel argument), so every index
+// is zero. A gather clears its mask and may not write its index
+// register, so the mask is reset each time and the latency chain
+// alternates between two registers.
+#define ISA_GATHER_Y(dst, idx) "vpcmpeqd %%ymm9, %%ymm9, %%ymm9\n\t" \
+                               "vpgatherdd %%ymm9, (%1,%%ymm" idx ",4), %%ymm" dst "\n\t"
+#define ISA_GATHER_Z(dst, idx) "kxnorw %%k1, %%k1, %%k1\n\t" \
+                               "vpgatherdd (%1,%%zmm" idx ",4), %%zmm" dst "%{%%k1%}\n\t"
+#define ISA_GATHER_Y8(v) ISA_GATHER_Y(v, "8")
+#define ISA_GATHER_Z8(v) ISA_GATHER_Z(v, "8")
+ISA_KERNEL(, gather_ymm_latency, ISA_ZERO_VEC,
+           X4(ISA_GATHER_Y("1", "0") ISA_GATHER_Y("0", "1")), ISA_VZEROUPPER, ISA_VEC_CLOBBERS)
+ISA_KERNEL(, gather_ymm_throughput, ISA_ZERO_VEC, ISA_EACH_V0_7(ISA_GATHER_Y8),
+           ISA_VZEROUPPER, ISA_VEC_CLOBBERS)
+ISA_KERNEL(ISA_AVX512, gather_zmm_latency, ISA_ZERO_VEC,
+           X4(ISA_GATHER_Z("1", "0") ISA_GATHER_Z("0", "1")), ISA_VZEROUPPER,
+           ISA_VEC_CLOBBERS, "k1")
+ISA_KERNEL(ISA_AVX512, gather_zmm_throughput, ISA_ZERO_VEC, ISA_EACH_V0_7(ISA_GATHER_Z8),
+           ISA_VZEROUPPER, ISA_VEC_CLOBBERS, "k1")
+
+#define ISA_AESENC(v) "aesenc %%xmm8, %%xmm" v "\n\t"
+#define ISA_CLMUL(v) "pclmulqdq $0, %%xmm8, %%xmm" v "\n\t"
+ISA_KERNEL(, aesenc_xmm_latency, ISA_ZERO_SSE, X8(ISA_AESENC("0")), "", ISA_XMM0_7, "xmm8")
+ISA_KERNEL(, aesenc_xmm_throughput, ISA_ZERO_SSE, ISA_EACH_V0_7(ISA_AESENC), "",
+           ISA_XMM0_7, "xmm8")
+ISA_KERNEL(, pclmulqdq_xmm_latency, ISA_ZERO_SSE, X8(ISA_CLMUL("0")), "", ISA_XMM0_7, "xmm8")
+ISA_KERNEL(, pclmulqdq_xmm_throughput, ISA_ZERO_SSE, ISA_EACH_V0_7(ISA_CLMUL), "",
+           ISA_XMM0_7, "xmm8")
+
+//////////////////////////////////////////////////////////////////////
+
+struct isa_instruction {
+  const char* name;
+  const char* features[3];   // all required; NULL-terminated
+  cpuid_bench_body latency;
+  cpuid_bench_body throughput;
+};
+
+const isa_instruction isa_instructions[] = {
+  { "add64",         { NULL },                              isa_add64_latency, NULL },
+  { "imul64",        { NULL },                              isa_imul64_latency,
+                                                            isa_imul64_throughput },
+  { "div64",         { NULL },                              isa_div64_latency,
+                                                            isa_div64_throughput },
+  { "mulsd",         { "sse2", NULL },                      isa_mulsd_latency,
+                                                            isa_mulsd_throughput },
+  { "divsd",         { "sse2", NULL },                      isa_divsd_latency,
+                                                            isa_divsd_throughput },
+  { "popcnt64",      { "popcnt", NULL },                    isa_popcnt64_latency,
+                                                            isa_popcnt64_throughput },
+  { "lzcnt64",       { "lzcnt", NULL },                     isa_lzcnt64_latency,
+                                                            isa_lzcnt64_throughput },
+  { "pdep64",        { "bmi2", NULL },                      isa_pdep64_latency,
+                                                            isa_pdep64_throughput },
+  { "pext64",        { "bmi2", NULL },                      isa_pext64_latency,
+                                                            isa_pext64_throughput },
+  { "fma_xmm",       { "fma", "os-avx", NULL },             isa_fma_xmm_latency,
+                                                            isa_fma_xmm_throughput },
+  { "fma_ymm",       { "fma", "os-avx", NULL },             isa_fma_ymm_latency,
+                                                            isa_fma_ymm_throughput },
+  { "fma_zmm",       { "avx512f", "os-avx512", NULL },      isa_fma_zmm_latency,
+                                                            isa_fma_zmm_throughput },
+  { "pshufb_xmm",    { "ssse3", NULL },                     isa_pshufb_xmm_latency,
+                                                            isa_pshufb_xmm_throughput },
+  { "pshufb_ymm",    { "avx2", "os-avx", NULL },            isa_pshufb_ymm_latency,
+                                                            isa_pshufb_ymm_throughput },
+  { "vpermps_ymm",   { "avx2", "os-avx", NULL },            isa_vpermps_ymm_latency,
+                                                            isa_vpermps_ymm_throughput },
+  { "vpermps_zmm",   { "avx512f", "os-avx512", NULL },      isa_vpermps_zmm_latency,
+                                                            isa_vpermps_zmm_throughput },
+  { "gather_ymm",    { "avx2", "os-avx", NULL },            isa_gather_ymm_latency,
+                                                            isa_gather_ymm_throughput },
+  { "gather_zmm",    { "avx512f", "os-avx512", NULL },      isa_gather_zmm_latency,
+                                                            isa_gather_zmm_throughput },
+  { "aesenc_xmm",    { "aes", NULL },                       isa_aesenc_xmm_latency,
+                                                            isa_aesenc_xmm_throughput },
+  { "pclmulqdq_xmm", { "pclmuldq", NULL },                  isa_pclmulqdq_xmm_latency,
+                                                            isa_pclmulqdq_xmm_throughput }
+};
+
+int isa_gather_table[16] __attribute__((aligned(64)));
+
+bool isa_supported(const cpuid_info& info, const isa_instruction& insn) {
+  for (int f = 0; insn.features[f]; ++f) {
+    const char* name = insn.features[f];
+    // AMD calls LZCNT "abm".
+    bool present = cpuid_has_feature(info, name)
+                || (!strcmp(name, "lzcnt") && cpuid_has_feature(info, "abm"));
+    if (!present) return false;
+  }
+  return true;
+}
+
+void bench_isa_register(cpuid_bench_registry& registry, const cpuid_info& info) {
+  const int count = sizeof(isa_instructions) / sizeof(isa_instructions[0]);
+  for (int i = 0; i < count; ++i) {
+    const isa_instruction& insn = isa_instructions[i];
+    if (!isa_supported(info, insn)) continue;
+
+    std::string prefix = std::string("isa/") + insn.name;
+    registry.push_back(cpuid_bench_make_case(prefix + "/latency", insn.latency,
+                                             isa_gather_table));
+    if (insn.throughput) {
+      registry.push_back(cpuid_bench_make_case(prefix + "/throughput", insn.throughput,
+                                               isa_gather_table));
+    }
+  }
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Cost of producing testcpuid's cpuid_info document: the jsoncpp tree
+// plus toStyledString, against the streaming writer into a fixed
+// buffer. One iteration is one whole document. The "256cpu" cases pad
+// the processor list out to a large host's, where the per-CPU arrays
+// dominate. Both only walk cpuid_info; the groups, events and
+// selections in it are computed at setup.
+
+#include "bench_cases.h"
+#include "cpuid_json.h"
+#include "cpuid_json_tree.h"
+
+#define JSON_BENCH_BUFFER (1 << 20)
+
+struct json_bench {
+  cpuid_info info;
+  char buffer[JSON_BENCH_BUFFER];
+  volatile size_t sink;
+};
+
+void json_tree_body(void* arg, uint64 iterations) {
+  json_bench* b = (json_bench*) arg;
+  size_t total = 0;
+  for (uint64 i = 0; i < iterations; ++i) {
+    total += cpuid_json_tree(b->info).toStyledString().size();
+  }
+  b->sink = total;
+}
+
+void json_stream_body(void* arg, uint64 iterations) {
+  json_bench* b = (json_bench*) arg;
+  size_t total = 0;
+  for (uint64 i = 0; i < iterations; ++i) {
+    cpuid_json_writer w;
+    cpuid_json_init_buffer(w, b->buffer, sizeof(b->buffer), 3);
+    cpuid_json_begin_object(w);
+    cpuid_json_write_info(w, b->info);
+    cpuid_json_end_object(w);
+    cpuid_json_finish(w);
+    total += w.used;
+  }
+  b->sink = total;
+}
+
+json_bench* json_bench_new(const cpuid_info& info, size_t cpus) {
+  json_bench* b = new json_bench;
+  b->info = info;
+  cpuid_info::logical_processor_list& lps = b->info.logical_processors;
+  for (size_t n = lps.size(), i = 0; n > 0 && lps.size() < cpus; ++i) {
+    tag_logical_processor lp = lps[i % n];
+    lp.os_cpu = int(lps.size());
+    lp.apic_id += uint(lps.size() / n) << b->info.apic_id_layout.package_shift;
+    lp.package_id += uint(lps.size() / n);
+    lps.push_back(lp);
+  }
+  cpuid_group_logical_processors(b->info);
+  return b;
+}
+
+void json_bench_release(void* arg) {
+  delete (json_bench*) arg;
+}
+
+void json_bench_add(cpuid_bench_registry& registry, const char* name,
+                    cpuid_bench_body body, json_bench* b) {
+  cpuid_bench_case c = cpuid_bench_make_case(name, body, b);
+  c.release = json_bench_release;
+  registry.push_back(c);
+}
+
+void bench_json_register(cpuid_bench_registry& registry, const cpuid_info& info) {
+  json_bench_add(registry, "json/jsoncpp_tree", json_tree_body, json_bench_new(info, 0));
+  json_bench_add(registry, "json/stream", json_stream_body, json_bench_new(info, 0));
+  json_bench_add(registry, "json/jsoncpp_tree/256cpu", json_tree_body, json_bench_new(info, 256));
+  json_bench_add(registry, "json/stream/256cpu", json_stream_body, json_bench_new(info, 256));
+}
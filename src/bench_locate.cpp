@@ -0,0 +1,43 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Cost of each cpuid_locate() path.
+
+#include "bench_cases.h"
+#include "cpuid_locate.h"
+
+struct locate_bench {
+  cpuid_cpu_locator locator;
+  volatile int sink;
+};
+
+void locate_body(void* arg, uint64 iterations) {
+  locate_bench* b = (locate_bench*) arg;
+  int sum = 0;
+  for (uint64 i = 0; i < iterations; ++i) {
+    sum += cpuid_locate(b->locator).llc_index;
+  }
+  b->sink = sum;
+}
+
+void locate_bench_release(void* arg) {
+  delete (locate_bench*) arg;
+}
+
+void bench_locate_register(cpuid_bench_registry& registry, const cpuid_info& info) {
+  cpuid_locate_method methods[] = {
+    CPUID_LOCATE_RDPID, CPUID_LOCATE_RDTSCP, CPUID_LOCATE_SCHED_GETCPU
+  };
+  for (int i = 0; i < 3; ++i) {
+    if (!cpuid_locate_method_usable(info, methods[i])) continue;
+
+    locate_bench* b = new locate_bench;
+    cpuid_locator_init(b->locator, info);
+    b->locator.method = methods[i];
+    cpuid_bench_case c = cpuid_bench_make_case(
+        std::string("locate/") + cpuid_locate_method_name(methods[i]), locate_body, b);
+    c.release = locate_bench_release;
+    registry.push_back(c);
+  }
+}
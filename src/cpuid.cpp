@@ -2,7 +2,15 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
 
+#include <algorithm>
+#include <cmath>
+
 #include "cpuid.h"
+#include "cpuid_ibs.h"
+#include "cpuid_os.h"
+#include "cpuid_pmu.h"
+#include "cpuid_trace.h"
+#include "cpuid_tsc.h"
 
 ///////////////////////////////////////////////////////////////
 
@@ -67,6 +75,15 @@ int cpuid_large_cache_size(cpuid_info& info) {
 
 #define D(expr) (#expr) << " = " << (expr)
 
+// Number of bits needed to hold values in [0, n), i.e. ceil(log2(n)).
+int cpuid_bits_for_count(uint n) {
+  int bits = 0;
+  while (n > 1 && (1U << bits) < n) {
+    ++bits;
+  }
+  return bits;
+}
+
 // http://www.ibiblio.org/gferg/ldp/GCC-Inline-Assembly-HOWTO.html
 
 // http://www.intel.com/Assets/PDF/appnote/241618.pdf page 13 and 14
@@ -140,11 +157,18 @@ uint64 rdtsc_unserialized() {
 }
 #endif
 
+// CPUID is fully serializing, but slow, and traps to the hypervisor
+// in a VM; cpuid_tsc.h has cheaper fenced reads.
 uint64 rdtsc_serialized() {
   cpuid_with_eax(0);
-  uint64 ticks;
-  __asm__ __volatile__("rdtsc": "=A" (ticks));
-  return ticks;
+  return rdtsc_unserialized();
+}
+
+// Only valid when CPUID reports osxsave.
+uint64 cpuid_xgetbv(uint xcr) {
+  uint a, d;
+  __asm__ __volatile__("xgetbv" : "=a"(a), "=d"(d) : "c"(xcr));
+  return MERGE_HI_LO(d, a);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -154,9 +178,18 @@ uint64 rdtsc_serialized() {
 
 //////////////////////////////////////////////////////////////////////////////
 
+bool cpuid_has_feature(const cpuid_info& info, const char* name) {
+  cpuid_info::feature_flags::const_iterator it = info.features.find(name);
+  return it != info.features.end() && it->second;
+}
+
 void init_all_features_to_false(cpuid_info& info) {
   intel_init_all_features_to_false(info);
   amd_init_all_features_to_false(info);
+  info.features["invariant-tsc"] = false;
+  info.features["aperf-mperf"] = false;
+  info.features["os-avx"] = false;
+  info.features["os-avx512"] = false;
 }
 
 uint cpuid_vendor_id_and_max_basic_eax_input(cpuid_info& info) {
@@ -189,17 +222,92 @@ void cpuid_fill_brand_string(cpuid_info& info) {
   fill_brand_string_helper(info, 8);
 }
 
+void cpuid_summarize_samples(std::vector<uint64>& samples, tag_sample_distribution& d) {
+  d.samples = samples.size();
+  if (samples.empty()) {
+    d.min = d.median = d.p90 = d.p99 = d.max = d.mean = d.stddev = 0;
+    return;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  d.min    = double(samples[0]);
+  d.median = double(samples[n / 2]);
+  d.p90    = double(samples[(n * 90) / 100]);
+  d.p99    = double(samples[(n * 99) / 100]);
+  d.max    = double(samples[n - 1]);
+
+  double sum = 0;
+  for (size_t i = 0; i < n; ++i) sum += double(samples[i]);
+  d.mean = sum / n;
+
+  double sq = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double dev = double(samples[i]) - d.mean;
+    sq += dev * dev;
+  }
+  d.stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+}
+
+const int kTimerWarmupSamples = 1000;
+const int kTimerSamples = 5000;
+
+// The first calls pay for cold caches, TLB misses and lazy binding;
+// only samples taken after the warm-up count.
+template <uint64 (*Read)()>
+void measure_timer_overhead(cpuid_info& info, const char* name) {
+  std::vector<uint64> deltas(kTimerSamples);
+  for (int i = -kTimerWarmupSamples; i < kTimerSamples; ++i) {
+    uint64 a = Read();
+    uint64 b = Read();
+    if (i >= 0) deltas[i] = b - a;
+  }
+  cpuid_summarize_samples(deltas, info.timer_overheads[name]);
+}
+
+// The begin/end pair a region would actually be timed with.
+void measure_fenced_region_overhead(cpuid_info& info) {
+  cpuid_tsc_fences fences;
+  cpuid_tsc_select_fences(info, fences);
+
+  std::vector<uint64> deltas(kTimerSamples);
+  for (int i = -kTimerWarmupSamples; i < kTimerSamples; ++i) {
+    uint64 a = cpuid_tsc_read(fences.begin);
+    uint64 b = cpuid_tsc_read(fences.end);
+    if (i >= 0) deltas[i] = b - a;
+  }
+  cpuid_summarize_samples(deltas, info.timer_overheads["fenced_region"]);
+}
+
 void estimate_rdtsc_overhead(cpuid_info& info) {
-  uint64 a, b;
-  a = rdtsc_serialized();
-  b = rdtsc_serialized();
-  info.rdtsc_serialized_overhead_cycles = double(b - a);
+  measure_timer_overhead<rdtsc_serialized>(info, "rdtsc_serialized");
+  measure_timer_overhead<rdtsc_unserialized>(info, "rdtsc_unserialized");
+  measure_timer_overhead<cpuid_lfence_rdtsc>(info, "lfence_rdtsc");
+  measure_timer_overhead<cpuid_mfence_lfence_rdtsc>(info, "mfence_lfence_rdtsc");
+  if (info.features["rdtscp"]) {
+    measure_timer_overhead<cpuid_rdtscp_lfence>(info, "rdtscp_lfence");
+  }
+  measure_fenced_region_overhead(info);
 
-  a = rdtsc_unserialized();
-  b = rdtsc_unserialized();
-  info.rdtsc_unserialized_overhead_cycles = double(b - a);
+  info.rdtsc_serialized_overhead_cycles
+      = info.timer_overheads["rdtsc_serialized"].median;
+  info.rdtsc_unserialized_overhead_cycles
+      = info.timer_overheads["rdtsc_unserialized"].median;
 }
 
+// Choices derived from the features, kept so reports need not redo them.
+void cpuid_fill_selections(cpuid_info& info) {
+  cpuid_pmu_available_events(info, info.available_events);
+  cpuid_ibs_select(info, false, info.ibs_sampling);
+
+  cpuid_trace_request request;
+  cpuid_trace_default_request(request);
+  cpuid_trace_select(info, request, info.branch_history_trace);
+  request.every_branch = true;
+  cpuid_trace_select(info, request, info.full_trace);
+
+  cpuid_tsc_select_fences(info, info.tsc_fences);
+}
 
 bool cpuid_introspect(cpuid_info& info) {
   info.vendor_id[12] = '\0';
@@ -216,9 +324,13 @@ bool cpuid_introspect(cpuid_info& info) {
     intel_fill_processor_features(info);
     //intel_detect_processor_topology();
     intel_fill_processor_signature(info.processor_signature);
+    intel_fill_apic_id_layout(info);
   } else if (std::string("AuthenticAMD") == info.vendor_id) {
     amd_fill_processor_features(info);
     amd_fill_processor_caches(info);
+    // Leaf 1 EAX has the same layout on AMD.
+    intel_fill_processor_signature(info.processor_signature);
+    amd_fill_apic_id_layout(info);
   } else {
     // Unknown vendor ID!
     return false;
@@ -231,10 +343,202 @@ bool cpuid_introspect(cpuid_info& info) {
     info.max_linear_address_size   = MASK_RANGE_IN(eax, 15, 8);
   }
 
+  if (info.max_ext_eax >= 0x80000007) {
+    cpuid_with_eax(0x80000007);
+    info.features["invariant-tsc"] = BIT_IS_SET(edx, 8);
+  }
+
+  // The CPU supporting AVX is not enough; the OS must also save the
+  // register state, which XCR0 says it does.
+  if (info.features["osxsave"]) {
+    uint64 xcr0 = cpuid_xgetbv(0);
+    info.features["os-avx"] = (xcr0 & 0x06) == 0x06;        // SSE, AVX
+    info.features["os-avx512"] = (xcr0 & 0xE6) == 0xE6;     // + opmask, ZMM
+  }
+
+  // IA32_APERF/IA32_MPERF; same bit on both vendors.
+  if (info.max_basic_eax >= 0x6) {
+    cpuid_with_eax_and_ecx(0x6, 0);
+    info.features["aperf-mperf"] = BIT_IS_SET(ecx, 0);
+  }
+
+  // VMware and KVM report the guest's TSC frequency in leaf 0x40000010,
+  // which may differ from what leaf 0x15 claims. Other hypervisors use
+  // that leaf for something else, so check who is answering first.
+  if (info.features["hypervisor"]) {
+    cpuid_with_eax(0x40000000);
+    char signature[13];
+    memcpy(signature + 0, &ebx, 4);
+    memcpy(signature + 4, &ecx, 4);
+    memcpy(signature + 8, &edx, 4);
+    signature[12] = '\0';
+    bool frequency_leaf = !strcmp(signature, "VMwareVMware") || !strcmp(signature, "KVMKVMKVM");
+    if (frequency_leaf && eax >= 0x40000010) {
+      cpuid_with_eax(0x40000010);
+      info.processor_features.tsc_features.hypervisor_tsc_khz = eax;
+      info.processor_features.tsc_features.hypervisor_bus_khz = ebx;
+    }
+  }
+
   if (info.features["tsc"]) {
     estimate_rdtsc_overhead(info);
   }
 
+  cpuid_fill_selections(info);
   return true;
 }
 
+
+void cpuid_fill_logical_processor(cpuid_info& info, tag_logical_processor& lp) {
+  if (std::string("AuthenticAMD") == info.vendor_id) {
+    amd_read_logical_processor_ids(info, lp);
+  } else {
+    intel_read_logical_processor_ids(info, lp);
+  }
+
+  const tag_apic_id_layout& layout = info.apic_id_layout;
+  lp.smt_id     = lp.apic_id & (BIT(layout.smt_shift) - 1U);
+  lp.core_id    = lp.apic_id >> layout.smt_shift;
+  lp.l2_id      = lp.apic_id >> layout.l2_shift;
+  lp.llc_id     = lp.apic_id >> layout.llc_shift;
+  lp.die_id     = lp.apic_id >> layout.die_shift;
+  lp.package_id = lp.apic_id >> layout.package_shift;
+}
+
+bool cpuid_enumerate_logical_processors(cpuid_info& info) {
+  info.logical_processors.clear();
+
+  std::vector<int> allowed;
+  if (!cpuid_os_allowed_cpus(allowed)) {
+    // No affinity control; describe wherever we happen to be running.
+    tag_logical_processor lp;
+    lp.os_cpu = cpuid_os_current_cpu();
+    cpuid_fill_logical_processor(info, lp);
+    info.logical_processors.push_back(lp);
+    cpuid_group_logical_processors(info);
+    return false;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < allowed.size(); ++i) {
+    if (!cpuid_os_pin_current_thread(allowed[i])) {
+      ok = false;
+      continue;
+    }
+    tag_logical_processor lp;
+    lp.os_cpu = allowed[i];
+    cpuid_fill_logical_processor(info, lp);
+    info.logical_processors.push_back(lp);
+  }
+
+  cpuid_os_set_allowed_cpus(allowed);
+  cpuid_group_logical_processors(info);
+  return ok;
+}
+
+uint cpuid_domain_id(const tag_logical_processor& lp, cpuid_topology_level level) {
+  switch (level) {
+    case CPUID_LEVEL_CORE:    return lp.core_id;
+    case CPUID_LEVEL_L2:      return lp.l2_id;
+    case CPUID_LEVEL_LLC:     return lp.llc_id;
+    case CPUID_LEVEL_DIE:     return lp.die_id;
+    case CPUID_LEVEL_PACKAGE: return lp.package_id;
+  }
+  return 0;
+}
+
+std::vector<std::vector<int> > cpuid_processor_groups(const cpuid_info& info,
+                                                      cpuid_topology_level level) {
+  std::map<uint, std::vector<int> > by_id;
+  for (size_t i = 0; i < info.logical_processors.size(); ++i) {
+    const tag_logical_processor& lp = info.logical_processors[i];
+    by_id[cpuid_domain_id(lp, level)].push_back(lp.os_cpu);
+  }
+
+  std::vector<std::vector<int> > groups;
+  std::map<uint, std::vector<int> >::const_iterator it;
+  for (it = by_id.begin(); it != by_id.end(); ++it) {
+    groups.push_back(it->second);
+  }
+  return groups;
+}
+
+void cpuid_effective_capacity(const cpuid_info& info, tag_effective_capacity& cap) {
+  cap.allowed_logical_processors = info.logical_processors.size();
+  cap.allowed_physical_cores = cpuid_processor_groups(info, CPUID_LEVEL_CORE).size();
+  cap.allowed_llc_domains    = cpuid_processor_groups(info, CPUID_LEVEL_LLC).size();
+  cap.cpu_quota = cpuid_os_cpu_quota();
+
+  cap.recommended_workers = cap.allowed_logical_processors;
+  if (cap.cpu_quota > 0 && cap.cpu_quota < cap.recommended_workers) {
+    cap.recommended_workers = int(cap.cpu_quota);
+  }
+  if (cap.recommended_workers < 1) {
+    cap.recommended_workers = 1;
+  }
+}
+
+void cpuid_group_logical_processors(cpuid_info& info) {
+  for (int level = CPUID_LEVEL_CORE; level <= CPUID_LEVEL_PACKAGE; ++level) {
+    info.processor_groups[level] = cpuid_processor_groups(info, cpuid_topology_level(level));
+  }
+  cpuid_effective_capacity(info, info.effective_capacity);
+}
+
+void dump_leaf(std::vector<tag_cpuid_leaf>& leaves, uint leaf, uint subleaf) {
+  cpuid_with_eax_and_ecx(leaf, subleaf);
+  tag_cpuid_leaf l = { leaf, subleaf, eax, ebx, ecx, edx };
+  leaves.push_back(l);
+}
+
+// Whether to read the subleaf after this one, judged from the
+// registers just read. Leaves not listed have only subleaf 0.
+bool dump_next_subleaf(uint leaf, uint subleaf, uint max_subleaf) {
+  if (subleaf >= 63) return false;
+  switch (leaf) {
+    case 0x4: case 0x8000001D:           // until the null cache type
+      return MASK_RANGE_IN(eax, 4, 0) != 0;
+    case 0xB: case 0x1F:                 // until the invalid level type
+      return MASK_RANGE_IN(ecx, 15, 8) != 0;
+    case 0x7: case 0x14: case 0x17: case 0x18: case 0x1D: case 0x20:
+      return subleaf < max_subleaf;      // subleaf 0 EAX is the last one
+    case 0xD:                            // XSAVE components 2..62
+      return true;
+    case 0xF: case 0x10: case 0x12:
+      return subleaf < 7;
+  }
+  return false;
+}
+
+void dump_range(std::vector<tag_cpuid_leaf>& leaves, uint first, uint last) {
+  for (uint leaf = first; leaf <= last; ++leaf) {
+    size_t at = leaves.size();
+    dump_leaf(leaves, leaf, 0);
+    uint max_subleaf = leaves[at].eax;
+    uint subleaf = 0;
+    while (dump_next_subleaf(leaf, subleaf, max_subleaf)) {
+      dump_leaf(leaves, leaf, ++subleaf);
+      // XSAVE components, RDT resources and SGX EPC sections are
+      // sparse; keep only the ones that exist.
+      bool sparse = (leaf == 0xD && subleaf >= 2) || leaf == 0xF || leaf == 0x10
+                 || leaf == 0x12;
+      if (sparse && !eax && !ebx && !ecx && !edx) leaves.pop_back();
+    }
+  }
+}
+
+void cpuid_dump_leaves(const cpuid_info& info, std::vector<tag_cpuid_leaf>& leaves) {
+  leaves.clear();
+  dump_range(leaves, 0, info.max_basic_eax);
+
+  // Leaf 0x40000000 answers with the highest hypervisor leaf only
+  // under a hypervisor; on bare metal it echoes the top basic leaf.
+  cpuid_with_eax(0x40000000);
+  uint max_hv = eax;
+  if (max_hv >= 0x40000000 && max_hv <= 0x400000FF) {
+    dump_range(leaves, 0x40000000, max_hv);
+  }
+  if (info.max_ext_eax >= 0x80000000 && info.max_ext_eax <= 0x800000FF) {
+    dump_range(leaves, 0x80000000, info.max_ext_eax);
+  }
+}
@@ -20,9 +20,59 @@ struct cpuid_info;
 
 bool cpuid_introspect(cpuid_info&);
 
+uint64 rdtsc_serialized();
+uint64 rdtsc_unserialized();
+
+struct tag_sample_distribution;
+
+// Sorts `samples` in place and fills in order statistics and moments.
+void cpuid_summarize_samples(std::vector<uint64>& samples, tag_sample_distribution&);
+
+// True if the feature is recorded and set. Unlike info.features[name],
+// this never adds the name to the map.
+bool cpuid_has_feature(const cpuid_info&, const char* name);
+
 int cpuid_small_cache_size(cpuid_info&);
 int cpuid_large_cache_size(cpuid_info&);
 
+// Runs CPUID on every CPU the calling thread may use, filling
+// info.logical_processors. Requires a prior cpuid_introspect().
+// The caller's affinity mask is restored before returning.
+bool cpuid_enumerate_logical_processors(cpuid_info&);
+
+enum cpuid_topology_level {
+  CPUID_LEVEL_CORE,
+  CPUID_LEVEL_L2,
+  CPUID_LEVEL_LLC,     // a CCX on AMD Zen
+  CPUID_LEVEL_DIE,     // a CCD on AMD Zen
+  CPUID_LEVEL_PACKAGE
+};
+
+// OS CPU indices of the enumerated logical processors, grouped by the
+// domain they share at the given level. Groups are ordered by ID.
+std::vector<std::vector<int> > cpuid_processor_groups(const cpuid_info&,
+                                                      cpuid_topology_level);
+
+struct tag_effective_capacity;
+
+// What this process can actually use, as opposed to what the package
+// has: the allowed CPUs (cpuset/affinity) mapped onto cores and LLC
+// domains, and the cgroup CPU quota. Requires a prior
+// cpuid_enumerate_logical_processors().
+void cpuid_effective_capacity(const cpuid_info&, tag_effective_capacity&);
+
+// Recomputes info.processor_groups and info.effective_capacity from
+// info.logical_processors. cpuid_enumerate_logical_processors() calls
+// it; call it again after editing the list.
+void cpuid_group_logical_processors(cpuid_info&);
+
+struct tag_cpuid_leaf;
+
+// The raw registers of every leaf and subleaf the calling CPU reports,
+// in the basic, hypervisor and extended ranges, ordered by (leaf,
+// subleaf). Requires a prior cpuid_introspect().
+void cpuid_dump_leaves(const cpuid_info&, std::vector<tag_cpuid_leaf>&);
+
 /////////////////////////////////////////////////////////////////////
 
 struct tag_processor_features {
@@ -38,10 +88,108 @@ struct tag_processor_features {
     int version_id;
     int gp_counters_per_processor;
     int gp_counter_bitwidth;
-    int gp_counter_events;
+    int gp_counter_events;           // length of the EBX bit vector
+    uint arch_events_unavailable;    // CPUID 0xA EBX; bit set = not available
     int ff_counter_bitwidth;
-    int ff_counter_count;
+    int ff_counter_count;            // contiguous fixed counters, EDX[4:0]
+    uint ff_counter_mask;            // CPUID 0xA ECX; v5+, may have holes
+    bool any_thread_deprecated;      // CPUID 0xA EDX[15]
   } pm_features;
+
+  // All zero unless "processor-trace" is set.
+  struct tag_pt_features {
+    int max_subleaf;                 // CPUID 0x14.0 EAX
+    bool cr3_filtering;              // EBX[0]
+    bool psb_cyc_configurable;       // EBX[1] PSB frequency and cycle-accurate mode
+    bool ip_filtering;               // EBX[2] IP filtering and TraceStop
+    bool mtc;                        // EBX[3] mini time counter packets
+    bool ptwrite;                    // EBX[4]
+    bool power_event_trace;          // EBX[5]
+    bool psb_pmi_preservation;       // EBX[6]
+    bool event_trace;                // EBX[7]
+    bool tnt_disable;                // EBX[8]
+    bool topa;                       // ECX[0] table of physical addresses output
+    bool topa_multiple_entries;      // ECX[1] ToPA tables may have many entries
+    bool single_range_output;        // ECX[2]
+    bool trace_transport_output;     // ECX[3]
+    bool lip;                        // ECX[31] IPs are linear, not effective
+    int address_ranges;              // CPUID 0x14.1 EAX[2:0]
+    uint mtc_period_mask;            // EAX[31:16]; bit n = encoding n allowed
+    uint cycle_threshold_mask;       // EBX[15:0]
+    uint psb_frequency_mask;         // EBX[31:16]
+  } pt_features;
+
+  // All zero unless "arch-lbr" is set.
+  struct tag_arch_lbr_features {
+    uint depth_mask;                 // CPUID 0x1C EAX[7:0]; bit n = depth 8*(n+1)
+    bool deep_c_state_reset;         // EAX[30] records may be lost in deep C-states
+    bool lip;                        // EAX[31]
+    bool cpl_filtering;              // EBX[0]
+    bool branch_filtering;           // EBX[1]
+    bool call_stack;                 // EBX[2] call-stack mode
+    bool mispredict;                 // ECX[0] mispredict bit per record
+    bool timed_lbr;                  // ECX[1] cycle counts per record
+    bool branch_type;                // ECX[2] branch type per record
+    uint event_logging_mask;         // ECX[19:16]; counters loggable per record
+  } arch_lbr_features;
+
+  // AMD Instruction-Based Sampling, CPUID 0x8000001B EAX. All zero
+  // unless "ibs" is set.
+  struct tag_ibs_features {
+    bool flags_valid;                // EAX[0]
+    bool fetch_sampling;             // EAX[1]
+    bool op_sampling;                // EAX[2]
+    bool op_counter_rw;              // EAX[3] IbsOpCurCnt readable and writable
+    bool op_counting;                // EAX[4] count dispatched ops, not cycles
+    bool branch_target;              // EAX[5] IbsBrTarget
+    bool op_count_extended;          // EAX[6] MaxCnt/CurCnt widened by 7 bits
+    bool rip_invalid_check;          // EAX[7] IbsRipInvalid
+    bool op_branch_fuse;             // EAX[8] fused branch indication
+    bool fetch_control_extended;     // EAX[9] IBS_FETCH_CTL_EXTD
+    bool op_data4;                   // EAX[10] IBS_OP_DATA4
+    bool l3_miss_filtering;          // EAX[11] sample only L3 misses
+  } ibs_features;
+
+  struct tag_amd_topology_features {
+    int threads_per_package;         // CPUID 0x80000008 ECX[7:0] + 1; NC counts
+                                     // threads, not cores, on family 17h+
+    int apic_id_core_id_size;        // CPUID 0x80000008 ECX[15:12]
+    int threads_per_compute_unit;    // CPUID 0x8000001E EBX[15:8] + 1
+    int nodes_per_processor;         // CPUID 0x8000001E ECX[10:8] + 1
+  } amd_topology;
+
+  struct tag_tsc_features {
+    uint crystal_ratio_denominator;  // CPUID 0x15 EAX
+    uint crystal_ratio_numerator;    // CPUID 0x15 EBX
+    uint crystal_hz;                 // CPUID 0x15 ECX; 0 if not enumerated
+    int base_mhz;                    // CPUID 0x16 EAX
+    int max_mhz;                     // CPUID 0x16 EBX
+    int bus_mhz;                     // CPUID 0x16 ECX
+    uint hypervisor_tsc_khz;         // CPUID 0x40000010 EAX
+    uint hypervisor_bus_khz;         // CPUID 0x40000010 EBX
+  } tsc_features;
+};
+
+// Number of low APIC ID bits to shift out to get the ID of the
+// enclosing domain at each level. Uniform across a system.
+struct tag_apic_id_layout {
+  int smt_shift;
+  int l2_shift;
+  int llc_shift;
+  int die_shift;
+  int package_shift;
+};
+
+struct tag_logical_processor {
+  int  os_cpu;     // index used by the OS scheduler
+  uint apic_id;    // x2APIC ID, or AMD extended APIC ID
+  uint smt_id;     // thread index within its core
+  uint core_id;    // IDs below are unique system-wide, not per package
+  uint l2_id;
+  uint llc_id;
+  uint die_id;
+  uint node_id;    // AMD node ID (CPUID 0x8000001E ECX[7:0]); else package
+  uint package_id;
 };
 
 struct tag_processor_cache_descriptor {
@@ -84,6 +232,96 @@ struct tag_processor_cache_parameter_set {
   int size_in_bytes;
 };
 
+struct tag_sample_distribution {
+  int samples;
+  double min;
+  double median;
+  double p90;
+  double p99;
+  double max;
+  double mean;
+  double stddev;
+};
+
+struct tag_effective_capacity {
+  int allowed_logical_processors;
+  int allowed_physical_cores;   // cores with at least one allowed thread
+  int allowed_llc_domains;      // LLC domains with at least one allowed thread
+  double cpu_quota;             // CPUs' worth of CFS bandwidth; -1 if unlimited
+
+  // Allowed logical processors, capped by the quota rounded down (a
+  // pool sized to the rounded-up quota is throttled every period).
+  int recommended_workers;
+};
+
+// The choices below are made once by cpuid_introspect() and kept in
+// cpuid_info, so code that only reports them never recomputes them.
+// The functions that make them are in cpuid_pmu.h, cpuid_ibs.h,
+// cpuid_trace.h and cpuid_tsc.h.
+
+struct cpuid_pmu_event_spec {
+  std::string name;
+  uint type;         // PERF_TYPE_*
+  uint64 config;
+  int fixed_counter; // fixed counter that can count it, or -1
+};
+
+struct cpuid_ibs_config {
+  const char* pmu;             // "ibs_op", "ibs_fetch" or NULL
+  uint64 perf_config;
+  uint64 max_period;           // largest sample period the counter holds
+  bool count_ops;              // period in dispatched ops, else cycles
+  bool l3_miss_only;
+  bool branch_target;          // samples carry the taken target
+  bool rip_invalid_check;      // discard samples flagged IbsRipInvalid
+  std::string reason;          // why pmu is NULL
+};
+
+enum cpuid_trace_method {
+  CPUID_TRACE_NONE,
+  CPUID_TRACE_ARCH_LBR,
+  CPUID_TRACE_PT
+};
+
+enum cpuid_trace_output {
+  CPUID_TRACE_OUTPUT_NONE,
+  CPUID_TRACE_OUTPUT_SINGLE_RANGE,
+  CPUID_TRACE_OUTPUT_TOPA_MULTI,
+  CPUID_TRACE_OUTPUT_TOPA_SINGLE
+};
+
+struct cpuid_trace_config {
+  cpuid_trace_method method;
+
+  // Processor Trace.
+  cpuid_trace_output output;
+  bool mtc;
+  int mtc_period;          // encoding; -1 without MTC
+  bool cyc;
+  int cyc_threshold;       // encoding; -1 without CYC
+  int psb_frequency;       // encoding; -1 if not configurable
+  bool ptwrite;
+  int address_filters;
+
+  // Architectural LBR.
+  int lbr_depth;
+  bool lbr_call_stack;
+
+  std::string reason;      // why method is NONE, or what was left out
+};
+
+enum cpuid_tsc_read_kind {
+  CPUID_TSC_RDTSC,                 // no ordering at all
+  CPUID_TSC_LFENCE_RDTSC,
+  CPUID_TSC_RDTSCP_LFENCE,
+  CPUID_TSC_MFENCE_LFENCE_RDTSC
+};
+
+struct cpuid_tsc_fences {
+  cpuid_tsc_read_kind begin;
+  cpuid_tsc_read_kind end;
+};
+
 struct tag_processor_signature {
   uint full_bit_string;
   uint extended_family;
@@ -94,13 +332,27 @@ struct tag_processor_signature {
   uint stepping_id;
 };
 
+struct tag_cpuid_leaf {
+  uint leaf;
+  uint subleaf;
+  uint eax, ebx, ecx, edx;
+};
+
 struct cpuid_info {
   cpuid_info() {
     memset(brand_string,        0, sizeof(brand_string));
     memset(vendor_id,           0, sizeof(vendor_id));
     memset(&processor_signature, 0xFF, sizeof(processor_signature));
+    memset(&processor_features,  0, sizeof(processor_features));
+    memset(&apic_id_layout,      0, sizeof(apic_id_layout));
     rdtsc_serialized_overhead_cycles = -1;
     rdtsc_unserialized_overhead_cycles = -1;
+    ibs_sampling.pmu = NULL;
+    branch_history_trace.method = CPUID_TRACE_NONE;
+    full_trace.method = CPUID_TRACE_NONE;
+    tsc_fences.begin = tsc_fences.end = CPUID_TSC_RDTSC;
+    memset(&effective_capacity, 0, sizeof(effective_capacity));
+    effective_capacity.cpu_quota = -1;
   }
 
   // A Core i7 has the following basic leafs, by EAX value:
@@ -115,19 +367,40 @@ struct cpuid_info {
   int max_physical_address_size;
   int cache_line_size;
   int cache_size_bytes;
-  double rdtsc_serialized_overhead_cycles;
+  double rdtsc_serialized_overhead_cycles;    // median of timer_overheads entry
   double rdtsc_unserialized_overhead_cycles;
 
+  // Cycles between back-to-back reads of each timing primitive, after
+  // warm-up, keyed by primitive name.
+  typedef std::map<std::string, tag_sample_distribution> timer_overhead_map;
+  timer_overhead_map timer_overheads;
+
   typedef std::vector<tag_processor_cache_parameter_set> cache_parameters;
   cache_parameters processor_cache_parameters;
 
   tag_processor_features           processor_features;
   tag_processor_signature          processor_signature;
   tag_processor_cache_descriptors  processor_cache_descriptors;
+  tag_apic_id_layout               apic_id_layout;
+
+  typedef std::vector<tag_logical_processor> logical_processor_list;
+  logical_processor_list logical_processors;
 
   typedef std::map<std::string, bool> feature_flags;
   feature_flags features;
 
+  // Filled by cpuid_introspect().
+  std::vector<cpuid_pmu_event_spec> available_events;
+  cpuid_ibs_config ibs_sampling;               // without L3-miss filtering
+  cpuid_trace_config branch_history_trace;     // the default request
+  cpuid_trace_config full_trace;               // ...with every_branch
+  cpuid_tsc_fences tsc_fences;
+
+  // Filled by cpuid_enumerate_logical_processors(); indexed by
+  // cpuid_topology_level.
+  std::vector<std::vector<int> > processor_groups[CPUID_LEVEL_PACKAGE + 1];
+  tag_effective_capacity effective_capacity;
+
   char brand_string[48];
   char vendor_id[13];
 };
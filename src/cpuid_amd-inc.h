@@ -14,15 +14,25 @@ feature_bit amd_feature_bits[] = {
   { EDX, 28, "htt" },
 
   { ECX,  0, "sse3" },
+  { ECX,  1, "pclmuldq" },
   { ECX,  3, "monitor" },
   { ECX,  9, "ssse3" },
+  { ECX, 12, "fma" },
   { ECX, 13, "cx16" },
   { ECX, 19, "sse41" },
+  { ECX, 20, "sse42" },
   { ECX, 23, "popcnt" },
-  { ECX, 31, "raz" }
+  { ECX, 25, "aes" },
+  { ECX, 26, "xsave" },
+  { ECX, 27, "osxsave" },
+  { ECX, 28, "avx" },
+  { ECX, 29, "f16c" },
+  { ECX, 31, "hypervisor" }
 };
 
 feature_bit amd_ext_feature_bits[] = { // EAX = 0x80000001
+  { ECX, 23, "perfctr-core" },
+  { ECX, 22, "topoext" },
   { ECX, 10, "ibs" },
   { ECX,  8, "3dnowprefetch" },
   { ECX,  7, "misalignsse" },
@@ -41,6 +51,28 @@ feature_bit amd_ext_feature_bits[] = { // EAX = 0x80000001
   { EDX,  3, "pse" }
 };
 
+feature_bit amd_st_ext_feature_bits[] = { // EAX = 0x7, ECX = 0
+  { EBX,  3, "bmi1" },
+  { EBX,  5, "avx2" },
+  { EBX,  8, "bmi2" },
+  { EBX, 16, "avx512f" },
+  { EBX, 17, "avx512dq" },
+  { EBX, 18, "rdseed" },
+  { EBX, 19, "adx" },
+  { EBX, 29, "sha-ext" },
+  { EBX, 30, "avx512bw" },
+  { EBX, 31, "avx512vl" },
+  { ECX, 22, "rdpid" }
+};
+
+feature_bit amd_ext2_feature_bits[] = { // EAX = 0x80000021
+  { EAX,  2, "lfence-serializing" }
+};
+
+feature_bit amd_perfmon_feature_bits[] = { // EAX = 0x80000022
+  { EAX,  0, "perfmon-v2" }
+};
+
 void amd_init_all_features_to_false(cpuid_info& info) {
   for (int i = 0; i < ARRAY_SIZE(amd_feature_bits); ++i) {
     info.features[amd_feature_bits[i].name] = false;
@@ -48,6 +80,116 @@ void amd_init_all_features_to_false(cpuid_info& info) {
   for (int i = 0; i < ARRAY_SIZE(amd_ext_feature_bits); ++i) {
     info.features[amd_ext_feature_bits[i].name] = false;
   }
+  for (int i = 0; i < ARRAY_SIZE(amd_st_ext_feature_bits); ++i) {
+    info.features[amd_st_ext_feature_bits[i].name] = false;
+  }
+  for (int i = 0; i < ARRAY_SIZE(amd_ext2_feature_bits); ++i) {
+    info.features[amd_ext2_feature_bits[i].name] = false;
+  }
+  for (int i = 0; i < ARRAY_SIZE(amd_perfmon_feature_bits); ++i) {
+    info.features[amd_perfmon_feature_bits[i].name] = false;
+  }
+}
+
+uint amd_family(uint signature) {
+  uint family = MASK_RANGE_IN(signature, 11, 8);
+  if (family == 0xF) {
+    family += MASK_RANGE_IN(signature, 27, 20);
+  }
+  return family;
+}
+
+uint amd_model(uint signature) {
+  return (MASK_RANGE_IN(signature, 19, 16) << 4) | MASK_RANGE_IN(signature, 7, 4);
+}
+
+// Precondition: amd_ext_feature_bits filled
+void amd_fill_topology_features(cpuid_info& info) {
+  tag_processor_features::tag_amd_topology_features& topo
+      = info.processor_features.amd_topology;
+
+  topo.threads_per_package = 1;
+  topo.apic_id_core_id_size = 0;
+  topo.threads_per_compute_unit = 1;
+  topo.nodes_per_processor = 1;
+
+  if (info.max_ext_eax >= 0x80000008) {
+    cpuid_with_eax(0x80000008);
+    topo.threads_per_package        = MASK_RANGE_IN(ecx, 7, 0) + 1;
+    topo.apic_id_core_id_size       = MASK_RANGE_IN(ecx, 15, 12);
+  }
+
+  if (info.features["topoext"] && info.max_ext_eax >= 0x8000001E) {
+    cpuid_with_eax(0x8000001E);
+    topo.threads_per_compute_unit = MASK_RANGE_IN(ebx, 15, 8) + 1;
+    topo.nodes_per_processor      = MASK_RANGE_IN(ecx, 10, 8) + 1;
+  }
+}
+
+// Number of threads sharing the cache at the given level, from the
+// cache topology leaf 0x8000001D; 0 if unknown.
+int amd_cache_sharing_threads(cpuid_info& info, int level) {
+  if (!info.features["topoext"] || info.max_ext_eax < 0x8000001D) {
+    return 0;
+  }
+
+  int sharing = 0;
+  for (uint in_ecx = 0; in_ecx < 8; ++in_ecx) {
+    cpuid_with_eax_and_ecx(0x8000001D, in_ecx);
+    if (MASK_RANGE_IN(eax, 4, 0) == 0) break;
+    if (int(MASK_RANGE_IN(eax, 7, 5)) == level) {
+      sharing = MASK_RANGE_IN(eax, 25, 14) + 1;
+    }
+  }
+  return sharing;
+}
+
+// Precondition: amd_fill_topology_features done
+void amd_fill_apic_id_layout(cpuid_info& info) {
+  tag_processor_features::tag_amd_topology_features& topo
+      = info.processor_features.amd_topology;
+  tag_apic_id_layout& layout = info.apic_id_layout;
+
+  layout.smt_shift = cpuid_bits_for_count(topo.threads_per_compute_unit);
+
+  // A zero ApicIdCoreIdSize means the legacy method applies.
+  if (topo.apic_id_core_id_size != 0) {
+    layout.package_shift = topo.apic_id_core_id_size;
+  } else {
+    layout.package_shift = cpuid_bits_for_count(
+        info.processor_features.logical_processors_per_physical_processor_package);
+  }
+
+  int l2_sharing  = amd_cache_sharing_threads(info, 2);
+  int llc_sharing = amd_cache_sharing_threads(info, 3);
+  layout.l2_shift  = l2_sharing  ? cpuid_bits_for_count(l2_sharing)  : layout.smt_shift;
+  layout.llc_shift = llc_sharing ? cpuid_bits_for_count(llc_sharing) : layout.package_shift;
+
+  // CPUID does not enumerate CCDs. Zen and Zen 2 put two CCXs on each
+  // die; Zen 3 and later have one CCX per CCD, except Zen 4c which
+  // went back to two.
+  cpuid_with_eax(1);
+  uint family = amd_family(eax);
+  uint model  = amd_model(eax);
+  bool two_ccx_per_ccd = (family == 0x17)
+                      || (family == 0x19 && model >= 0xA0 && model <= 0xAF);
+  layout.die_shift = layout.llc_shift + (two_ccx_per_ccd && llc_sharing ? 1 : 0);
+  if (layout.die_shift > layout.package_shift) {
+    layout.die_shift = layout.package_shift;
+  }
+}
+
+// Runs on the logical processor being described.
+void amd_read_logical_processor_ids(cpuid_info& info, tag_logical_processor& lp) {
+  if (info.features["topoext"] && info.max_ext_eax >= 0x8000001E) {
+    cpuid_with_eax(0x8000001E);
+    lp.apic_id = eax;
+    lp.node_id = MASK_RANGE_IN(ecx, 7, 0);
+  } else {
+    cpuid_with_eax(1);
+    lp.apic_id = MASK_RANGE_IN(ebx, 31, 24);
+    lp.node_id = lp.apic_id >> info.apic_id_layout.package_shift;
+  }
 }
 
 void amd_fill_processor_features(cpuid_info& info) {
@@ -63,6 +205,8 @@ void amd_fill_processor_features(cpuid_info& info) {
   } else {
     info.processor_features.logical_processors_per_physical_processor_package = 1;
   }
+  info.processor_features.max_logical_processors_per_physical_processor_package
+      = info.processor_features.logical_processors_per_physical_processor_package;
 
   cpuid_with_eax(0x80000001);
   for (int i = 0; i < ARRAY_SIZE(amd_ext_feature_bits); ++i) {
@@ -70,6 +214,52 @@ void amd_fill_processor_features(cpuid_info& info) {
     info.features[f.name] = BIT_IS_SET(reg[f.reg], f.offset);
   }
 
+  // PerfMonV2 parts enumerate their core counters; before that,
+  // perfctr-core means six and its absence the legacy four.
+  if (info.max_ext_eax >= 0x80000022) {
+    cpuid_with_eax(0x80000022);
+    for (int i = 0; i < ARRAY_SIZE(amd_perfmon_feature_bits); ++i) {
+      feature_bit f(amd_perfmon_feature_bits[i]);
+      info.features[f.name] = BIT_IS_SET(reg[f.reg], f.offset);
+    }
+    if (info.features["perfmon-v2"]) {
+      info.processor_features.pm_features.gp_counters_per_processor = MASK_RANGE_IN(ebx, 3, 0);
+    }
+  }
+
+  if (info.max_basic_eax >= 0x7) {
+    cpuid_with_eax_and_ecx(0x7, 0);
+    for (int i = 0; i < ARRAY_SIZE(amd_st_ext_feature_bits); ++i) {
+      feature_bit f(amd_st_ext_feature_bits[i]);
+      info.features[f.name] = BIT_IS_SET(reg[f.reg], f.offset);
+    }
+  }
+
+  if (info.features["ibs"] && info.max_ext_eax >= 0x8000001B) {
+    tag_processor_features::tag_ibs_features& ibs = info.processor_features.ibs_features;
+    cpuid_with_eax(0x8000001B);
+    ibs.flags_valid            = BIT_IS_SET(eax, 0);
+    ibs.fetch_sampling         = BIT_IS_SET(eax, 1);
+    ibs.op_sampling            = BIT_IS_SET(eax, 2);
+    ibs.op_counter_rw          = BIT_IS_SET(eax, 3);
+    ibs.op_counting            = BIT_IS_SET(eax, 4);
+    ibs.branch_target          = BIT_IS_SET(eax, 5);
+    ibs.op_count_extended      = BIT_IS_SET(eax, 6);
+    ibs.rip_invalid_check      = BIT_IS_SET(eax, 7);
+    ibs.op_branch_fuse         = BIT_IS_SET(eax, 8);
+    ibs.fetch_control_extended = BIT_IS_SET(eax, 9);
+    ibs.op_data4               = BIT_IS_SET(eax, 10);
+    ibs.l3_miss_filtering      = BIT_IS_SET(eax, 11);
+  }
+
+  if (info.max_ext_eax >= 0x80000021) {
+    cpuid_with_eax(0x80000021);
+    for (int i = 0; i < ARRAY_SIZE(amd_ext2_feature_bits); ++i) {
+      feature_bit f(amd_ext2_feature_bits[i]);
+      info.features[f.name] = BIT_IS_SET(reg[f.reg], f.offset);
+    }
+  }
+
   if (info.features["monitor"]) {
     cpuid_with_eax(5);
     info.processor_features.monitor_features.min_line_size = MASK_RANGE_IN(eax, 15, 0);
@@ -78,6 +268,8 @@ void amd_fill_processor_features(cpuid_info& info) {
     info.processor_features.monitor_features.min_line_size = 0;
     info.processor_features.monitor_features.max_line_size = 0;
   }
+
+  amd_fill_topology_features(info);
 }
 
 
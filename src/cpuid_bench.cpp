@@ -0,0 +1,265 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <cstring>
+
+#include "cpuid_bench.h"
+#include "cpuid_os.h"
+
+void cpuid_bench_default_options(cpuid_bench_options& o) {
+  o.cpu = -1;
+  o.warmup_ms = 50;
+  o.target_sample_us = 100;
+  o.min_samples = 30;
+  o.max_samples = 2000;
+  o.max_seconds = 2.0;
+  o.stable_change = 0.005;
+  o.use_pmu = true;
+  o.events.clear();
+  o.topdown = false;
+}
+
+cpuid_bench_case cpuid_bench_make_case(const std::string& name,
+                                       cpuid_bench_body body, void* arg) {
+  cpuid_bench_case c;
+  c.name = name;
+  c.body = body;
+  c.arg = arg;
+  c.setup = NULL;
+  c.teardown = NULL;
+  c.release = NULL;
+  return c;
+}
+
+void cpuid_bench_registry_free(cpuid_bench_registry& registry) {
+  for (size_t i = 0; i < registry.size(); ++i) {
+    if (registry[i].release) registry[i].release(registry[i].arg);
+  }
+  registry.clear();
+}
+
+#ifdef __linux__
+int bench_perf_open(uint64 config, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = group_fd < 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+void bench_pmu_open(cpuid_bench_context& ctx) {
+  ctx.pmu_fd = bench_perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+  if (ctx.pmu_fd < 0) return;
+  ctx.pmu_instructions_fd = bench_perf_open(PERF_COUNT_HW_INSTRUCTIONS, ctx.pmu_fd);
+  if (ctx.pmu_instructions_fd < 0) {
+    close(ctx.pmu_fd);
+    ctx.pmu_fd = -1;
+  }
+}
+
+void bench_pmu_start(cpuid_bench_context& ctx) {
+  ioctl(ctx.pmu_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(ctx.pmu_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// Returns false if the counts could not be read.
+bool bench_pmu_stop(cpuid_bench_context& ctx, uint64& cycles, uint64& instructions) {
+  ioctl(ctx.pmu_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  uint64 values[3];
+  if (read(ctx.pmu_fd, values, sizeof(values)) != sizeof(values) || values[0] != 2) {
+    return false;
+  }
+  cycles = values[1];
+  instructions = values[2];
+  return true;
+}
+
+void bench_pmu_close(cpuid_bench_context& ctx) {
+  if (ctx.pmu_instructions_fd >= 0) close(ctx.pmu_instructions_fd);
+  if (ctx.pmu_fd >= 0) close(ctx.pmu_fd);
+}
+#else
+void bench_pmu_open(cpuid_bench_context&) {}
+void bench_pmu_start(cpuid_bench_context&) {}
+bool bench_pmu_stop(cpuid_bench_context&, uint64&, uint64&) { return false; }
+void bench_pmu_close(cpuid_bench_context&) {}
+#endif
+
+bool cpuid_bench_init(cpuid_bench_context& ctx, cpuid_info& info,
+                      const cpuid_bench_options& options) {
+  ctx.info = &info;
+  ctx.options = options;
+  ctx.pmu_fd = -1;
+  ctx.pmu_instructions_fd = -1;
+  ctx.use_schedule = false;
+  ctx.topdown.method = CPUID_TOPDOWN_UNSUPPORTED;
+  ctx.topdown.reason = "not requested";
+
+  if (options.cpu >= 0 && !cpuid_os_pin_current_thread(options.cpu)) {
+    return false;
+  }
+  if (!cpuid_tsc_clock_init(ctx.clock, info)) {
+    return false;
+  }
+  cpuid_tsc_select_fences(info, ctx.fences);
+
+  cpuid_info::timer_overhead_map::const_iterator it
+      = info.timer_overheads.find("fenced_region");
+  ctx.overhead_cycles = it != info.timer_overheads.end() ? it->second.median : 0;
+
+  // Top-down events join the requested ones, without duplicates.
+  std::vector<cpuid_pmu_event_spec> events = options.events;
+  if (options.use_pmu && options.topdown && cpuid_topdown_select(info, ctx.topdown)) {
+    for (size_t i = 0; i < ctx.topdown.events.size(); ++i) {
+      size_t k = 0;
+      while (k < events.size() && events[k].name != ctx.topdown.events[i].name) ++k;
+      if (k == events.size()) events.push_back(ctx.topdown.events[i]);
+    }
+  }
+
+  // Counters open on the calling thread, which then runs every sample.
+  if (options.use_pmu && !events.empty()) {
+    ctx.use_schedule = cpuid_pmu_schedule_init(ctx.schedule, info, events);
+    if (!ctx.use_schedule && ctx.topdown.method != CPUID_TOPDOWN_UNSUPPORTED) {
+      ctx.topdown.method = CPUID_TOPDOWN_UNSUPPORTED;
+      ctx.topdown.reason = ctx.schedule.reason;
+    }
+  } else if (options.use_pmu) {
+    bench_pmu_open(ctx);
+  }
+  return true;
+}
+
+void cpuid_bench_free(cpuid_bench_context& ctx) {
+  bench_pmu_close(ctx);
+  ctx.pmu_fd = ctx.pmu_instructions_fd = -1;
+  if (ctx.use_schedule) cpuid_pmu_schedule_free(ctx.schedule);
+  ctx.use_schedule = false;
+}
+
+uint64 bench_sample(cpuid_bench_context& ctx, cpuid_bench_body body, void* arg,
+                    uint64 iterations) {
+  uint64 start = cpuid_tsc_read(ctx.fences.begin);
+  body(arg, iterations);
+  uint64 end = cpuid_tsc_read(ctx.fences.end);
+
+  uint64 elapsed = end - start;
+  uint64 overhead = uint64(ctx.overhead_cycles);
+  return elapsed > overhead ? elapsed - overhead : 0;
+}
+
+double bench_median(std::vector<uint64> samples) {
+  tag_sample_distribution d;
+  cpuid_summarize_samples(samples, d);
+  return d.median;
+}
+
+bool cpuid_bench_measure(cpuid_bench_context& ctx, const char* name,
+                         cpuid_bench_body body, void* arg, cpuid_bench_result& r) {
+  const cpuid_bench_options& o = ctx.options;
+  r.name = name;
+  r.cpu = cpuid_os_current_cpu();
+  r.instructions_per_cycle = -1;
+  r.counters.clear();
+  r.has_topdown = false;
+  r.stable = false;
+  if (ctx.use_schedule) cpuid_pmu_schedule_reset(ctx.schedule);
+
+  // Warm up caches, branch predictors and clock frequency.
+  double hz = double(ctx.clock.tsc_hz);
+  uint64 warmup_until = cpuid_rdtsc() + uint64(o.warmup_ms * 1e-3 * hz);
+  uint64 iterations = 1;
+  while (cpuid_rdtsc() < warmup_until) {
+    body(arg, iterations);
+  }
+
+  // Grow the sample until it is long enough to swamp the fences.
+  uint64 target = uint64(o.target_sample_us * 1e-6 * hz);
+  if (target < uint64(ctx.overhead_cycles) * 1000) {
+    target = uint64(ctx.overhead_cycles) * 1000;
+  }
+  while (bench_sample(ctx, body, arg, iterations) < target
+         && iterations < (1ULL << 40)) {
+    iterations *= 2;
+  }
+  r.iterations_per_sample = iterations;
+
+  std::vector<uint64> samples;
+  uint64 pmu_cycles = 0, pmu_instructions = 0;
+  bool pmu_ok = ctx.pmu_fd >= 0;
+  uint64 deadline = cpuid_rdtsc() + uint64(o.max_seconds * hz);
+  const int kBatch = 10;
+  double last_median = -1;
+  while (int(samples.size()) < o.max_samples) {
+    for (int i = 0; i < kBatch; ++i) {
+      if (ctx.use_schedule) {
+        cpuid_pmu_schedule_begin(ctx.schedule);
+        samples.push_back(bench_sample(ctx, body, arg, iterations));
+        cpuid_pmu_schedule_end(ctx.schedule);
+        continue;
+      }
+      if (pmu_ok) bench_pmu_start(ctx);
+      samples.push_back(bench_sample(ctx, body, arg, iterations));
+      uint64 c = 0, n = 0;
+      if (pmu_ok && bench_pmu_stop(ctx, c, n)) {
+        pmu_cycles += c;
+        pmu_instructions += n;
+      } else {
+        pmu_ok = false;
+      }
+    }
+
+    if (int(samples.size()) < o.min_samples) continue;
+    double median = bench_median(samples);
+    if (last_median > 0 && median > 0
+        && (median > last_median ? median - last_median : last_median - median)
+           / median < o.stable_change) {
+      r.stable = true;
+      break;
+    }
+    last_median = median;
+    if (cpuid_rdtsc() > deadline) break;
+  }
+
+  tag_sample_distribution d;
+  cpuid_summarize_samples(samples, d);
+  double per = 1.0 / double(iterations);
+  d.min *= per; d.median *= per; d.p90 *= per; d.p99 *= per;
+  d.max *= per; d.mean *= per; d.stddev *= per;
+  r.tsc_cycles_per_iteration = d;
+  r.ns_per_iteration = d.median * 1e9 / hz;
+  if (pmu_ok && pmu_cycles > 0) {
+    r.instructions_per_cycle = double(pmu_instructions) / double(pmu_cycles);
+  }
+
+  if (ctx.use_schedule) {
+    cpuid_pmu_schedule_results(ctx.schedule, r.counters);
+    double cycles = 0, instructions = 0;
+    for (size_t i = 0; i < r.counters.size(); ++i) {
+      r.counters[i].mean *= per;
+      r.counters[i].standard_error *= per;
+      if (r.counters[i].name == "cycles")       cycles = r.counters[i].mean;
+      if (r.counters[i].name == "instructions") instructions = r.counters[i].mean;
+    }
+    if (cycles > 0 && instructions > 0) {
+      r.instructions_per_cycle = instructions / cycles;
+    }
+  }
+
+  if (ctx.topdown.method != CPUID_TOPDOWN_UNSUPPORTED) {
+    r.has_topdown = cpuid_topdown_compute(ctx.topdown, r.counters, r.topdown, r.topdown_reason);
+  }
+  return true;
+}
@@ -0,0 +1,94 @@
+#ifndef CPUID_BENCH_H
+#define CPUID_BENCH_H
+
+// Cycle-accurate microbenchmark harness. A benchmark body runs a
+// given number of iterations; the harness pins to the chosen CPU,
+// warms up, sizes samples to dwarf the timer overhead, and takes
+// samples until the median settles. Each sample is bracketed by the
+// fenced TSC reads from cpuid_tsc_select_fences(), and the measured
+// overhead of that pair (cpuid_info::timer_overheads["fenced_region"])
+// is subtracted. When the kernel allows perf_event counters, the
+// instructions-per-cycle of the body is reported too; given a list of
+// events, the harness instead rotates them across samples with a
+// cpuid_pmu_schedule and reports each one per iteration. Asking for
+// top-down analysis adds the events cpuid_topdown_select() needs.
+
+#include "cpuid.h"
+#include "cpuid_pmu.h"
+#include "cpuid_topdown.h"
+#include "cpuid_tsc.h"
+
+typedef void (*cpuid_bench_body)(void* arg, uint64 iterations);
+
+struct cpuid_bench_options {
+  int cpu;                   // -1 to stay wherever we are
+  double warmup_ms;
+  double target_sample_us;   // each sample runs at least this long
+  int min_samples;
+  int max_samples;
+  double max_seconds;        // per benchmark, after warm-up
+  double stable_change;      // stop when a batch moves the median less than this
+  bool use_pmu;
+  std::vector<cpuid_pmu_event_spec> events;  // empty: just cycles and instructions
+  bool topdown;
+};
+
+void cpuid_bench_default_options(cpuid_bench_options&);
+
+struct cpuid_bench_context {
+  cpuid_info* info;
+  cpuid_bench_options options;
+  cpuid_tsc_clock clock;
+  cpuid_tsc_fences fences;
+  double overhead_cycles;
+  int pmu_fd;                // group leader counting cycles, or -1
+  int pmu_instructions_fd;
+  bool use_schedule;         // options.events opened successfully
+  cpuid_pmu_schedule schedule;
+  cpuid_topdown_plan topdown;  // method is unsupported, with a reason, if off
+};
+
+struct cpuid_bench_result {
+  std::string name;
+  int cpu;
+  uint64 iterations_per_sample;
+  tag_sample_distribution tsc_cycles_per_iteration;  // overhead removed
+  double ns_per_iteration;                           // from the median
+  double instructions_per_cycle;                     // -1 without a PMU
+  std::vector<tag_pmu_count> counters;               // per iteration
+  bool has_topdown;
+  tag_topdown topdown;
+  std::string topdown_reason;                        // when computing it failed
+  bool stable;
+};
+
+// Requires a prior cpuid_introspect().
+bool cpuid_bench_init(cpuid_bench_context&, cpuid_info&, const cpuid_bench_options&);
+void cpuid_bench_free(cpuid_bench_context&);
+
+bool cpuid_bench_measure(cpuid_bench_context&, const char* name,
+                         cpuid_bench_body, void* arg, cpuid_bench_result&);
+
+//////////////////////////////////////////////////////////////////////
+
+// Benchmarks built into the cpuid_bench target. setup, teardown and
+// release may be NULL; a setup returning false skips the case. release
+// frees arg once the registry is done with it.
+struct cpuid_bench_case {
+  std::string name;
+  cpuid_bench_body body;
+  void* arg;
+  bool (*setup)(cpuid_bench_context&, void* arg);
+  void (*teardown)(void* arg);
+  void (*release)(void* arg);
+};
+
+typedef std::vector<cpuid_bench_case> cpuid_bench_registry;
+
+cpuid_bench_case cpuid_bench_make_case(const std::string& name,
+                                       cpuid_bench_body, void* arg);
+
+// Releases every case's arg and empties the registry.
+void cpuid_bench_registry_free(cpuid_bench_registry&);
+
+#endif
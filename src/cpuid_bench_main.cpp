@@ -0,0 +1,172 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "bench_cases.h"
+#include "cpuid_json_tree.h"
+
+using Json::Value;
+
+void topdown_set(Value& v, const char* name, double fraction) {
+  if (fraction >= 0) v[name] = Value(fraction);
+}
+
+Value Value_from(const tag_topdown& t) {
+  Value root;
+  topdown_set(root, "frontend_bound",     t.frontend_bound);
+  topdown_set(root, "bad_speculation",    t.bad_speculation);
+  topdown_set(root, "backend_bound",      t.backend_bound);
+  topdown_set(root, "retiring",           t.retiring);
+  topdown_set(root, "smt_contention",     t.smt_contention);
+  topdown_set(root, "fetch_latency",      t.fetch_latency);
+  topdown_set(root, "fetch_bandwidth",    t.fetch_bandwidth);
+  topdown_set(root, "branch_mispredicts", t.branch_mispredicts);
+  topdown_set(root, "machine_clears",     t.machine_clears);
+  topdown_set(root, "memory_bound",       t.memory_bound);
+  topdown_set(root, "core_bound",         t.core_bound);
+  topdown_set(root, "light_operations",   t.light_operations);
+  topdown_set(root, "heavy_operations",   t.heavy_operations);
+  return root;
+}
+
+Value Value_from(const cpuid_bench_result& r) {
+  Value root;
+  root["name"]                     = Value(r.name);
+  root["cpu"]                      = Value(r.cpu);
+  root["iterations_per_sample"]    = Value(double(r.iterations_per_sample));
+  root["tsc_cycles_per_iteration"] = Value_from(r.tsc_cycles_per_iteration);
+  root["ns_per_iteration"]         = Value(r.ns_per_iteration);
+  root["stable"]                   = Value(r.stable);
+  if (r.instructions_per_cycle >= 0) {
+    root["instructions_per_cycle"] = Value(r.instructions_per_cycle);
+  }
+  for (size_t i = 0; i < r.counters.size(); ++i) {
+    const tag_pmu_count& c = r.counters[i];
+    Value v;
+    v["per_iteration"]  = Value(c.mean);
+    v["standard_error"] = Value(c.standard_error);
+    v["samples"]        = Value(c.repetitions);
+    if (c.multiplexed) v["multiplexed"] = Value(true);
+    root["counters"][c.name] = v;
+  }
+  if (r.has_topdown) {
+    root["topdown"] = Value_from(r.topdown);
+  } else if (!r.topdown_reason.empty()) {
+    root["topdown_unavailable"] = Value(r.topdown_reason);
+  }
+  return root;
+}
+
+void usage(const char* argv0) {
+  fprintf(stderr,
+      "usage: %s [--list] [--filter=SUBSTRING] [--cpu=N] [--max-seconds=S]\n"
+      "          [--min-samples=N] [--no-pmu] [--events=NAME,NAME,...]\n"
+      "          [--topdown]\n", argv0);
+}
+
+int main(int argc, char** argv) {
+  cpuid_bench_options options;
+  cpuid_bench_default_options(options);
+  bool list = false;
+  std::string filter;
+  std::string event_names;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--list")) list = true;
+    else if (!strncmp(argv[i], "--filter=", 9)) filter = argv[i] + 9;
+    else if (!strncmp(argv[i], "--cpu=", 6)) options.cpu = atoi(argv[i] + 6);
+    else if (!strncmp(argv[i], "--max-seconds=", 14)) options.max_seconds = atof(argv[i] + 14);
+    else if (!strncmp(argv[i], "--min-samples=", 14)) options.min_samples = atoi(argv[i] + 14);
+    else if (!strcmp(argv[i], "--no-pmu")) options.use_pmu = false;
+    else if (!strncmp(argv[i], "--events=", 9)) event_names = argv[i] + 9;
+    else if (!strcmp(argv[i], "--topdown")) options.topdown = true;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  cpuid_info info;
+  cpuid_introspect(info);
+  cpuid_enumerate_logical_processors(info);
+  if (options.cpu < 0 && !info.logical_processors.empty()) {
+    options.cpu = info.logical_processors[0].os_cpu;
+  }
+
+  // Events are named as in testcpuid's perfmon.available_events.
+  std::stringstream names(event_names);
+  std::string name;
+  while (std::getline(names, name, ',')) {
+    cpuid_pmu_event_spec e;
+    if (!cpuid_pmu_find_event(info, name.c_str(), e)) {
+      fprintf(stderr, "%s: event %s is not available on this CPU\n", argv[0], name.c_str());
+      return 1;
+    }
+    options.events.push_back(e);
+  }
+
+  cpuid_bench_registry registry;
+  bench_locate_register(registry, info);
+  bench_barrier_register(registry, info);
+  bench_hist_register(registry, info);
+  bench_isa_register(registry, info);
+  bench_json_register(registry, info);
+
+  if (list) {
+    for (size_t i = 0; i < registry.size(); ++i) {
+      printf("%s\n", registry[i].name.c_str());
+    }
+    cpuid_bench_registry_free(registry);
+    return 0;
+  }
+
+  cpuid_bench_context ctx;
+  if (!cpuid_bench_init(ctx, info, options)) {
+    fprintf(stderr, "%s: could not pin to CPU %d or start the TSC clock\n",
+            argv[0], options.cpu);
+    cpuid_bench_registry_free(registry);
+    return 1;
+  }
+
+  Value root;
+  root["vendor_id"]           = Value(info.vendor_id);
+  root["model_name"]          = Value(info.brand_string);
+  root["tsc_hz"]              = Value(double(ctx.clock.tsc_hz));
+  root["timer_begin"]         = Value(cpuid_tsc_read_name(ctx.fences.begin));
+  root["timer_end"]           = Value(cpuid_tsc_read_name(ctx.fences.end));
+  root["timer_overhead_cycles"] = Value(ctx.overhead_cycles);
+  root["pmu"]                 = Value(ctx.pmu_fd >= 0 || ctx.use_schedule);
+  if (!ctx.schedule.events.empty()) {
+    root["pmu_groups"] = Value(int(ctx.schedule.members.size()));
+    if (!ctx.use_schedule) root["pmu_unavailable"] = Value(ctx.schedule.reason);
+  }
+  if (options.topdown) {
+    root["topdown_method"] = Value(cpuid_topdown_method_name(ctx.topdown.method));
+    if (ctx.topdown.method == CPUID_TOPDOWN_UNSUPPORTED) {
+      root["topdown_unavailable"] = Value(ctx.topdown.reason);
+    }
+  }
+  root["benchmarks"]          = Value(Json::arrayValue);
+
+  for (size_t i = 0; i < registry.size(); ++i) {
+    cpuid_bench_case& c = registry[i];
+    if (!filter.empty() && c.name.find(filter) == std::string::npos) continue;
+    if (c.setup && !c.setup(ctx, c.arg)) continue;
+
+    cpuid_bench_result result;
+    cpuid_bench_measure(ctx, c.name.c_str(), c.body, c.arg, result);
+    if (c.teardown) c.teardown(c.arg);
+    root["benchmarks"].append(Value_from(result));
+  }
+
+  cpuid_bench_free(ctx);
+  cpuid_bench_registry_free(registry);
+  std::cout << root.toStyledString() << std::endl;
+  return 0;
+}
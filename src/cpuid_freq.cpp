@@ -0,0 +1,193 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <cstdio>
+#include <cstring>
+
+#include "cpuid_freq.h"
+
+#define MSR_IA32_TSC   0x10
+#define MSR_IA32_MPERF 0xE7
+#define MSR_IA32_APERF 0xE8
+
+const char* cpuid_freq_method_name(cpuid_freq_method method) {
+  switch (method) {
+    case CPUID_FREQ_MSR_DEVICE:  return "msr_device";
+    case CPUID_FREQ_PERF_MSR:    return "perf_msr";
+    case CPUID_FREQ_UNAVAILABLE: return "unavailable";
+  }
+  return "?";
+}
+
+void cpuid_freq_free(cpuid_freq_sampler& s) {
+#ifdef __linux__
+  for (size_t i = 0; i < s.fds.size(); ++i) {
+    if (s.fds[i] >= 0) close(s.fds[i]);
+  }
+#endif
+  s.fds.clear();
+}
+
+#ifdef __linux__
+
+bool freq_read_msr(int fd, uint msr, uint64& value) {
+  return pread(fd, &value, sizeof(value), msr) == sizeof(value);
+}
+
+bool freq_read_count(int fd, uint64& value) {
+  return read(fd, &value, sizeof(value)) == sizeof(value);
+}
+
+// Reads tsc, aperf and mperf for the i'th CPU into `v`.
+bool freq_read(const cpuid_freq_sampler& s, size_t i, uint64 v[3]) {
+  if (s.method == CPUID_FREQ_MSR_DEVICE) {
+    return freq_read_msr(s.fds[i], MSR_IA32_TSC,   v[0])
+        && freq_read_msr(s.fds[i], MSR_IA32_APERF, v[1])
+        && freq_read_msr(s.fds[i], MSR_IA32_MPERF, v[2]);
+  }
+  return freq_read_count(s.fds[3 * i + 0], v[0])
+      && freq_read_count(s.fds[3 * i + 1], v[1])
+      && freq_read_count(s.fds[3 * i + 2], v[2]);
+}
+
+bool freq_open_msr_devices(cpuid_freq_sampler& s) {
+  for (size_t i = 0; i < s.cpus.size(); ++i) {
+    char path[64];
+    snprintf(path, sizeof(path), "/dev/cpu/%d/msr", s.cpus[i]);
+    int fd = open(path, O_RDONLY);
+    uint64 probe;
+    if (fd >= 0 && !freq_read_msr(fd, MSR_IA32_APERF, probe)) {
+      close(fd);
+      fd = -1;
+    }
+    if (fd < 0) {
+      cpuid_freq_free(s);
+      return false;
+    }
+    s.fds.push_back(fd);
+  }
+  return true;
+}
+
+// Reads a sysfs "event=0x.." or plain number file.
+bool freq_read_sysfs_number(const char* path, const char* prefix, uint64& value) {
+  FILE* f = fopen(path, "r");
+  if (!f) return false;
+  char buf[64];
+  bool ok = fgets(buf, sizeof(buf), f) != NULL;
+  fclose(f);
+  size_t n = strlen(prefix);
+  if (!ok || strncmp(buf, prefix, n) != 0) return false;
+  return sscanf(buf + n, "%lli", (long long*) &value) == 1;
+}
+
+bool freq_open_perf_msr(cpuid_freq_sampler& s) {
+  const char* dir = "/sys/bus/event_source/devices/msr";
+  const char* events[3] = { "tsc", "aperf", "mperf" };
+  char path[128];
+
+  uint64 type;
+  snprintf(path, sizeof(path), "%s/type", dir);
+  if (!freq_read_sysfs_number(path, "", type)) return false;
+
+  uint64 config[3];
+  for (int e = 0; e < 3; ++e) {
+    snprintf(path, sizeof(path), "%s/events/%s", dir, events[e]);
+    if (!freq_read_sysfs_number(path, "event=", config[e])) return false;
+  }
+
+  for (size_t i = 0; i < s.cpus.size(); ++i) {
+    for (int e = 0; e < 3; ++e) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config[e];
+      int fd = syscall(__NR_perf_event_open, &attr, -1, s.cpus[i], -1, 0);
+      if (fd < 0) {
+        cpuid_freq_free(s);
+        return false;
+      }
+      s.fds.push_back(fd);
+    }
+  }
+  return true;
+}
+
+#endif
+
+bool cpuid_freq_init(cpuid_freq_sampler& s, const cpuid_info& info,
+                     const cpuid_tsc_clock& clock) {
+  s.method = CPUID_FREQ_UNAVAILABLE;
+  s.tsc_hz = clock.tsc_hz;
+  s.base_mhz = info.processor_features.tsc_features.base_mhz;
+  s.max_mhz = info.processor_features.tsc_features.max_mhz;
+  s.cpus.clear();
+  s.fds.clear();
+  for (size_t i = 0; i < info.logical_processors.size(); ++i) {
+    s.cpus.push_back(info.logical_processors[i].os_cpu);
+  }
+
+  if (!cpuid_has_feature(info, "aperf-mperf")) {
+    s.unavailable_reason = "aperf-mperf not enumerated";
+    return false;
+  }
+
+#ifdef __linux__
+  if (freq_open_msr_devices(s)) {
+    s.method = CPUID_FREQ_MSR_DEVICE;
+  } else if (freq_open_perf_msr(s)) {
+    s.method = CPUID_FREQ_PERF_MSR;
+  } else {
+    s.unavailable_reason = "no access to /dev/cpu/*/msr or the perf msr PMU";
+    return false;
+  }
+
+  s.last.assign(3 * s.cpus.size(), 0);
+  for (size_t i = 0; i < s.cpus.size(); ++i) {
+    if (!freq_read(s, i, &s.last[3 * i])) {
+      cpuid_freq_free(s);
+      s.method = CPUID_FREQ_UNAVAILABLE;
+      s.unavailable_reason = "counter read failed";
+      return false;
+    }
+  }
+  return true;
+#else
+  s.unavailable_reason = "unsupported OS";
+  return false;
+#endif
+}
+
+bool cpuid_freq_sample(cpuid_freq_sampler& s, std::vector<tag_cpu_frequency>& out) {
+  out.clear();
+  if (s.method == CPUID_FREQ_UNAVAILABLE) return false;
+
+#ifdef __linux__
+  for (size_t i = 0; i < s.cpus.size(); ++i) {
+    uint64 v[3];
+    if (!freq_read(s, i, v)) return false;
+
+    uint64 tsc   = v[0] - s.last[3 * i + 0];
+    uint64 aperf = v[1] - s.last[3 * i + 1];
+    uint64 mperf = v[2] - s.last[3 * i + 2];
+    memcpy(&s.last[3 * i], v, sizeof(v));
+
+    tag_cpu_frequency f;
+    f.os_cpu = s.cpus[i];
+    f.effective_mhz = mperf == 0 ? 0 : double(s.tsc_hz) * aperf / mperf / 1e6;
+    f.busy_ratio = tsc == 0 ? 0 : double(mperf) / tsc;
+    out.push_back(f);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
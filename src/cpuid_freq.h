@@ -0,0 +1,54 @@
+#ifndef CPUID_FREQ_H
+#define CPUID_FREQ_H
+
+// Effective core frequency from IA32_APERF and IA32_MPERF. Both count
+// only while the core is not halted: MPERF at the TSC rate and APERF
+// at the actual clock. Over an interval, APERF/MPERF scaled by the TSC
+// frequency is the average frequency while busy, and MPERF/TSC is the
+// fraction of the interval spent busy.
+//
+// The counters are read through the msr driver (/dev/cpu/N/msr) if it
+// can be opened, else through perf's "msr" PMU. Either usually needs
+// privileges; without them the sampler reports why and samples nothing.
+
+#include "cpuid.h"
+#include "cpuid_tsc.h"
+
+enum cpuid_freq_method {
+  CPUID_FREQ_MSR_DEVICE,
+  CPUID_FREQ_PERF_MSR,
+  CPUID_FREQ_UNAVAILABLE
+};
+
+struct tag_cpu_frequency {
+  int os_cpu;
+  double effective_mhz;   // average while busy; 0 if never busy
+  double busy_ratio;      // fraction of the interval not halted
+};
+
+struct cpuid_freq_sampler {
+  cpuid_freq_method method;
+  std::string unavailable_reason;
+  uint64 tsc_hz;
+  uint base_mhz;          // leaf 0x16; 0 if not enumerated
+  uint max_mhz;
+
+  std::vector<int> cpus;
+  std::vector<int> fds;      // per CPU: one msr device, or tsc/aperf/mperf events
+  std::vector<uint64> last;  // per CPU: tsc, aperf, mperf
+};
+
+// Opens the counters on every enumerated CPU and takes the first
+// reading. Requires a prior cpuid_enumerate_logical_processors().
+// Returns false, with method CPUID_FREQ_UNAVAILABLE and a reason, if
+// the counters cannot be read.
+bool cpuid_freq_init(cpuid_freq_sampler&, const cpuid_info&, const cpuid_tsc_clock&);
+
+// Frequencies over the interval since the previous call (or init).
+bool cpuid_freq_sample(cpuid_freq_sampler&, std::vector<tag_cpu_frequency>&);
+
+void cpuid_freq_free(cpuid_freq_sampler&);
+
+const char* cpuid_freq_method_name(cpuid_freq_method);
+
+#endif
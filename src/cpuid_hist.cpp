@@ -0,0 +1,81 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <cmath>
+#include <cstring>
+
+#include "cpuid_hist.h"
+
+const char* cpuid_hist_msb_method_name(cpuid_hist_msb_method method) {
+  switch (method) {
+    case CPUID_HIST_MSB_LZCNT: return "lzcnt";
+    case CPUID_HIST_MSB_BSR:   return "bsr";
+  }
+  return "?";
+}
+
+void cpuid_hist_clear(cpuid_latency_histogram& h) {
+  memset(h.counts, 0, sizeof(h.counts));
+}
+
+void cpuid_hist_init(cpuid_latency_histogram& h, const cpuid_info& info) {
+  // Intel names CPUID.80000001H:ECX[5] "lzcnt", AMD "abm".
+  bool lzcnt = cpuid_has_feature(info, "lzcnt") || cpuid_has_feature(info, "abm");
+  h.msb = lzcnt ? CPUID_HIST_MSB_LZCNT : CPUID_HIST_MSB_BSR;
+  cpuid_hist_clear(h);
+}
+
+void cpuid_hist_merge(cpuid_latency_histogram& dst, const cpuid_latency_histogram& src) {
+  for (int i = 0; i < CPUID_HIST_BUCKETS; ++i) {
+    dst.counts[i] += src.counts[i];
+  }
+}
+
+uint64 cpuid_hist_bucket_lower(uint index) {
+  if (index < CPUID_HIST_SUB_BUCKETS) return index;
+  uint shift = (index >> CPUID_HIST_SUB_BITS) - 1;
+  uint64 sub = index & (CPUID_HIST_SUB_BUCKETS - 1);
+  return (CPUID_HIST_SUB_BUCKETS + sub) << shift;
+}
+
+double hist_bucket_mid_ns(const cpuid_tsc_clock& clock, uint index) {
+  uint64 lower = cpuid_hist_bucket_lower(index);
+  uint64 width = index < CPUID_HIST_SUB_BUCKETS
+               ? 1 : 1ULL << ((index >> CPUID_HIST_SUB_BITS) - 1);
+  return double(cpuid_tsc_cycles_to_ns(clock, lower))
+       + double(cpuid_tsc_cycles_to_ns(clock, width - 1)) / 2;
+}
+
+void cpuid_hist_summarize(const cpuid_latency_histogram& h, const cpuid_tsc_clock& clock,
+                          tag_latency_summary& s) {
+  memset(&s, 0, sizeof(s));
+  double sum = 0;
+  for (uint i = 0; i < CPUID_HIST_BUCKETS; ++i) {
+    s.count += h.counts[i];
+    sum += h.counts[i] * hist_bucket_mid_ns(clock, i);
+  }
+  if (s.count == 0) return;
+  s.mean_ns = sum / s.count;
+
+  const double quantiles[] = { 0.5, 0.9, 0.99, 0.999, 0.9999 };
+  double* outputs[] = { &s.p50_ns, &s.p90_ns, &s.p99_ns, &s.p999_ns, &s.p9999_ns };
+  const int num_quantiles = sizeof(quantiles) / sizeof(quantiles[0]);
+  int q = 0;
+  uint64 seen = 0;
+  bool have_min = false;
+  for (uint i = 0; i < CPUID_HIST_BUCKETS; ++i) {
+    if (h.counts[i] == 0) continue;
+    double mid = hist_bucket_mid_ns(clock, i);
+    if (!have_min) {
+      s.min_ns = mid;
+      have_min = true;
+    }
+    s.max_ns = mid;
+    seen += h.counts[i];
+    // Rank of the quantile, rounded up as HdrHistogram does.
+    while (q < num_quantiles && seen >= uint64(ceil(quantiles[q] * s.count))) {
+      *outputs[q++] = mid;
+    }
+  }
+}
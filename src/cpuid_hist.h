@@ -0,0 +1,93 @@
+#ifndef CPUID_HIST_H
+#define CPUID_HIST_H
+
+// Log-linear latency histograms for hot loops. Each thread records raw
+// TSC deltas into its own histogram with one increment; histograms
+// merge by adding counts, and the merged result is summarized in
+// nanoseconds with the calibrated TSC clock.
+//
+// Values below 2^SUB_BITS get a bucket each. Above that, each power of
+// two is split into 2^SUB_BITS linear sub-buckets, so a bucket is never
+// wider than 1/2^SUB_BITS of its lower bound.
+//
+// The bucket index needs the position of the highest set bit. LZCNT
+// gives it directly, but on CPUs without it the same encoding runs as
+// BSR and returns a different answer, so the instruction is chosen
+// from the lzcnt/abm feature bits rather than assumed.
+
+#include "cpuid.h"
+#include "cpuid_tsc.h"
+
+#define CPUID_HIST_SUB_BITS    5
+#define CPUID_HIST_SUB_BUCKETS (1 << CPUID_HIST_SUB_BITS)
+#define CPUID_HIST_BUCKETS     ((64 - CPUID_HIST_SUB_BITS + 1) * CPUID_HIST_SUB_BUCKETS)
+
+enum cpuid_hist_msb_method {
+  CPUID_HIST_MSB_LZCNT,
+  CPUID_HIST_MSB_BSR
+};
+
+// Aligned so neighbouring threads' histograms never share a line.
+struct cpuid_latency_histogram {
+  cpuid_hist_msb_method msb __attribute__((aligned(128)));
+  uint64 counts[CPUID_HIST_BUCKETS];
+};
+
+struct tag_latency_summary {
+  uint64 count;
+  double min_ns;     // bucket bounds, so within one bucket's width
+  double max_ns;
+  double mean_ns;
+  double p50_ns;
+  double p90_ns;
+  double p99_ns;
+  double p999_ns;
+  double p9999_ns;
+};
+
+// Clears the counts and picks the MSB instruction for this CPU.
+void cpuid_hist_init(cpuid_latency_histogram&, const cpuid_info&);
+
+void cpuid_hist_clear(cpuid_latency_histogram&);
+
+// Adds src's counts into dst.
+void cpuid_hist_merge(cpuid_latency_histogram& dst, const cpuid_latency_histogram& src);
+
+// Bucket values are reported at their midpoints.
+void cpuid_hist_summarize(const cpuid_latency_histogram&, const cpuid_tsc_clock&,
+                          tag_latency_summary&);
+
+const char* cpuid_hist_msb_method_name(cpuid_hist_msb_method);
+
+// Smallest value that lands in the bucket.
+uint64 cpuid_hist_bucket_lower(uint index);
+
+//////////////////////////////////////////////////////////////////////
+
+// Both require a nonzero value.
+inline uint cpuid_hist_msb_lzcnt(uint64 v) {
+  uint64 n;
+  __asm__("lzcnt %1, %0" : "=r"(n) : "rm"(v) : "cc");
+  return 63 - uint(n);
+}
+
+inline uint cpuid_hist_msb_bsr(uint64 v) {
+  uint64 n;
+  __asm__("bsr %1, %0" : "=r"(n) : "rm"(v) : "cc");
+  return uint(n);
+}
+
+inline uint cpuid_hist_bucket(cpuid_hist_msb_method method, uint64 v) {
+  if (v < CPUID_HIST_SUB_BUCKETS) return uint(v);
+  uint msb = method == CPUID_HIST_MSB_LZCNT ? cpuid_hist_msb_lzcnt(v)
+                                            : cpuid_hist_msb_bsr(v);
+  uint shift = msb - CPUID_HIST_SUB_BITS;
+  return ((shift + 1) << CPUID_HIST_SUB_BITS)
+       + uint((v >> shift) & (CPUID_HIST_SUB_BUCKETS - 1));
+}
+
+inline void cpuid_hist_record(cpuid_latency_histogram& h, uint64 tsc_delta) {
+  ++h.counts[cpuid_hist_bucket(h.msb, tsc_delta)];
+}
+
+#endif
@@ -0,0 +1,65 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <cstring>
+
+#include "cpuid_ibs.h"
+
+// IBS_OP_CTL and IBS_FETCH_CTL bits, as perf passes them through.
+#define IBS_OP_L3_MISS_ONLY     (1ULL << 16)
+#define IBS_OP_CNT_CTL          (1ULL << 19)
+#define IBS_FETCH_L3_MISS_ONLY  (1ULL << 59)
+
+// MaxCnt counts in units of 16: 16 bits, plus 7 with OpCntExt. Fetch
+// sampling always has 16.
+#define IBS_MAX_PERIOD          (0xFFFFULL << 4)
+#define IBS_MAX_PERIOD_EXT      (0x7FFFFFULL << 4)
+
+bool cpuid_ibs_select(const cpuid_info& info, bool l3_miss_only, cpuid_ibs_config& c) {
+  c.pmu = NULL;
+  c.perf_config = 0;
+  c.max_period = 0;
+  c.count_ops = false;
+  c.l3_miss_only = false;
+  c.branch_target = false;
+  c.rip_invalid_check = false;
+  c.reason.clear();
+
+  if (!cpuid_has_feature(info, "ibs")) {
+    c.reason = "no IBS";
+    return false;
+  }
+
+  // Without valid flags (early family 10h) only the two basic sampling
+  // modes are there.
+  tag_processor_features::tag_ibs_features ibs = info.processor_features.ibs_features;
+  if (!ibs.flags_valid) {
+    memset(&ibs, 0, sizeof(ibs));
+    ibs.fetch_sampling = ibs.op_sampling = true;
+  }
+
+  if (ibs.op_sampling) {
+    c.pmu = "ibs_op";
+    c.max_period = ibs.op_count_extended ? IBS_MAX_PERIOD_EXT : IBS_MAX_PERIOD;
+    c.count_ops = ibs.op_counting;
+    if (c.count_ops) c.perf_config |= IBS_OP_CNT_CTL;
+    c.l3_miss_only = l3_miss_only && ibs.l3_miss_filtering;
+    if (c.l3_miss_only) c.perf_config |= IBS_OP_L3_MISS_ONLY;
+    c.branch_target = ibs.branch_target;
+    c.rip_invalid_check = ibs.rip_invalid_check;
+  } else if (ibs.fetch_sampling) {
+    c.pmu = "ibs_fetch";
+    c.max_period = IBS_MAX_PERIOD;
+    c.l3_miss_only = l3_miss_only && ibs.l3_miss_filtering;
+    if (c.l3_miss_only) c.perf_config |= IBS_FETCH_L3_MISS_ONLY;
+  } else {
+    c.reason = "IBS enumerates neither op nor fetch sampling";
+    return false;
+  }
+
+  if (l3_miss_only && !c.l3_miss_only) {
+    c.reason = "no hardware L3-miss filtering; filter samples in software";
+  }
+  return true;
+}
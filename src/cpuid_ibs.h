@@ -0,0 +1,20 @@
+#ifndef CPUID_IBS_H
+#define CPUID_IBS_H
+
+// Choosing an AMD Instruction-Based Sampling mode. Op sampling tags
+// one micro-op per period and reports where it went (latencies, cache
+// and TLB results, branch outcome); fetch sampling only sees the
+// front end, so it is the fallback. Counting dispatched ops rather than
+// cycles spreads samples by work done instead of time, which keeps long
+// stalls from soaking up samples. The config bits are those of Linux
+// perf's ibs_op and ibs_fetch PMUs (see their sysfs "format"
+// directories); the PMU type number is read from sysfs at open time.
+
+#include "cpuid.h"
+
+// Picks the most detailed mode this CPU has. With l3_miss_only, asks the
+// hardware to drop samples that hit in the L3 where it can (Zen 4).
+// cpuid_introspect() keeps the choice without it in info.ibs_sampling.
+bool cpuid_ibs_select(const cpuid_info&, bool l3_miss_only, cpuid_ibs_config&);
+
+#endif
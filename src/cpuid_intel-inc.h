@@ -44,7 +44,8 @@ feature_bit intel_feature_bits[] = { // EAX = 1
   { ECX, 27, "osxsave" },
   { ECX, 28, "avx" },
   { ECX, 29, "f16c" },
-  { ECX, 30, "rdrand" }
+  { ECX, 30, "rdrand" },
+  { ECX, 31, "hypervisor" }
 };
 
 feature_bit intel_ext_feature_bits[] = { // EAX = 0x80000001
@@ -80,6 +81,8 @@ feature_bit intel_st_ext_feature_bits[] = { // EAX = 0x7, ECX = 0
   { EBX, 12, "rdt-m" },
   { EBX, 14, "mpx" },
   { EBX, 15, "rdt-a" },
+  { EBX, 16, "avx512f" },
+  { EBX, 17, "avx512dq" },
   { EBX, 18, "rdseed" },
   { EBX, 19, "adx" },
   { EBX, 20, "smap" },
@@ -87,11 +90,20 @@ feature_bit intel_st_ext_feature_bits[] = { // EAX = 0x7, ECX = 0
   { EBX, 24, "clwb" },
   { EBX, 25, "processor-trace" },
   { EBX, 29, "sha-ext" },
+  { EBX, 30, "avx512bw" },
+  { EBX, 31, "avx512vl" },
   { ECX,  2, "umip" },
   { ECX,  3, "pku" },
   { ECX,  4, "ospke" },
   { ECX, 22, "rdpid" },
   { ECX, 30, "sgx-lc" },
+  { EDX,  4, "fsrm" }, // fast short rep movsb
+  { EDX, 10, "md-clear" },
+  { EDX, 14, "serialize" },
+  { EDX, 15, "hybrid" },
+  { EDX, 19, "arch-lbr" },
+  { EDX, 20, "cet-ibt" },
+  { EDX, 29, "arch-capabilities" },
 };
 
 #if 0
@@ -241,6 +253,81 @@ void intel_detect_processor_topology(cpuid_info& info) {
   }
 }
 
+// Leaf 0x0B can be in range but unimplemented; subleaf 0 then reports
+// no logical processors at the SMT level.
+bool intel_has_extended_topology(const cpuid_info& info) {
+  if (info.max_basic_eax < 0x0B) return false;
+  cpuid_with_eax_and_ecx(0x0B, 0);
+  return ebx != 0;
+}
+
+// Precondition: intel_fill_processor_caches and
+// intel_fill_processor_features done
+void intel_fill_apic_id_layout(cpuid_info& info) {
+  tag_apic_id_layout& layout = info.apic_id_layout;
+
+  if (intel_has_extended_topology(info)) {
+    // Leaf 0x1F is a superset of 0x0B that also enumerates dies.
+    uint leaf = 0x0B;
+    if (info.max_basic_eax >= 0x1F) {
+      cpuid_with_eax_and_ecx(0x1F, 0);
+      if (ebx != 0) leaf = 0x1F;
+    }
+
+    int below_die_shift = 0;
+    bool have_die = false;
+    layout.smt_shift = 0;
+    layout.package_shift = 0;
+    for (uint in_ecx = 0; in_ecx < 8; ++in_ecx) {
+      cpuid_with_eax_and_ecx(leaf, in_ecx);
+      uint type  = MASK_RANGE_IN(ecx, 15, 8);
+      int  shift = MASK_RANGE_IN(eax, 4, 0);
+      if (type == 0) break;
+      if (type == 1) layout.smt_shift = shift;
+      if (type < 5) below_die_shift = shift;
+      if (type == 5) have_die = true;
+      layout.package_shift = shift;
+    }
+    layout.die_shift = have_die ? below_die_shift : layout.package_shift;
+  } else {
+    cpuid_with_eax(1);
+    uint max_logical = MASK_RANGE_IN(ebx, 23, 16);
+    uint max_cores = 1;
+    if (info.max_basic_eax >= 4) {
+      cpuid_with_eax_and_ecx(4, 0);
+      max_cores = MASK_RANGE_IN(eax, 31, 26) + 1;
+    }
+    layout.package_shift = info.features["htt"] ? cpuid_bits_for_count(max_logical) : 0;
+    layout.smt_shift = layout.package_shift - cpuid_bits_for_count(max_cores);
+    if (layout.smt_shift < 0) layout.smt_shift = 0;
+    layout.die_shift = layout.package_shift;
+  }
+
+  layout.l2_shift = layout.smt_shift;
+  layout.llc_shift = layout.package_shift;
+  int llc_level = 0;
+  for (size_t i = 0; i < info.processor_cache_parameters.size(); ++i) {
+    const tag_processor_cache_parameter_set& c = info.processor_cache_parameters[i];
+    int shift = cpuid_bits_for_count(c.max_sharing_threads);
+    if (c.cache_level == 2) layout.l2_shift = shift;
+    if (c.cache_level > llc_level) {
+      llc_level = c.cache_level;
+      layout.llc_shift = shift;
+    }
+  }
+}
+
+// Runs on the logical processor being described.
+void intel_read_logical_processor_ids(cpuid_info& info, tag_logical_processor& lp) {
+  if (intel_has_extended_topology(info)) {
+    cpuid_with_eax_and_ecx(0x0B, 0);
+    lp.apic_id = edx;
+  } else {
+    cpuid_with_eax(1);
+    lp.apic_id = MASK_RANGE_IN(ebx, 31, 24);
+  }
+  lp.node_id = lp.apic_id >> info.apic_id_layout.package_shift;
+}
 
 void intel_fill_processor_features(cpuid_info& info) {
   cpuid_with_eax(1);
@@ -269,15 +356,66 @@ void intel_fill_processor_features(cpuid_info& info) {
     info.features[f.name] = BIT_IS_SET(reg[f.reg], f.offset);
   }
 
+  if (info.max_basic_eax >= 0x14 && info.features["processor-trace"]) {
+    tag_processor_features::tag_pt_features& pt = info.processor_features.pt_features;
+    cpuid_with_eax_and_ecx(0x14, 0);
+    pt.max_subleaf            = eax;
+    pt.cr3_filtering          = BIT_IS_SET(ebx, 0);
+    pt.psb_cyc_configurable   = BIT_IS_SET(ebx, 1);
+    pt.ip_filtering           = BIT_IS_SET(ebx, 2);
+    pt.mtc                    = BIT_IS_SET(ebx, 3);
+    pt.ptwrite                = BIT_IS_SET(ebx, 4);
+    pt.power_event_trace      = BIT_IS_SET(ebx, 5);
+    pt.psb_pmi_preservation   = BIT_IS_SET(ebx, 6);
+    pt.event_trace            = BIT_IS_SET(ebx, 7);
+    pt.tnt_disable            = BIT_IS_SET(ebx, 8);
+    pt.topa                   = BIT_IS_SET(ecx, 0);
+    pt.topa_multiple_entries  = BIT_IS_SET(ecx, 1);
+    pt.single_range_output    = BIT_IS_SET(ecx, 2);
+    pt.trace_transport_output = BIT_IS_SET(ecx, 3);
+    pt.lip                    = BIT_IS_SET(ecx, 31);
+    if (pt.max_subleaf >= 1) {
+      cpuid_with_eax_and_ecx(0x14, 1);
+      pt.address_ranges       = MASK_RANGE_IN(eax, 2, 0);
+      pt.mtc_period_mask      = MASK_RANGE_IN(eax, 31, 16);
+      pt.cycle_threshold_mask = MASK_RANGE_IN(ebx, 15, 0);
+      pt.psb_frequency_mask   = MASK_RANGE_IN(ebx, 31, 16);
+    }
+  }
+
+  if (info.max_basic_eax >= 0x1C && info.features["arch-lbr"]) {
+    tag_processor_features::tag_arch_lbr_features& lbr = info.processor_features.arch_lbr_features;
+    cpuid_with_eax_and_ecx(0x1C, 0);
+    lbr.depth_mask         = MASK_RANGE_IN(eax, 7, 0);
+    lbr.deep_c_state_reset = BIT_IS_SET(eax, 30);
+    lbr.lip                = BIT_IS_SET(eax, 31);
+    lbr.cpl_filtering      = BIT_IS_SET(ebx, 0);
+    lbr.branch_filtering   = BIT_IS_SET(ebx, 1);
+    lbr.call_stack         = BIT_IS_SET(ebx, 2);
+    lbr.mispredict         = BIT_IS_SET(ecx, 0);
+    lbr.timed_lbr          = BIT_IS_SET(ecx, 1);
+    lbr.branch_type        = BIT_IS_SET(ecx, 2);
+    lbr.event_logging_mask = MASK_RANGE_IN(ecx, 19, 16);
+  }
+
   if (info.max_basic_eax >= 0x0A) {
     cpuid_with_eax(0x0A);
     info.processor_features.pm_features.version_id = MASK_RANGE_IN(eax, 7, 0);
     info.processor_features.pm_features.gp_counters_per_processor = MASK_RANGE_IN(eax, 15, 8);
     info.processor_features.pm_features.gp_counter_bitwidth = MASK_RANGE_IN(eax, 23, 16);
     info.processor_features.pm_features.gp_counter_events   = MASK_RANGE_IN(eax, 31, 24);
-
-    info.processor_features.pm_features.ff_counter_count    = MASK_RANGE_IN(edx,  4, 0);
-    info.processor_features.pm_features.ff_counter_bitwidth = MASK_RANGE_IN(edx, 12, 5);
+    info.processor_features.pm_features.arch_events_unavailable = ebx;
+
+    // Before version 5, ECX is reserved and the fixed counters are
+    // just the first EDX[4:0].
+    if (info.processor_features.pm_features.version_id >= 5) {
+      info.processor_features.pm_features.ff_counter_mask = ecx;
+    }
+    if (info.processor_features.pm_features.version_id > 1) {
+      info.processor_features.pm_features.ff_counter_count    = MASK_RANGE_IN(edx,  4, 0);
+      info.processor_features.pm_features.ff_counter_bitwidth = MASK_RANGE_IN(edx, 12, 5);
+      info.processor_features.pm_features.any_thread_deprecated = BIT_IS_SET(edx, 15);
+    }
   }
 
   if (info.max_basic_eax >= 0x80000006) {
@@ -286,9 +424,19 @@ void intel_fill_processor_features(cpuid_info& info) {
     info.cache_size_bytes = 1024 * MASK_RANGE_IN(ecx, 31, 16);
   }
 
-  if (info.max_basic_eax >= 0x80000007) {
-    cpuid_with_eax(0x80000007);
-    info.features["invariant-tsc"] = BIT_IS_SET(edx, 8);
+  tag_processor_features::tag_tsc_features& tsc = info.processor_features.tsc_features;
+  if (info.max_basic_eax >= 0x15) {
+    cpuid_with_eax(0x15);
+    tsc.crystal_ratio_denominator = eax;
+    tsc.crystal_ratio_numerator   = ebx;
+    tsc.crystal_hz                = ecx;
+  }
+
+  if (info.max_basic_eax >= 0x16) {
+    cpuid_with_eax(0x16);
+    tsc.base_mhz = MASK_RANGE_IN(eax, 15, 0);
+    tsc.max_mhz  = MASK_RANGE_IN(ebx, 15, 0);
+    tsc.bus_mhz  = MASK_RANGE_IN(ecx, 15, 0);
   }
 
   if (info.features["monitor"]) {
@@ -0,0 +1,564 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <errno.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "cpuid_json.h"
+#include "cpuid_trace.h"
+#include "cpuid_tsc.h"
+
+void json_init(cpuid_json_writer& w, int fd, char* buffer, size_t capacity, int indent) {
+  w.buffer = buffer;
+  w.capacity = capacity;
+  w.used = 0;
+  w.fd = fd;
+  w.indent = indent;
+  w.depth = 0;
+  w.empty[0] = true;
+  w.after_key = false;
+  w.truncated = false;
+  w.failed = false;
+}
+
+void cpuid_json_init_buffer(cpuid_json_writer& w, char* buffer, size_t capacity, int indent) {
+  json_init(w, -1, buffer, capacity, indent);
+}
+
+void cpuid_json_init_fd(cpuid_json_writer& w, int fd, char* buffer, size_t capacity, int indent) {
+  json_init(w, fd, buffer, capacity, indent);
+}
+
+void json_write_fd(cpuid_json_writer& w, const char* s, size_t n) {
+  while (n > 0 && !w.failed) {
+    ssize_t k = write(w.fd, s, n);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) {
+      w.failed = true;
+      return;
+    }
+    s += k;
+    n -= k;
+  }
+}
+
+void json_flush(cpuid_json_writer& w) {
+  if (w.fd < 0) return;
+  json_write_fd(w, w.buffer, w.used);
+  w.used = 0;
+}
+
+void json_put(cpuid_json_writer& w, const char* s, size_t n) {
+  if (w.used + n > w.capacity) {
+    if (w.fd < 0) {
+      w.truncated = true;
+      return;
+    }
+    json_flush(w);
+    if (n > w.capacity) {
+      json_write_fd(w, s, n);
+      return;
+    }
+  }
+  memcpy(w.buffer + w.used, s, n);
+  w.used += n;
+}
+
+void json_put(cpuid_json_writer& w, char c) {
+  if (w.used < w.capacity) {
+    w.buffer[w.used++] = c;
+  } else {
+    json_put(w, &c, 1);
+  }
+}
+
+void json_newline(cpuid_json_writer& w) {
+  static const char spaces[] = "                                ";
+  if (!w.indent) return;
+  json_put(w, '\n');
+  for (int n = w.depth * w.indent; n > 0; n -= sizeof(spaces) - 1) {
+    json_put(w, spaces, n < int(sizeof(spaces) - 1) ? n : sizeof(spaces) - 1);
+  }
+}
+
+// Separator and indentation ahead of a value or key.
+void json_before(cpuid_json_writer& w) {
+  if (w.after_key) {
+    w.after_key = false;
+    return;
+  }
+  if (w.depth == 0) return;
+  if (!w.empty[w.depth]) json_put(w, ',');
+  w.empty[w.depth] = false;
+  json_newline(w);
+}
+
+void json_open(cpuid_json_writer& w, char c) {
+  json_before(w);
+  json_put(w, c);
+  if (w.depth + 1 >= CPUID_JSON_MAX_DEPTH) {
+    w.failed = true;
+    return;
+  }
+  w.empty[++w.depth] = true;
+}
+
+void json_close(cpuid_json_writer& w, char c) {
+  if (w.depth == 0) {
+    w.failed = true;
+    return;
+  }
+  bool was_empty = w.empty[w.depth--];
+  if (!was_empty) json_newline(w);
+  json_put(w, c);
+}
+
+void cpuid_json_begin_object(cpuid_json_writer& w) { json_open(w, '{'); }
+void cpuid_json_end_object(cpuid_json_writer& w) { json_close(w, '}'); }
+void cpuid_json_begin_array(cpuid_json_writer& w) { json_open(w, '['); }
+void cpuid_json_end_array(cpuid_json_writer& w) { json_close(w, ']'); }
+
+void json_string(cpuid_json_writer& w, const char* s) {
+  static const char hex[] = "0123456789abcdef";
+  json_put(w, '"');
+  const char* run = s;
+  for (; *s; ++s) {
+    unsigned char c = *s;
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    json_put(w, run, s - run);
+    run = s + 1;
+    char esc[6] = { '\\', char(c), 0, 0, 0, 0 };
+    size_t n = 2;
+    switch (c) {
+      case '"': case '\\': break;
+      case '\n': esc[1] = 'n'; break;
+      case '\r': esc[1] = 'r'; break;
+      case '\t': esc[1] = 't'; break;
+      case '\b': esc[1] = 'b'; break;
+      case '\f': esc[1] = 'f'; break;
+      default:
+        esc[1] = 'u'; esc[2] = '0'; esc[3] = '0';
+        esc[4] = hex[c >> 4]; esc[5] = hex[c & 15];
+        n = 6;
+    }
+    json_put(w, esc, n);
+  }
+  json_put(w, run, s - run);
+  json_put(w, '"');
+}
+
+void cpuid_json_key(cpuid_json_writer& w, const char* key) {
+  json_before(w);
+  json_string(w, key);
+  if (w.indent) {
+    json_put(w, " : ", 3);
+  } else {
+    json_put(w, ':');
+  }
+  w.after_key = true;
+}
+
+void cpuid_json_value(cpuid_json_writer& w, bool b) {
+  json_before(w);
+  if (b) json_put(w, "true", 4);
+  else   json_put(w, "false", 5);
+}
+
+void json_raw(cpuid_json_writer& w, const char* buf, int n) {
+  json_before(w);
+  json_put(w, buf, n);
+}
+
+void cpuid_json_value(cpuid_json_writer& w, int v) {
+  char buf[24];
+  json_raw(w, buf, snprintf(buf, sizeof(buf), "%d", v));
+}
+
+void cpuid_json_value(cpuid_json_writer& w, uint v) {
+  char buf[24];
+  json_raw(w, buf, snprintf(buf, sizeof(buf), "%u", v));
+}
+
+// jsoncpp holds 64-bit integers as doubles, so they print as doubles.
+void cpuid_json_value(cpuid_json_writer& w, int64 v) {
+  cpuid_json_value(w, double(v));
+}
+
+void cpuid_json_value(cpuid_json_writer& w, uint64 v) {
+  cpuid_json_value(w, double(v));
+}
+
+// As jsoncpp prints doubles: "%#.16g" with the trailing zeros of the
+// fraction cut back to one, so 54 prints as 54.0 and 0.2 as 0.20.
+void cpuid_json_value(cpuid_json_writer& w, double v) {
+  if (std::isnan(v) || std::isinf(v)) {
+    json_raw(w, "null", 4);
+    return;
+  }
+  char buf[32];
+  int n = snprintf(buf, sizeof(buf), "%#.16g", v);
+  if (buf[n - 1] == '0') {
+    int last_nonzero = n - 1;
+    while (last_nonzero > 0 && buf[last_nonzero] == '0') --last_nonzero;
+    int i = last_nonzero;
+    while (i >= 0 && buf[i] >= '0' && buf[i] <= '9') --i;
+    if (i >= 0 && buf[i] == '.') n = last_nonzero + 2;
+  }
+  json_raw(w, buf, n);
+}
+
+void cpuid_json_value(cpuid_json_writer& w, const char* s) {
+  json_before(w);
+  json_string(w, s);
+}
+
+void cpuid_json_value(cpuid_json_writer& w, const std::string& s) {
+  cpuid_json_value(w, s.c_str());
+}
+
+bool cpuid_json_finish(cpuid_json_writer& w) {
+  json_put(w, '\n');
+  json_flush(w);
+  return !w.truncated && !w.failed && w.depth == 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// "0b0101", most significant bit first, as testcpuid has always printed
+// masks.
+void json_bits(cpuid_json_writer& w, const char* key, int bits, uint64 x) {
+  char buf[68] = "0b";
+  for (int i = 0; i < bits; ++i) {
+    buf[2 + (bits - 1) - i] = (i < 64 && ((x >> i) & 1)) ? '1' : '0';
+  }
+  buf[2 + bits] = '\0';
+  cpuid_json_member(w, key, (const char*) buf);
+}
+
+void json_cache(cpuid_json_writer& w, const tag_processor_cache_parameter_set& params) {
+  char name[24];
+  snprintf(name, sizeof(name), "L%d%s", params.cache_level, cache_type_str(params.cache_type));
+  cpuid_json_key(w, name);
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "reserved_apics",      params.reserved_APICS);
+  cpuid_json_member(w, "max_sharing_threads", params.max_sharing_threads);
+  cpuid_json_member(w, "ways",                params.ways);
+  cpuid_json_member(w, "line_size",           params.system_coherency_line_size);
+  cpuid_json_member(w, "line_partitions",     params.physical_line_partitions);
+  cpuid_json_member(w, "sets",                params.sets);
+  cpuid_json_member(w, "total_size",          params.size_in_bytes);
+  cpuid_json_member(w, "inclusive",           params.inclusive);
+  cpuid_json_member(w, "inclusive_behavior",  params.inclusive_behavior);
+  cpuid_json_end_object(w);
+}
+
+void json_perfmon(cpuid_json_writer& w, const cpuid_info& info) {
+  const tag_processor_features::tag_pm_features& pm = info.processor_features.pm_features;
+  cpuid_json_key(w, "perfmon");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "version",                   pm.version_id);
+  cpuid_json_member(w, "gp_counters_per_processor", pm.gp_counters_per_processor);
+  cpuid_json_member(w, "gp_counter_bitwidth",       pm.gp_counter_bitwidth);
+  cpuid_json_member(w, "gp_counter_events",         pm.gp_counter_events);
+  json_bits(w, "arch_events_unavailable", 13, pm.arch_events_unavailable);
+  cpuid_json_member(w, "ff_counter_bitwidth",       pm.ff_counter_bitwidth);
+  cpuid_json_member(w, "ff_counter_count",          pm.ff_counter_count);
+  json_bits(w, "ff_counter_mask", 8, pm.ff_counter_mask);
+  cpuid_json_member(w, "any_thread_deprecated",     pm.any_thread_deprecated);
+
+  const std::vector<cpuid_pmu_event_spec>& events = info.available_events;
+  cpuid_json_key(w, "available_events");
+  cpuid_json_begin_array(w);
+  for (size_t i = 0; i < events.size(); ++i) {
+    cpuid_json_begin_object(w);
+    cpuid_json_member(w, "name", events[i].name);
+    if (events[i].fixed_counter >= 0) {
+      cpuid_json_member(w, "fixed_counter", events[i].fixed_counter);
+    }
+    cpuid_json_end_object(w);
+  }
+  cpuid_json_end_array(w);
+  cpuid_json_end_object(w);
+}
+
+void json_ibs(cpuid_json_writer& w, const cpuid_info& info) {
+  const tag_processor_features::tag_ibs_features& ibs = info.processor_features.ibs_features;
+  cpuid_json_key(w, "ibs");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "flags_valid",            ibs.flags_valid);
+  cpuid_json_member(w, "fetch_sampling",         ibs.fetch_sampling);
+  cpuid_json_member(w, "op_sampling",            ibs.op_sampling);
+  cpuid_json_member(w, "op_counter_rw",          ibs.op_counter_rw);
+  cpuid_json_member(w, "op_counting",            ibs.op_counting);
+  cpuid_json_member(w, "branch_target",          ibs.branch_target);
+  cpuid_json_member(w, "op_count_extended",      ibs.op_count_extended);
+  cpuid_json_member(w, "rip_invalid_check",      ibs.rip_invalid_check);
+  cpuid_json_member(w, "op_branch_fuse",         ibs.op_branch_fuse);
+  cpuid_json_member(w, "fetch_control_extended", ibs.fetch_control_extended);
+  cpuid_json_member(w, "op_data4",               ibs.op_data4);
+  cpuid_json_member(w, "l3_miss_filtering",      ibs.l3_miss_filtering);
+
+  const cpuid_ibs_config& c = info.ibs_sampling;
+  char config[24];
+  snprintf(config, sizeof(config), "0x%llx", c.perf_config);
+  cpuid_json_key(w, "sampling");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "pmu",               c.pmu ? c.pmu : "none");
+  cpuid_json_member(w, "perf_config",       (const char*) config);
+  cpuid_json_member(w, "max_period",        c.max_period);
+  cpuid_json_member(w, "count_ops",         c.count_ops);
+  cpuid_json_member(w, "l3_miss_only",      c.l3_miss_only);
+  cpuid_json_member(w, "branch_target",     c.branch_target);
+  cpuid_json_member(w, "rip_invalid_check", c.rip_invalid_check);
+  if (!c.reason.empty()) cpuid_json_member(w, "reason", c.reason);
+  cpuid_json_end_object(w);
+  cpuid_json_end_object(w);
+}
+
+void json_pt(cpuid_json_writer& w, const tag_processor_features::tag_pt_features& pt) {
+  cpuid_json_key(w, "processor_trace");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "max_subleaf",            pt.max_subleaf);
+  cpuid_json_member(w, "cr3_filtering",          pt.cr3_filtering);
+  cpuid_json_member(w, "psb_cyc_configurable",   pt.psb_cyc_configurable);
+  cpuid_json_member(w, "ip_filtering",           pt.ip_filtering);
+  cpuid_json_member(w, "mtc",                    pt.mtc);
+  cpuid_json_member(w, "ptwrite",                pt.ptwrite);
+  cpuid_json_member(w, "power_event_trace",      pt.power_event_trace);
+  cpuid_json_member(w, "psb_pmi_preservation",   pt.psb_pmi_preservation);
+  cpuid_json_member(w, "event_trace",            pt.event_trace);
+  cpuid_json_member(w, "tnt_disable",            pt.tnt_disable);
+  cpuid_json_member(w, "topa",                   pt.topa);
+  cpuid_json_member(w, "topa_multiple_entries",  pt.topa_multiple_entries);
+  cpuid_json_member(w, "single_range_output",    pt.single_range_output);
+  cpuid_json_member(w, "trace_transport_output", pt.trace_transport_output);
+  cpuid_json_member(w, "lip",                    pt.lip);
+  cpuid_json_member(w, "address_ranges",         pt.address_ranges);
+  json_bits(w, "mtc_period_mask",      16, pt.mtc_period_mask);
+  json_bits(w, "cycle_threshold_mask", 16, pt.cycle_threshold_mask);
+  json_bits(w, "psb_frequency_mask",   16, pt.psb_frequency_mask);
+  cpuid_json_end_object(w);
+}
+
+void json_arch_lbr(cpuid_json_writer& w, const tag_processor_features::tag_arch_lbr_features& lbr) {
+  cpuid_json_key(w, "arch_lbr");
+  cpuid_json_begin_object(w);
+  cpuid_json_key(w, "depths");
+  cpuid_json_begin_array(w);
+  for (int n = 0; n < 8; ++n) {
+    if ((lbr.depth_mask >> n) & 1) cpuid_json_value(w, 8 * (n + 1));
+  }
+  cpuid_json_end_array(w);
+  cpuid_json_member(w, "deep_c_state_reset", lbr.deep_c_state_reset);
+  cpuid_json_member(w, "lip",                lbr.lip);
+  cpuid_json_member(w, "cpl_filtering",      lbr.cpl_filtering);
+  cpuid_json_member(w, "branch_filtering",   lbr.branch_filtering);
+  cpuid_json_member(w, "call_stack",         lbr.call_stack);
+  cpuid_json_member(w, "mispredict",         lbr.mispredict);
+  cpuid_json_member(w, "timed_lbr",          lbr.timed_lbr);
+  cpuid_json_member(w, "branch_type",        lbr.branch_type);
+  json_bits(w, "event_logging_mask", 4, lbr.event_logging_mask);
+  cpuid_json_end_object(w);
+}
+
+void json_trace_config(cpuid_json_writer& w, const char* key, const cpuid_trace_config& c) {
+  cpuid_json_key(w, key);
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "method", cpuid_trace_method_name(c.method));
+  if (c.method == CPUID_TRACE_PT) {
+    cpuid_json_member(w, "output",        cpuid_trace_output_name(c.output));
+    cpuid_json_member(w, "mtc_period",    c.mtc_period);
+    cpuid_json_member(w, "cyc_threshold", c.cyc_threshold);
+    cpuid_json_member(w, "psb_frequency", c.psb_frequency);
+  } else if (c.method == CPUID_TRACE_ARCH_LBR) {
+    cpuid_json_member(w, "lbr_depth",      c.lbr_depth);
+    cpuid_json_member(w, "lbr_call_stack", c.lbr_call_stack);
+  }
+  if (!c.reason.empty()) cpuid_json_member(w, "reason", c.reason);
+  cpuid_json_end_object(w);
+}
+
+void json_trace(cpuid_json_writer& w, const cpuid_info& info) {
+  cpuid_json_key(w, "trace");
+  cpuid_json_begin_object(w);
+  json_trace_config(w, "branch_history", info.branch_history_trace);
+  json_trace_config(w, "full_trace", info.full_trace);
+  cpuid_json_end_object(w);
+}
+
+void json_groups(cpuid_json_writer& w, const char* key, const cpuid_info& info,
+                 cpuid_topology_level level) {
+  const std::vector<std::vector<int> >& groups = info.processor_groups[level];
+  cpuid_json_key(w, key);
+  cpuid_json_begin_array(w);
+  for (size_t i = 0; i < groups.size(); ++i) {
+    cpuid_json_begin_array(w);
+    for (size_t k = 0; k < groups[i].size(); ++k) cpuid_json_value(w, groups[i][k]);
+    cpuid_json_end_array(w);
+  }
+  cpuid_json_end_array(w);
+}
+
+void json_distribution(cpuid_json_writer& w, const char* key, const tag_sample_distribution& d) {
+  cpuid_json_key(w, key);
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "samples", d.samples);
+  cpuid_json_member(w, "min",     d.min);
+  cpuid_json_member(w, "median",  d.median);
+  cpuid_json_member(w, "p90",     d.p90);
+  cpuid_json_member(w, "p99",     d.p99);
+  cpuid_json_member(w, "max",     d.max);
+  cpuid_json_member(w, "mean",    d.mean);
+  cpuid_json_member(w, "stddev",  d.stddev);
+  cpuid_json_end_object(w);
+}
+
+void json_tsc(cpuid_json_writer& w, const cpuid_info& info) {
+  const tag_processor_features::tag_tsc_features& tsc = info.processor_features.tsc_features;
+  cpuid_json_key(w, "tsc_features");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "crystal_ratio_denominator", tsc.crystal_ratio_denominator);
+  cpuid_json_member(w, "crystal_ratio_numerator",   tsc.crystal_ratio_numerator);
+  cpuid_json_member(w, "crystal_hz",                tsc.crystal_hz);
+  cpuid_json_member(w, "base_mhz",                  tsc.base_mhz);
+  cpuid_json_member(w, "max_mhz",                   tsc.max_mhz);
+  cpuid_json_member(w, "bus_mhz",                   tsc.bus_mhz);
+  cpuid_json_member(w, "hypervisor_tsc_khz",        tsc.hypervisor_tsc_khz);
+  cpuid_json_member(w, "hypervisor_bus_khz",        tsc.hypervisor_bus_khz);
+  cpuid_json_end_object(w);
+
+  cpuid_json_member(w, "rdtsc_serialized_overhead_cycles", info.rdtsc_serialized_overhead_cycles);
+  cpuid_json_member(w, "rdtsc_unserialized_overhead_cycles",
+                    info.rdtsc_unserialized_overhead_cycles);
+  cpuid_json_key(w, "timer_overhead_cycles");
+  cpuid_json_begin_object(w);
+  cpuid_info::timer_overhead_map::const_iterator it;
+  for (it = info.timer_overheads.begin(); it != info.timer_overheads.end(); ++it) {
+    json_distribution(w, it->first.c_str(), it->second);
+  }
+  cpuid_json_end_object(w);
+
+  const cpuid_tsc_fences& fences = info.tsc_fences;
+  cpuid_json_key(w, "timing_primitives");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "begin", cpuid_tsc_read_name(fences.begin));
+  cpuid_json_member(w, "end",   cpuid_tsc_read_name(fences.end));
+  cpuid_json_end_object(w);
+}
+
+void cpuid_json_write_info(cpuid_json_writer& w, const cpuid_info& info) {
+  const tag_processor_features& feats = info.processor_features;
+  cpuid_json_member(w, "cpuid_version", CPUID_VERSION_STRING);
+  cpuid_json_member(w, "vendor_id", (const char*) info.vendor_id);
+  cpuid_json_member(w, "model_name", (const char*) info.brand_string);
+  if (!info.processor_cache_parameters.empty()) {
+    cpuid_json_key(w, "caches");
+    cpuid_json_begin_object(w);
+    for (size_t i = 0; i < info.processor_cache_parameters.size(); ++i) {
+      json_cache(w, info.processor_cache_parameters[i]);
+    }
+    cpuid_json_end_object(w);
+  }
+
+  cpuid_json_key(w, "features");
+  cpuid_json_begin_object(w);
+  cpuid_info::feature_flags::const_iterator it;
+  for (it = info.features.begin(); it != info.features.end(); ++it) {
+    cpuid_json_member(w, it->first.c_str(), it->second);
+  }
+  cpuid_json_end_object(w);
+
+  cpuid_json_member(w, "logical_processors_per_physical_processor_package",
+                    feats.logical_processors_per_physical_processor_package);
+  cpuid_json_member(w, "max_logical_processors_per_physical_processor_package",
+                    feats.max_logical_processors_per_physical_processor_package);
+  cpuid_json_member(w, "monitor_line_size_min", feats.monitor_features.min_line_size);
+  cpuid_json_member(w, "monitor_line_size_max", feats.monitor_features.max_line_size);
+  json_perfmon(w, info);
+
+  if (!strcmp(info.vendor_id, "AuthenticAMD")) {
+    const tag_processor_features::tag_amd_topology_features& topo = feats.amd_topology;
+    cpuid_json_key(w, "amd_topology");
+    cpuid_json_begin_object(w);
+    cpuid_json_member(w, "threads_per_package",        topo.threads_per_package);
+    cpuid_json_member(w, "apic_id_core_id_size",       topo.apic_id_core_id_size);
+    cpuid_json_member(w, "threads_per_compute_unit",   topo.threads_per_compute_unit);
+    cpuid_json_member(w, "nodes_per_processor",        topo.nodes_per_processor);
+    cpuid_json_end_object(w);
+  }
+  if (cpuid_has_feature(info, "ibs")) json_ibs(w, info);
+  if (cpuid_has_feature(info, "processor-trace")) json_pt(w, feats.pt_features);
+  if (cpuid_has_feature(info, "arch-lbr")) json_arch_lbr(w, feats.arch_lbr_features);
+  json_trace(w, info);
+
+  const tag_apic_id_layout& layout = info.apic_id_layout;
+  cpuid_json_key(w, "apic_id_layout");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "smt_shift",     layout.smt_shift);
+  cpuid_json_member(w, "l2_shift",      layout.l2_shift);
+  cpuid_json_member(w, "llc_shift",     layout.llc_shift);
+  cpuid_json_member(w, "die_shift",     layout.die_shift);
+  cpuid_json_member(w, "package_shift", layout.package_shift);
+  cpuid_json_end_object(w);
+
+  if (!info.logical_processors.empty()) {
+    cpuid_json_key(w, "logical_processors");
+    cpuid_json_begin_array(w);
+    for (size_t i = 0; i < info.logical_processors.size(); ++i) {
+      const tag_logical_processor& lp = info.logical_processors[i];
+      cpuid_json_begin_object(w);
+      cpuid_json_member(w, "os_cpu",     lp.os_cpu);
+      cpuid_json_member(w, "apic_id",    lp.apic_id);
+      cpuid_json_member(w, "smt_id",     lp.smt_id);
+      cpuid_json_member(w, "core_id",    lp.core_id);
+      cpuid_json_member(w, "l2_id",      lp.l2_id);
+      cpuid_json_member(w, "llc_id",     lp.llc_id);
+      cpuid_json_member(w, "die_id",     lp.die_id);
+      cpuid_json_member(w, "node_id",    lp.node_id);
+      cpuid_json_member(w, "package_id", lp.package_id);
+      cpuid_json_end_object(w);
+    }
+    cpuid_json_end_array(w);
+  }
+  cpuid_json_key(w, "processor_groups");
+  cpuid_json_begin_object(w);
+  json_groups(w, "core",    info, CPUID_LEVEL_CORE);
+  json_groups(w, "l2",      info, CPUID_LEVEL_L2);
+  json_groups(w, "llc",     info, CPUID_LEVEL_LLC);
+  json_groups(w, "die",     info, CPUID_LEVEL_DIE);
+  json_groups(w, "package", info, CPUID_LEVEL_PACKAGE);
+  cpuid_json_end_object(w);
+
+  const tag_effective_capacity& cap = info.effective_capacity;
+  cpuid_json_key(w, "effective_capacity");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "allowed_logical_processors", cap.allowed_logical_processors);
+  cpuid_json_member(w, "allowed_physical_cores",     cap.allowed_physical_cores);
+  cpuid_json_member(w, "allowed_llc_domains",        cap.allowed_llc_domains);
+  cpuid_json_member(w, "cpu_quota",                  cap.cpu_quota);
+  cpuid_json_member(w, "recommended_workers",        cap.recommended_workers);
+  cpuid_json_end_object(w);
+
+  if (cpuid_has_feature(info, "tsc")) json_tsc(w, info);
+
+  cpuid_json_member(w, "physical_address_bits", info.max_physical_address_size);
+  cpuid_json_member(w, "linear_address_bits",   info.max_linear_address_size);
+  cpuid_json_member(w, "max_basic_eax",         info.max_basic_eax);
+  cpuid_json_member(w, "max_ext_eax",           info.max_ext_eax);
+
+  const tag_processor_signature& sig = info.processor_signature;
+  cpuid_json_key(w, "signature");
+  cpuid_json_begin_object(w);
+  json_bits(w, "full_bit_string", 8 * sizeof(void*), sig.full_bit_string);
+  cpuid_json_member(w, "extended_family", sig.extended_family);
+  cpuid_json_member(w, "extended_model",  sig.extended_model);
+  cpuid_json_member(w, "processor_type",  sig.processor_type);
+  cpuid_json_member(w, "family_code",     sig.family_code);
+  cpuid_json_member(w, "model_number",    sig.model_number);
+  cpuid_json_member(w, "stepping_id",     sig.stepping_id);
+  cpuid_json_end_object(w);
+}
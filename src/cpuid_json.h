@@ -0,0 +1,68 @@
+#ifndef CPUID_JSON_H
+#define CPUID_JSON_H
+
+// A streaming JSON writer. Output goes into a caller-supplied buffer,
+// which is flushed to a file descriptor whenever it fills, or, with no
+// descriptor, is the whole document; the writer itself never
+// allocates. Commas, nesting and indentation are tracked in a fixed
+// stack, so a document is written front to back with no tree behind it.
+//
+// cpuid_json_write_info emits the members testcpuid derives from a
+// cpuid_info, with the same keys and values as the jsoncpp output.
+// Numbers are formatted as jsoncpp formats them, 64-bit integers
+// included (as doubles). Members come out in the order written rather
+// than sorted, and non-finite doubles are written as null.
+
+#include "cpuid.h"
+
+#define CPUID_JSON_MAX_DEPTH 32
+
+struct cpuid_json_writer {
+  char* buffer;
+  size_t capacity;
+  size_t used;
+  int fd;                  // -1: write into the buffer only
+  int indent;              // spaces per level; 0 for compact output
+  int depth;
+  bool empty[CPUID_JSON_MAX_DEPTH];   // nothing written at this level yet
+  bool after_key;
+  bool truncated;          // buffer-only output ran out of room
+  bool failed;             // write(2) failed, or nesting too deep
+};
+
+void cpuid_json_init_buffer(cpuid_json_writer&, char* buffer, size_t capacity, int indent);
+void cpuid_json_init_fd(cpuid_json_writer&, int fd, char* buffer, size_t capacity, int indent);
+
+// Ends the document with a newline and flushes. False if anything was
+// lost; for buffer output, buffer[0, used) is the document.
+bool cpuid_json_finish(cpuid_json_writer&);
+
+void cpuid_json_begin_object(cpuid_json_writer&);
+void cpuid_json_end_object(cpuid_json_writer&);
+void cpuid_json_begin_array(cpuid_json_writer&);
+void cpuid_json_end_array(cpuid_json_writer&);
+void cpuid_json_key(cpuid_json_writer&, const char* key);
+
+void cpuid_json_value(cpuid_json_writer&, bool);
+void cpuid_json_value(cpuid_json_writer&, int);
+void cpuid_json_value(cpuid_json_writer&, uint);
+void cpuid_json_value(cpuid_json_writer&, int64);    // as a double
+void cpuid_json_value(cpuid_json_writer&, uint64);   // as a double
+void cpuid_json_value(cpuid_json_writer&, double);   // null if not finite
+void cpuid_json_value(cpuid_json_writer&, const char*);
+void cpuid_json_value(cpuid_json_writer&, const std::string&);
+
+template <typename T>
+void cpuid_json_member(cpuid_json_writer& w, const char* key, const T& value) {
+  cpuid_json_key(w, key);
+  cpuid_json_value(w, value);
+}
+
+// Writes the cpuid_info members into the object currently open. It
+// only walks fields: the event list, groups, capacity and the IBS,
+// trace and timing choices were worked out by cpuid_introspect() and
+// cpuid_enumerate_logical_processors(), so this does not allocate
+// either.
+void cpuid_json_write_info(cpuid_json_writer&, const cpuid_info&);
+
+#endif
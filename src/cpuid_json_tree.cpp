@@ -0,0 +1,343 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <sstream>
+
+#include "cpuid_json_tree.h"
+#include "cpuid_trace.h"
+#include "cpuid_tsc.h"
+
+using Json::Value;
+
+template<int N, typename T>
+std::string format_bitstring(T x) {
+  std::string buf(N, '@');
+  for (int i = 0; i < N; ++i) {
+    buf[(N - 1) - i] = (i < int(8 * sizeof(T)) && ((x >> i) & 1)) ? '1' : '0';
+  }
+  return "0b" + buf;
+}
+
+Value Value_from(bool b) { return Value(b); }
+Value Value_from(int b) { return Value(b); }
+Value Value_from(double b) { return Value(b); }
+Value Value_from(const std::string& b) { return Value(b); }
+Value Value_from(uint b) { return Value(b); }
+Value Value_from(uint64 b) { return Value(double(b)); }
+Value Value_from(int64 b) { return Value(double(b)); }
+
+template <typename T>
+Value Value_from(const std::map<std::string, T>& amap) {
+  Value root;
+  typedef std::map<std::string, T> map_type;
+  for (typename map_type::const_iterator it = amap.begin(); it != amap.end(); ++it) {
+    root[(*it).first] = Value_from((*it).second);
+  }
+  return root;
+}
+
+Value Value_from(const tag_processor_cache_parameter_set& params) {
+  Value root;
+  root["reserved_apics"]      = Value(params.reserved_APICS);
+  root["max_sharing_threads"] = Value(params.max_sharing_threads);
+  root["ways"]                = Value(params.ways);
+  root["line_size"]           = Value(params.system_coherency_line_size);
+  root["line_partitions"]     = Value(params.physical_line_partitions);
+  root["sets"]                = Value(params.sets);
+  root["total_size"]          = Value(params.size_in_bytes);
+  root["inclusive"]           = Value(params.inclusive);
+  root["inclusive_behavior"]  = Value(params.inclusive_behavior);
+  return root;
+}
+
+Value& operator<<(Value& root,
+                  const tag_processor_cache_parameter_set& params) {
+  std::stringstream name;
+  name << "L" << params.cache_level << cache_type_str(params.cache_type);
+  root[name.str()] = Value_from(params);
+  return root;
+}
+
+Value& operator<<(Value& root, const tag_processor_features& feats) {
+  root["logical_processors_per_physical_processor_package"]
+             = Value(feats.logical_processors_per_physical_processor_package);
+  root["max_logical_processors_per_physical_processor_package"]
+             = Value(feats.max_logical_processors_per_physical_processor_package);
+  root["monitor_line_size_min"] = Value(feats.monitor_features.min_line_size);
+  root["monitor_line_size_max"] = Value(feats.monitor_features.max_line_size);
+
+  Value pm;
+  pm["version"]                   = Value(feats.pm_features.version_id);
+  pm["gp_counters_per_processor"] = Value(feats.pm_features.gp_counters_per_processor);
+  pm["gp_counter_bitwidth"] = Value(feats.pm_features.gp_counter_bitwidth);
+  pm["gp_counter_events"]   = Value(feats.pm_features.gp_counter_events);
+  pm["arch_events_unavailable"] = Value(format_bitstring<13>(feats.pm_features.arch_events_unavailable));
+  pm["ff_counter_bitwidth"] = Value(feats.pm_features.ff_counter_bitwidth);
+  pm["ff_counter_count"]    = Value(feats.pm_features.ff_counter_count);
+  pm["ff_counter_mask"]     = Value(format_bitstring<8>(feats.pm_features.ff_counter_mask));
+  pm["any_thread_deprecated"] = Value(feats.pm_features.any_thread_deprecated);
+
+  root["perfmon"] = pm;
+  return root;
+}
+
+Value Value_from(const tag_processor_features::tag_pt_features& pt) {
+  Value root;
+  root["max_subleaf"]            = Value(pt.max_subleaf);
+  root["cr3_filtering"]          = Value(pt.cr3_filtering);
+  root["psb_cyc_configurable"]   = Value(pt.psb_cyc_configurable);
+  root["ip_filtering"]           = Value(pt.ip_filtering);
+  root["mtc"]                    = Value(pt.mtc);
+  root["ptwrite"]                = Value(pt.ptwrite);
+  root["power_event_trace"]      = Value(pt.power_event_trace);
+  root["psb_pmi_preservation"]   = Value(pt.psb_pmi_preservation);
+  root["event_trace"]            = Value(pt.event_trace);
+  root["tnt_disable"]            = Value(pt.tnt_disable);
+  root["topa"]                   = Value(pt.topa);
+  root["topa_multiple_entries"]  = Value(pt.topa_multiple_entries);
+  root["single_range_output"]    = Value(pt.single_range_output);
+  root["trace_transport_output"] = Value(pt.trace_transport_output);
+  root["lip"]                    = Value(pt.lip);
+  root["address_ranges"]         = Value(pt.address_ranges);
+  root["mtc_period_mask"]        = Value(format_bitstring<16>(pt.mtc_period_mask));
+  root["cycle_threshold_mask"]   = Value(format_bitstring<16>(pt.cycle_threshold_mask));
+  root["psb_frequency_mask"]     = Value(format_bitstring<16>(pt.psb_frequency_mask));
+  return root;
+}
+
+Value Value_from(const tag_processor_features::tag_arch_lbr_features& lbr) {
+  Value root;
+  root["depths"] = Value(Json::arrayValue);
+  for (int n = 0; n < 8; ++n) {
+    if ((lbr.depth_mask >> n) & 1) root["depths"].append(Value(8 * (n + 1)));
+  }
+  root["deep_c_state_reset"] = Value(lbr.deep_c_state_reset);
+  root["lip"]                = Value(lbr.lip);
+  root["cpl_filtering"]      = Value(lbr.cpl_filtering);
+  root["branch_filtering"]   = Value(lbr.branch_filtering);
+  root["call_stack"]         = Value(lbr.call_stack);
+  root["mispredict"]         = Value(lbr.mispredict);
+  root["timed_lbr"]          = Value(lbr.timed_lbr);
+  root["branch_type"]        = Value(lbr.branch_type);
+  root["event_logging_mask"] = Value(format_bitstring<4>(lbr.event_logging_mask));
+  return root;
+}
+
+Value Value_from(const tag_processor_features::tag_ibs_features& ibs) {
+  Value root;
+  root["flags_valid"]            = Value(ibs.flags_valid);
+  root["fetch_sampling"]         = Value(ibs.fetch_sampling);
+  root["op_sampling"]            = Value(ibs.op_sampling);
+  root["op_counter_rw"]          = Value(ibs.op_counter_rw);
+  root["op_counting"]            = Value(ibs.op_counting);
+  root["branch_target"]          = Value(ibs.branch_target);
+  root["op_count_extended"]      = Value(ibs.op_count_extended);
+  root["rip_invalid_check"]      = Value(ibs.rip_invalid_check);
+  root["op_branch_fuse"]         = Value(ibs.op_branch_fuse);
+  root["fetch_control_extended"] = Value(ibs.fetch_control_extended);
+  root["op_data4"]               = Value(ibs.op_data4);
+  root["l3_miss_filtering"]      = Value(ibs.l3_miss_filtering);
+  return root;
+}
+
+Value Value_from(const cpuid_ibs_config& c) {
+  Value root;
+  root["pmu"]               = Value(c.pmu ? c.pmu : "none");
+  char config[24];
+  snprintf(config, sizeof(config), "0x%llx", (unsigned long long) c.perf_config);
+  root["perf_config"]       = Value(config);
+  root["max_period"]        = Value_from(c.max_period);
+  root["count_ops"]         = Value(c.count_ops);
+  root["l3_miss_only"]      = Value(c.l3_miss_only);
+  root["branch_target"]     = Value(c.branch_target);
+  root["rip_invalid_check"] = Value(c.rip_invalid_check);
+  if (!c.reason.empty()) root["reason"] = Value(c.reason);
+  return root;
+}
+
+Value Value_from(const cpuid_trace_config& c) {
+  Value root;
+  root["method"] = Value(cpuid_trace_method_name(c.method));
+  if (c.method == CPUID_TRACE_PT) {
+    root["output"] = Value(cpuid_trace_output_name(c.output));
+    root["mtc_period"] = Value(c.mtc_period);
+    root["cyc_threshold"] = Value(c.cyc_threshold);
+    root["psb_frequency"] = Value(c.psb_frequency);
+  } else if (c.method == CPUID_TRACE_ARCH_LBR) {
+    root["lbr_depth"] = Value(c.lbr_depth);
+    root["lbr_call_stack"] = Value(c.lbr_call_stack);
+  }
+  if (!c.reason.empty()) root["reason"] = Value(c.reason);
+  return root;
+}
+
+Value Value_from(const tag_processor_features::tag_amd_topology_features& topo) {
+  Value root;
+  root["threads_per_package"]        = Value(topo.threads_per_package);
+  root["apic_id_core_id_size"]       = Value(topo.apic_id_core_id_size);
+  root["threads_per_compute_unit"]   = Value(topo.threads_per_compute_unit);
+  root["nodes_per_processor"]        = Value(topo.nodes_per_processor);
+  return root;
+}
+
+Value Value_from(const tag_processor_features::tag_tsc_features& tsc) {
+  Value root;
+  root["crystal_ratio_denominator"] = Value(tsc.crystal_ratio_denominator);
+  root["crystal_ratio_numerator"]   = Value(tsc.crystal_ratio_numerator);
+  root["crystal_hz"]                = Value(tsc.crystal_hz);
+  root["base_mhz"]                  = Value(tsc.base_mhz);
+  root["max_mhz"]                   = Value(tsc.max_mhz);
+  root["bus_mhz"]                   = Value(tsc.bus_mhz);
+  root["hypervisor_tsc_khz"]        = Value(tsc.hypervisor_tsc_khz);
+  root["hypervisor_bus_khz"]        = Value(tsc.hypervisor_bus_khz);
+  return root;
+}
+
+Value Value_from(const tag_sample_distribution& d) {
+  Value root;
+  root["samples"] = Value(d.samples);
+  root["min"]     = Value(d.min);
+  root["median"]  = Value(d.median);
+  root["p90"]     = Value(d.p90);
+  root["p99"]     = Value(d.p99);
+  root["max"]     = Value(d.max);
+  root["mean"]    = Value(d.mean);
+  root["stddev"]  = Value(d.stddev);
+  return root;
+}
+
+Value Value_from(const tag_apic_id_layout& layout) {
+  Value root;
+  root["smt_shift"]     = Value(layout.smt_shift);
+  root["l2_shift"]      = Value(layout.l2_shift);
+  root["llc_shift"]     = Value(layout.llc_shift);
+  root["die_shift"]     = Value(layout.die_shift);
+  root["package_shift"] = Value(layout.package_shift);
+  return root;
+}
+
+Value Value_from(const tag_logical_processor& lp) {
+  Value root;
+  root["os_cpu"]     = Value(lp.os_cpu);
+  root["apic_id"]    = Value(lp.apic_id);
+  root["smt_id"]     = Value(lp.smt_id);
+  root["core_id"]    = Value(lp.core_id);
+  root["l2_id"]      = Value(lp.l2_id);
+  root["llc_id"]     = Value(lp.llc_id);
+  root["die_id"]     = Value(lp.die_id);
+  root["node_id"]    = Value(lp.node_id);
+  root["package_id"] = Value(lp.package_id);
+  return root;
+}
+
+Value Value_from(const tag_effective_capacity& cap) {
+  Value root;
+  root["allowed_logical_processors"] = Value(cap.allowed_logical_processors);
+  root["allowed_physical_cores"]     = Value(cap.allowed_physical_cores);
+  root["allowed_llc_domains"]        = Value(cap.allowed_llc_domains);
+  root["cpu_quota"]                  = Value(cap.cpu_quota);
+  root["recommended_workers"]        = Value(cap.recommended_workers);
+  return root;
+}
+
+Value Value_from(const std::vector<std::vector<int> >& groups) {
+  Value root(Json::arrayValue);
+  for (size_t i = 0; i < groups.size(); ++i) {
+    Value group(Json::arrayValue);
+    for (size_t k = 0; k < groups[i].size(); ++k) {
+      group.append(Value(groups[i][k]));
+    }
+    root.append(group);
+  }
+  return root;
+}
+
+Value Value_from(const tag_processor_signature& sig) {
+  Value root;
+  root["full_bit_string"] = Value(format_bitstring<8 * sizeof(void*)>(sig.full_bit_string));
+  root["extended_family"] = Value(sig.extended_family);
+  root["extended_model"]  = Value(sig.extended_model);
+  root["processor_type"]  = Value(sig.processor_type);
+  root["family_code"]     = Value(sig.family_code);
+  root["model_number"]    = Value(sig.model_number);
+  root["stepping_id"]     = Value(sig.stepping_id);
+  return root;
+}
+
+///////////////////////////////////////////////////////
+
+Value cpuid_json_tree(const cpuid_info& info) {
+  Value root;
+  root["cpuid_version"] = Value(CPUID_VERSION_STRING);
+
+  root["vendor_id"] = info.vendor_id;
+  root["model_name"] = info.brand_string;
+  for (size_t i = 0; i < info.processor_cache_parameters.size(); ++i) {
+    root["caches"] << info.processor_cache_parameters[i];
+  }
+  root["features"] = Value_from(info.features);
+  root << info.processor_features;
+  if (std::string("AuthenticAMD") == info.vendor_id) {
+    root["amd_topology"] = Value_from(info.processor_features.amd_topology);
+  }
+  if (cpuid_has_feature(info, "ibs")) {
+    root["ibs"] = Value_from(info.processor_features.ibs_features);
+    root["ibs"]["sampling"] = Value_from(info.ibs_sampling);
+  }
+
+  if (cpuid_has_feature(info, "processor-trace")) {
+    root["processor_trace"] = Value_from(info.processor_features.pt_features);
+  }
+  if (cpuid_has_feature(info, "arch-lbr")) {
+    root["arch_lbr"] = Value_from(info.processor_features.arch_lbr_features);
+  }
+  // Cheapest way to get recent branch history, and a full trace.
+  root["trace"]["branch_history"] = Value_from(info.branch_history_trace);
+  root["trace"]["full_trace"]     = Value_from(info.full_trace);
+
+  root["apic_id_layout"] = Value_from(info.apic_id_layout);
+  for (size_t i = 0; i < info.logical_processors.size(); ++i) {
+    root["logical_processors"].append(Value_from(info.logical_processors[i]));
+  }
+  Value groups;
+  groups["core"]    = Value_from(info.processor_groups[CPUID_LEVEL_CORE]);
+  groups["l2"]      = Value_from(info.processor_groups[CPUID_LEVEL_L2]);
+  groups["llc"]     = Value_from(info.processor_groups[CPUID_LEVEL_LLC]);
+  groups["die"]     = Value_from(info.processor_groups[CPUID_LEVEL_DIE]);
+  groups["package"] = Value_from(info.processor_groups[CPUID_LEVEL_PACKAGE]);
+  root["processor_groups"] = groups;
+
+  root["effective_capacity"] = Value_from(info.effective_capacity);
+
+  if (cpuid_has_feature(info, "tsc")) {
+    root["tsc_features"] = Value_from(info.processor_features.tsc_features);
+    root["rdtsc_serialized_overhead_cycles"] = Value_from(info.rdtsc_serialized_overhead_cycles);
+    root["rdtsc_unserialized_overhead_cycles"] = Value_from(info.rdtsc_unserialized_overhead_cycles);
+    root["timer_overhead_cycles"] = Value_from(info.timer_overheads);
+
+    root["timing_primitives"]["begin"] = Value(cpuid_tsc_read_name(info.tsc_fences.begin));
+    root["timing_primitives"]["end"]   = Value(cpuid_tsc_read_name(info.tsc_fences.end));
+  }
+
+  const std::vector<cpuid_pmu_event_spec>& pmu_events = info.available_events;
+  root["perfmon"]["available_events"] = Value(Json::arrayValue);
+  for (size_t i = 0; i < pmu_events.size(); ++i) {
+    Value e;
+    e["name"] = Value(pmu_events[i].name);
+    if (pmu_events[i].fixed_counter >= 0) {
+      e["fixed_counter"] = Value(pmu_events[i].fixed_counter);
+    }
+    root["perfmon"]["available_events"].append(e);
+  }
+
+  root["physical_address_bits"] = info.max_physical_address_size;
+  root["linear_address_bits"] = info.max_linear_address_size;
+  //root["cache_line_size"] = info.cache_line_size;
+  //root["cache_size_bytes"] = info.cache_size_bytes;
+  root["max_basic_eax"] = info.max_basic_eax;
+  root["max_ext_eax"] = info.max_ext_eax;
+  root["signature"] = Value_from(info.processor_signature);
+
+  return root;
+}
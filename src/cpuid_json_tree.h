@@ -0,0 +1,23 @@
+#ifndef CPUID_JSON_TREE_H
+#define CPUID_JSON_TREE_H
+
+// The cpuid_info part of testcpuid's output as a jsoncpp tree, the way
+// it has always been built. testcpuid --format=jsoncpp still uses it,
+// and the json/ benchmarks measure cpuid_json_write_info against it.
+// Compiled into the executables that link jsoncpp, not into the library.
+
+#include "cpuid.h"
+#include "json/json.h"
+
+Json::Value Value_from(bool);
+Json::Value Value_from(int);
+Json::Value Value_from(double);
+Json::Value Value_from(const std::string&);
+Json::Value Value_from(uint);
+Json::Value Value_from(uint64);
+Json::Value Value_from(int64);
+Json::Value Value_from(const tag_sample_distribution&);
+
+Json::Value cpuid_json_tree(const cpuid_info&);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef CPUID_LE_H
+#define CPUID_LE_H
+
+// Little-endian field access for the on-disk formats, so files read
+// the same whatever the byte order of the machine that wrote them.
+
+#include "cpuid.h"
+
+inline void cpuid_put_le16(unsigned char* p, uint v) {
+  p[0] = v; p[1] = v >> 8;
+}
+
+inline void cpuid_put_le32(unsigned char* p, uint v) {
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+inline void cpuid_put_le64(unsigned char* p, uint64 v) {
+  cpuid_put_le32(p, uint(v));
+  cpuid_put_le32(p + 4, uint(v >> 32));
+}
+
+inline uint cpuid_get_le16(const unsigned char* p) {
+  return p[0] | (p[1] << 8);
+}
+
+inline uint cpuid_get_le32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (uint(p[3]) << 24);
+}
+
+inline uint64 cpuid_get_le64(const unsigned char* p) {
+  return cpuid_get_le32(p) | (uint64(cpuid_get_le32(p + 4)) << 32);
+}
+
+#endif
@@ -0,0 +1,92 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include "cpuid_locate.h"
+
+const char* cpuid_locate_method_name(cpuid_locate_method method) {
+  switch (method) {
+    case CPUID_LOCATE_RDPID:        return "rdpid";
+    case CPUID_LOCATE_RDTSCP:       return "rdtscp";
+    case CPUID_LOCATE_SCHED_GETCPU: return "sched_getcpu";
+  }
+  return "?";
+}
+
+bool cpuid_locate_method_usable(const cpuid_info& info, cpuid_locate_method method) {
+  if (method == CPUID_LOCATE_RDPID  && !cpuid_has_feature(info, "rdpid"))  return false;
+  if (method == CPUID_LOCATE_RDTSCP && !cpuid_has_feature(info, "rdtscp")) return false;
+
+  std::vector<int> allowed;
+  if (!cpuid_os_allowed_cpus(allowed)) {
+    // Without affinity control the only trustworthy source is the OS.
+    return method == CPUID_LOCATE_SCHED_GETCPU && cpuid_os_current_cpu() >= 0;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; ok && i < allowed.size(); ++i) {
+    if (!cpuid_os_pin_current_thread(allowed[i])) continue;
+    ok = cpuid_locate_os_cpu(method) == allowed[i];
+  }
+  cpuid_os_set_allowed_cpus(allowed);
+  return ok;
+}
+
+// Assigns each CPU the index of its group at the given level.
+void locate_fill_indices(cpuid_cpu_locator& loc, const cpuid_info& info,
+                         cpuid_topology_level level, int tag_cpu_location::* field,
+                         int& count) {
+  std::vector<std::vector<int> > groups = cpuid_processor_groups(info, level);
+  count = groups.size();
+  for (size_t g = 0; g < groups.size(); ++g) {
+    for (size_t k = 0; k < groups[g].size(); ++k) {
+      loc.table[groups[g][k]].*field = g;
+    }
+  }
+}
+
+bool cpuid_locator_init(cpuid_cpu_locator& loc, const cpuid_info& info) {
+  int max_cpu = 0;
+  for (size_t i = 0; i < info.logical_processors.size(); ++i) {
+    if (info.logical_processors[i].os_cpu > max_cpu) {
+      max_cpu = info.logical_processors[i].os_cpu;
+    }
+  }
+
+  // CPUs we were not allowed to enumerate map to index 0 everywhere.
+  tag_cpu_location unknown = { 0, 0, 0, 0 };
+  loc.table.assign(max_cpu + 1, unknown);
+  for (int cpu = 0; cpu <= max_cpu; ++cpu) {
+    loc.table[cpu].os_cpu = cpu;
+  }
+
+  locate_fill_indices(loc, info, CPUID_LEVEL_CORE, &tag_cpu_location::core_index, loc.num_cores);
+  locate_fill_indices(loc, info, CPUID_LEVEL_LLC,  &tag_cpu_location::llc_index,  loc.num_llcs);
+
+  std::map<uint, int> nodes;
+  for (size_t i = 0; i < info.logical_processors.size(); ++i) {
+    const tag_logical_processor& lp = info.logical_processors[i];
+    nodes.insert(std::make_pair(lp.node_id, 0));
+  }
+  int n = 0;
+  for (std::map<uint, int>::iterator it = nodes.begin(); it != nodes.end(); ++it) {
+    it->second = n++;
+  }
+  loc.num_nodes = n;
+  for (size_t i = 0; i < info.logical_processors.size(); ++i) {
+    const tag_logical_processor& lp = info.logical_processors[i];
+    loc.table[lp.os_cpu].node_index = nodes[lp.node_id];
+  }
+
+  if (max_cpu > int(CPUID_TSC_AUX_CPU_MASK)) {
+    // TSC_AUX only has room for 4096 CPUs.
+    loc.method = CPUID_LOCATE_SCHED_GETCPU;
+  } else if (cpuid_locate_method_usable(info, CPUID_LOCATE_RDPID)) {
+    loc.method = CPUID_LOCATE_RDPID;
+  } else if (cpuid_locate_method_usable(info, CPUID_LOCATE_RDTSCP)) {
+    loc.method = CPUID_LOCATE_RDTSCP;
+  } else {
+    loc.method = CPUID_LOCATE_SCHED_GETCPU;
+  }
+  return !info.logical_processors.empty();
+}
@@ -0,0 +1,81 @@
+#ifndef CPUID_LOCATE_H
+#define CPUID_LOCATE_H
+
+// Cheap "which core and LLC am I on" queries for per-CPU data
+// structures. The OS CPU number is read with RDPID if available,
+// else RDTSCP's TSC_AUX, else sched_getcpu(), and then mapped through
+// a flat table built from the enumerated topology.
+//
+// Linux stores (node << 12) | cpu in IA32_TSC_AUX; other kernels may
+// not, so the instruction paths are only used once validated against
+// the scheduler.
+
+#include "cpuid.h"
+#include "cpuid_os.h"
+
+// Dense indices, suitable for indexing per-core/per-LLC arrays.
+struct tag_cpu_location {
+  int os_cpu;
+  int core_index;
+  int llc_index;
+  int node_index;
+};
+
+enum cpuid_locate_method {
+  CPUID_LOCATE_RDPID,
+  CPUID_LOCATE_RDTSCP,
+  CPUID_LOCATE_SCHED_GETCPU
+};
+
+struct cpuid_cpu_locator {
+  cpuid_locate_method method;
+  int num_cores;
+  int num_llcs;
+  int num_nodes;
+  std::vector<tag_cpu_location> table; // indexed by OS CPU
+};
+
+// Builds the table and picks the cheapest working method.
+// Requires a prior cpuid_enumerate_logical_processors().
+bool cpuid_locator_init(cpuid_cpu_locator&, const cpuid_info&);
+
+// Whether a method works on this host, checked against the scheduler.
+bool cpuid_locate_method_usable(const cpuid_info&, cpuid_locate_method);
+
+const char* cpuid_locate_method_name(cpuid_locate_method);
+
+//////////////////////////////////////////////////////////////////////
+
+#define CPUID_TSC_AUX_CPU_MASK 0xFFFU
+
+inline uint cpuid_rdpid() {
+  unsigned long aux;
+  // rdpid %rax (or %eax); spelled out for assemblers that predate it.
+  __asm__ __volatile__(".byte 0xf3, 0x0f, 0xc7, 0xf8" : "=a"(aux));
+  return uint(aux);
+}
+
+inline uint cpuid_rdtscp_aux() {
+  uint lo, hi, aux;
+  __asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+  return aux;
+}
+
+inline int cpuid_locate_os_cpu(cpuid_locate_method method) {
+  switch (method) {
+    case CPUID_LOCATE_RDPID:  return cpuid_rdpid() & CPUID_TSC_AUX_CPU_MASK;
+    case CPUID_LOCATE_RDTSCP: return cpuid_rdtscp_aux() & CPUID_TSC_AUX_CPU_MASK;
+    case CPUID_LOCATE_SCHED_GETCPU: break;
+  }
+  return cpuid_os_current_cpu();
+}
+
+// The answer may be stale by the time it is used, as with any such
+// query; it is a placement hint, not a lock.
+inline const tag_cpu_location& cpuid_locate(const cpuid_cpu_locator& loc) {
+  uint cpu = uint(cpuid_locate_os_cpu(loc.method));
+  if (cpu >= loc.table.size()) cpu = 0;
+  return loc.table[cpu];
+}
+
+#endif
@@ -1,127 +1,274 @@
-#include <sstream>
+#include <unistd.h>
+#include <cstring>
 #include <iostream>
 #include <cstdio>
 
 #include "cpuid.h"
-
-template<int N, typename T>
-std::string format_bitstring(T x) {
-  std::string buf(N, '@');
-  for (int i = 0; i < N; ++i) {
-    buf[(N - 1) - i] = (x & (1<<i)) ? '1' : '0';
-  }
-  return "0b" + buf;
-}
-
-#include "json/json.h"
+#include "cpuid_json.h"
+#include "cpuid_json_tree.h"
+#include "cpuid_pmu.h"
+#include "cpuid_snapshot.h"
+#include "cpuid_timers.h"
+#include "cpuid_tsc.h"
 
 using Json::Value;
 
-Value Value_from(bool b) { return Value(b); }
-Value Value_from(int b) { return Value(b); }
-Value Value_from(double b) { return Value(b); }
-Value Value_from(const std::string& b) { return Value(b); }
-Value Value_from(uint b) { return Value(b); }
-Value Value_from(uint64 b) { return Value(double(b)); }
-Value Value_from(int64 b) { return Value(double(b)); }
+// What testcpuid measures rather than decodes, in either output form.
+// Only gathered with --measure: calibration and the sync check take
+// long enough to matter next to plain introspection.
+struct measurements {
+  bool have_clock;
+  cpuid_tsc_clock clock;
+  tag_timer_comparison timers;
+  bool have_sync;
+  tag_tsc_sync_report sync;
+  bool have_pmu;
+  cpuid_pmu_group pmu;
+};
 
-template <typename T>
-Value Value_from(const std::map<std::string, T>& amap) {
+Value Value_from(const cpuid_tsc_clock& clock) {
   Value root;
-  typedef std::map<std::string, T> map_type;
-  for (typename map_type::const_iterator it = amap.begin(); it != amap.end(); ++it) {
-    root[(*it).first] = Value_from((*it).second);
-  }
+  root["tsc_hz"]    = Value_from(clock.tsc_hz);
+  root["source"]    = Value(cpuid_tsc_source_name(clock.source));
+  root["invariant"] = Value(clock.invariant);
+  root["mult"]      = Value_from(clock.mult);
+  root["shift"]     = Value(clock.shift);
   return root;
 }
 
-Value Value_from(const tag_processor_cache_parameter_set& params) {
+Value Value_from(const cpuid_pmu_group& g) {
   Value root;
-  root["reserved_apics"]      = Value(params.reserved_APICS);
-  root["max_sharing_threads"] = Value(params.max_sharing_threads);
-  root["ways"]                = Value(params.ways);
-  root["line_size"]           = Value(params.system_coherency_line_size);
-  root["line_partitions"]     = Value(params.physical_line_partitions);
-  root["sets"]                = Value(params.sets);
-  root["total_size"]          = Value(params.size_in_bytes);
-  root["inclusive"]           = Value(params.inclusive);
-  root["inclusive_behavior"]  = Value(params.inclusive_behavior);
+  root["access"] = Value(cpuid_pmu_access_name(g.access));
+  if (g.access != CPUID_PMU_OK) {
+    root["reason"] = Value(g.reason);
+  }
+  root["rdpmc"] = Value(g.rdpmc);
   return root;
 }
 
-Value& operator<<(Value& root,
-                  const tag_processor_cache_parameter_set& params) {
-  std::stringstream name;
-  name << "L" << params.cache_level << cache_type_str(params.cache_type);
-  root[name.str()] = Value_from(params);
+Value Value_from(const tag_timer_comparison& cmp) {
+  Value root;
+  Value sources(Json::objectValue);
+  for (size_t i = 0; i < cmp.sources.size(); ++i) {
+    const tag_timer_source& s = cmp.sources[i];
+    Value v;
+    v["available"] = Value(s.available);
+    if (s.available) {
+      v["cost_cycles"]   = Value(s.cost_cycles);
+      v["cost_ns"]       = Value(s.cost_ns);
+      v["resolution_ns"] = Value(s.resolution_ns);
+    }
+    sources[s.name] = v;
+  }
+  root["sources"]            = sources;
+  root["kernel_clocksource"] = Value(cmp.kernel_clocksource);
+  root["recommended"]        = Value(cmp.recommended);
+  root["reason"]             = Value(cmp.reason);
   return root;
 }
 
-Value& operator<<(Value& root, const tag_processor_features& feats) {
-  root["logical_processors_per_physical_processor_package"]
-             = Value(feats.logical_processors_per_physical_processor_package);
-  root["max_logical_processors_per_physical_processor_package"]
-             = Value(feats.max_logical_processors_per_physical_processor_package);
-  root["monitor_line_size_min"] = Value(feats.monitor_features.min_line_size);
-  root["monitor_line_size_max"] = Value(feats.monitor_features.max_line_size);
-
-  Value pm;
-  pm["version"]                   = Value(feats.pm_features.version_id);
-  pm["gp_counters_per_processor"] = Value(feats.pm_features.gp_counters_per_processor);
-  pm["gp_counter_bitwidth"] = Value(feats.pm_features.gp_counter_bitwidth);
-  pm["ff_counter_bitwidth"] = Value(feats.pm_features.ff_counter_bitwidth);
-  pm["ff_counter_count"]    = Value(feats.pm_features.ff_counter_count);
-
-  root["perfmon"] = pm;
+Value Value_from(const tag_tsc_sync_report& report) {
+  Value root;
+  root["reference_cpu"]    = Value(report.reference_cpu);
+  root["invariant_tsc"]    = Value(report.invariant_tsc);
+  root["ia32_tsc_adjust"]  = Value(report.tsc_adjust);
+  root["all_synchronized"] = Value(report.all_synchronized);
+  root["unchecked_cpus"]   = Value(report.unchecked_cpus);
+  root["cross_core_tsc_safe"] = Value(report.invariant_tsc && report.all_synchronized);
+  root["cpus"] = Value(Json::arrayValue);
+  for (size_t i = 0; i < report.cpus.size(); ++i) {
+    const tag_tsc_sync_cpu& cpu = report.cpus[i];
+    Value c;
+    c["os_cpu"]        = Value(cpu.os_cpu);
+    c["offset_min"]    = Value_from(cpu.offset_min);
+    c["offset_max"]    = Value_from(cpu.offset_max);
+    c["max_backwards"] = Value_from(cpu.max_backwards);
+    c["synchronized"]  = Value(cpu.synchronized);
+    root["cpus"].append(c);
+  }
   return root;
 }
 
-Value Value_from(const tag_processor_signature& sig) {
-  Value root;
-  root["full_bit_string"] = Value(format_bitstring<8 * sizeof(void*)>(sig.full_bit_string));
-  root["extended_family"] = Value(sig.extended_family);
-  root["extended_model"]  = Value(sig.extended_model);
-  root["processor_type"]  = Value(sig.processor_type);
-  root["family_code"]     = Value(sig.family_code);
-  root["model_number"]    = Value(sig.model_number);
-  root["stepping_id"]     = Value(sig.stepping_id);
-  return root;
+void write_json(cpuid_json_writer& w, const cpuid_tsc_clock& clock) {
+  cpuid_json_key(w, "tsc_clock");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "tsc_hz",    clock.tsc_hz);
+  cpuid_json_member(w, "source",    cpuid_tsc_source_name(clock.source));
+  cpuid_json_member(w, "invariant", clock.invariant);
+  cpuid_json_member(w, "mult",      clock.mult);
+  cpuid_json_member(w, "shift",     clock.shift);
+  cpuid_json_end_object(w);
 }
 
-///////////////////////////////////////////////////////
+void write_json(cpuid_json_writer& w, const tag_timer_comparison& cmp) {
+  cpuid_json_key(w, "timer_sources");
+  cpuid_json_begin_object(w);
+  cpuid_json_key(w, "sources");
+  cpuid_json_begin_object(w);
+  for (size_t i = 0; i < cmp.sources.size(); ++i) {
+    const tag_timer_source& s = cmp.sources[i];
+    cpuid_json_key(w, s.name.c_str());
+    cpuid_json_begin_object(w);
+    cpuid_json_member(w, "available", s.available);
+    if (s.available) {
+      cpuid_json_member(w, "cost_cycles",   s.cost_cycles);
+      cpuid_json_member(w, "cost_ns",       s.cost_ns);
+      cpuid_json_member(w, "resolution_ns", s.resolution_ns);
+    }
+    cpuid_json_end_object(w);
+  }
+  cpuid_json_end_object(w);
+  cpuid_json_member(w, "kernel_clocksource", cmp.kernel_clocksource);
+  cpuid_json_member(w, "recommended",        cmp.recommended);
+  cpuid_json_member(w, "reason",             cmp.reason);
+  cpuid_json_end_object(w);
+}
 
-int main() {
-  cpuid_info info;
-  cpuid_introspect(info);
+void write_json(cpuid_json_writer& w, const tag_tsc_sync_report& report) {
+  cpuid_json_key(w, "tsc_sync");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "reference_cpu",       report.reference_cpu);
+  cpuid_json_member(w, "invariant_tsc",       report.invariant_tsc);
+  cpuid_json_member(w, "ia32_tsc_adjust",     report.tsc_adjust);
+  cpuid_json_member(w, "all_synchronized",    report.all_synchronized);
+  cpuid_json_member(w, "unchecked_cpus",      report.unchecked_cpus);
+  cpuid_json_member(w, "cross_core_tsc_safe", report.invariant_tsc && report.all_synchronized);
+  cpuid_json_key(w, "cpus");
+  cpuid_json_begin_array(w);
+  for (size_t i = 0; i < report.cpus.size(); ++i) {
+    const tag_tsc_sync_cpu& cpu = report.cpus[i];
+    cpuid_json_begin_object(w);
+    cpuid_json_member(w, "os_cpu",        cpu.os_cpu);
+    cpuid_json_member(w, "offset_min",    cpu.offset_min);
+    cpuid_json_member(w, "offset_max",    cpu.offset_max);
+    cpuid_json_member(w, "max_backwards", cpu.max_backwards);
+    cpuid_json_member(w, "synchronized",  cpu.synchronized);
+    cpuid_json_end_object(w);
+  }
+  cpuid_json_end_array(w);
+  cpuid_json_end_object(w);
+}
 
-  ///////////////////////////////////////////////////////////////////
+void write_json(cpuid_json_writer& w, const cpuid_info& info, const cpuid_pmu_group& g) {
+  cpuid_json_key(w, "pmu");
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "access", cpuid_pmu_access_name(g.access));
+  if (g.access != CPUID_PMU_OK) {
+    cpuid_json_member(w, "reason", g.reason);
+  }
+  cpuid_json_member(w, "rdpmc", g.rdpmc);
+  cpuid_json_member(w, "perf_event_paranoid", cpuid_pmu_paranoid());
+  cpuid_json_member(w, "max_group_events", cpuid_pmu_max_group_events(info));
+  cpuid_json_end_object(w);
+}
 
-  Value root;
-  root["cpuid_version"] = Value(CPUID_VERSION_STRING);
+///////////////////////////////////////////////////////
 
-  root["vendor_id"] = info.vendor_id;
-  root["model_name"] = info.brand_string;
-  for (int i = 0; i < info.processor_cache_parameters.size(); ++i) {
-    root["caches"] << info.processor_cache_parameters[i];
+void measure(const cpuid_info& info, measurements& m) {
+  m.have_clock = m.have_sync = m.have_pmu = false;
+  if (cpuid_has_feature(info, "tsc")) {
+    m.have_clock = cpuid_tsc_clock_init(m.clock, info);
+    if (m.have_clock) {
+      cpuid_compare_timers(info, m.clock, m.timers);
+    }
+    m.have_sync = cpuid_tsc_check_sync(info, m.sync);
   }
-  root["features"] = Value_from(info.features);
-  root << info.processor_features;
 
-  if (info.features["tsc"]) {
-    root["rdtsc_serialized_overhead_cycles"] = Value_from(info.rdtsc_serialized_overhead_cycles);
-    root["rdtsc_unserialized_overhead_cycles"] = Value_from(info.rdtsc_unserialized_overhead_cycles);
+#ifdef __linux__
+  // Can we count cycles and instructions here, and read them cheaply?
+  std::vector<cpuid_pmu_event_spec> events(2);
+  if (!cpuid_pmu_find_event(info, "cycles", events[0])) {
+    events[0] = cpuid_pmu_hardware_event("cycles", PERF_COUNT_HW_CPU_CYCLES);
   }
+  if (!cpuid_pmu_find_event(info, "instructions", events[1])) {
+    events[1] = cpuid_pmu_hardware_event("instructions", PERF_COUNT_HW_INSTRUCTIONS);
+  }
+  cpuid_pmu_open(m.pmu, info, events);
+  m.have_pmu = true;
+#endif
+}
 
-  root["physical_address_bits"] = info.max_physical_address_size;
-  root["linear_address_bits"] = info.max_linear_address_size;
-  //root["cache_line_size"] = info.cache_line_size;
-  //root["cache_size_bytes"] = info.cache_size_bytes;
-  root["max_basic_eax"] = info.max_basic_eax;
-  root["max_ext_eax"] = info.max_ext_eax;
-  root["signature"] = Value_from(info.processor_signature);
-
+void print_jsoncpp(const cpuid_info& info, const measurements& m) {
+  Value root = cpuid_json_tree(info);
+  if (m.have_clock) {
+    root["tsc_clock"] = Value_from(m.clock);
+    root["timer_sources"] = Value_from(m.timers);
+  }
+  if (m.have_sync) {
+    root["tsc_sync"] = Value_from(m.sync);
+  }
+  if (m.have_pmu) {
+    root["pmu"] = Value_from(m.pmu);
+    root["pmu"]["perf_event_paranoid"] = Value(cpuid_pmu_paranoid());
+    root["pmu"]["max_group_events"] = Value(cpuid_pmu_max_group_events(info));
+  }
   std::cout << root.toStyledString() << std::endl;
+}
 
-  return 0;
+bool print_json(const cpuid_info& info, const measurements& m) {
+  static char buffer[64 * 1024];
+  cpuid_json_writer w;
+  cpuid_json_init_fd(w, STDOUT_FILENO, buffer, sizeof(buffer), 3);
+  cpuid_json_begin_object(w);
+  cpuid_json_write_info(w, info);
+  if (m.have_clock) {
+    write_json(w, m.clock);
+    write_json(w, m.timers);
+  }
+  if (m.have_sync) {
+    write_json(w, m.sync);
+  }
+  if (m.have_pmu) {
+    write_json(w, info, m.pmu);
+  }
+  cpuid_json_end_object(w);
+  return cpuid_json_finish(w);
 }
 
+bool print_snapshot(const cpuid_info& info) {
+  std::vector<tag_cpuid_leaf> leaves;
+  cpuid_dump_leaves(info, leaves);
+  std::vector<unsigned char> snapshot;
+  cpuid_snapshot_build(info, leaves, snapshot);
+  return fwrite(&snapshot[0], 1, snapshot.size(), stdout) == snapshot.size()
+      && fflush(stdout) == 0;
+}
+
+int main(int argc, char** argv) {
+  const char* format = "json";
+  bool want_measurements = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--format=", 9)) format = argv[i] + 9;
+    else if (!strcmp(argv[i], "--measure")) want_measurements = true;
+    else format = "";
+  }
+  if (strcmp(format, "json") && strcmp(format, "jsoncpp") && strcmp(format, "bin")) {
+    fprintf(stderr, "usage: %s [--format=json|jsoncpp|bin] [--measure]\n", argv[0]);
+    return 1;
+  }
+
+  cpuid_info info;
+  cpuid_introspect(info);
+  cpuid_enumerate_logical_processors(info);
+
+  // The snapshot holds what CPUID says, not what was measured here.
+  if (!strcmp(format, "bin")) {
+    return print_snapshot(info) ? 0 : 1;
+  }
+
+  measurements m;
+  m.have_clock = m.have_sync = m.have_pmu = false;
+  if (want_measurements) measure(info, m);
+
+  bool ok = true;
+  if (!strcmp(format, "jsoncpp")) {
+    print_jsoncpp(info, m);
+  } else {
+    ok = print_json(info, m);
+  }
+
+#ifdef __linux__
+  if (m.have_pmu) cpuid_pmu_close(m.pmu);
+#endif
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,299 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "cpuid_marker.h"
+
+__thread cpuid_marker_thread* cpuid_marker_tls_thread = NULL;
+
+struct marker_state {
+  pthread_mutex_t lock;           // names, unavailable and the registry
+  std::vector<std::string> names;
+
+  bool initialized;
+  cpuid_info info;
+  cpuid_tsc_clock clock;
+  std::vector<cpuid_pmu_event_spec> events;
+  std::string unavailable;        // why some thread counts nothing
+
+  cpuid_marker_thread* threads;   // live threads
+  uint next_thread_index;
+  pthread_key_t thread_key;
+
+  // Totals of the threads that have exited, whose slots are freed.
+  uint exited_threads;
+  cpuid_marker_region exited[CPUID_MARKER_MAX_REGIONS];
+
+  std::string report_path;        // empty for stderr
+  int wake[2];                    // signal handler -> reporter thread
+  pthread_t reporter;
+};
+
+marker_state g_marker = { PTHREAD_MUTEX_INITIALIZER };
+pthread_once_t marker_key_once = PTHREAD_ONCE_INIT;
+
+uint cpuid_marker_register(const char* name) {
+  pthread_mutex_lock(&g_marker.lock);
+  uint id = 0;
+  while (id < g_marker.names.size() && g_marker.names[id] != name) ++id;
+  if (id == g_marker.names.size()) g_marker.names.push_back(name);
+  pthread_mutex_unlock(&g_marker.lock);
+  return id;
+}
+
+void cpuid_marker_select_events(const cpuid_info& info,
+                                std::vector<cpuid_pmu_event_spec>& events) {
+  // Roughly most to least useful per counter; on Intel the first three
+  // are fixed counters and cost nothing.
+  static const char* const preferred[] = {
+    "cycles", "instructions", "ref-cycles",
+    "branch-misses", "llc-misses", "branches", "llc-references"
+  };
+  events.clear();
+  const int count = sizeof(preferred) / sizeof(preferred[0]);
+  for (int i = 0; i < count && events.size() < CPUID_MARKER_MAX_EVENTS; ++i) {
+    cpuid_pmu_event_spec e;
+    if (!cpuid_pmu_find_event(info, preferred[i], e)) continue;
+
+    std::vector<cpuid_pmu_event_spec> candidate = events;
+    candidate.push_back(e);
+    std::vector<std::vector<int> > groups;
+    if (cpuid_pmu_partition(info, candidate, groups) && groups.size() == 1) {
+      events = candidate;
+    }
+  }
+}
+
+void marker_unavailable(const std::string& reason) {
+  pthread_mutex_lock(&g_marker.lock);
+  if (g_marker.unavailable.empty()) g_marker.unavailable = reason;
+  pthread_mutex_unlock(&g_marker.lock);
+}
+
+// Thread-exit destructor: closes the counters, folds the thread's
+// totals into the exited ones and frees its slots.
+void marker_thread_exit(void* p) {
+  cpuid_marker_thread* t = (cpuid_marker_thread*) p;
+  if (t->event_count) cpuid_pmu_close(t->group);
+
+  pthread_mutex_lock(&g_marker.lock);
+  cpuid_marker_thread** link = &g_marker.threads;
+  while (*link != t) link = &(*link)->next;
+  *link = t->next;
+  for (int id = 0; id < CPUID_MARKER_MAX_REGIONS; ++id) {
+    const cpuid_marker_region& r = t->regions[id];
+    cpuid_marker_region& sum = g_marker.exited[id];
+    sum.calls += r.calls;
+    sum.counted_calls += r.counted_calls;
+    sum.tsc_cycles += r.tsc_cycles;
+    for (int i = 0; i < CPUID_MARKER_MAX_EVENTS; ++i) sum.counts[i] += r.counts[i];
+  }
+  ++g_marker.exited_threads;
+  pthread_mutex_unlock(&g_marker.lock);
+
+  cpuid_marker_tls_thread = NULL;
+  t->~cpuid_marker_thread();
+  free(t);
+}
+
+void marker_create_key() {
+  if (pthread_key_create(&g_marker.thread_key, marker_thread_exit) != 0) abort();
+}
+
+cpuid_marker_thread* cpuid_marker_thread_init() {
+  if (cpuid_marker_tls_thread) return cpuid_marker_tls_thread;
+  if (!__atomic_load_n(&g_marker.initialized, __ATOMIC_ACQUIRE)) return NULL;
+
+  pthread_once(&marker_key_once, marker_create_key);
+  void* mem = NULL;
+  if (posix_memalign(&mem, 64, sizeof(cpuid_marker_thread)) != 0) abort();
+  cpuid_marker_thread* t = new (mem) cpuid_marker_thread();
+  t->thread_index = __atomic_fetch_add(&g_marker.next_thread_index, 1, __ATOMIC_RELAXED);
+
+  // The counters run from here on; markers only take differences.
+  if (!g_marker.events.empty()) {
+    if (!cpuid_pmu_open(t->group, g_marker.info, g_marker.events)) {
+      marker_unavailable(t->group.reason);
+    } else if (!t->group.rdpmc) {
+      marker_unavailable("the kernel does not allow RDPMC on these events");
+      cpuid_pmu_close(t->group);
+    } else {
+      cpuid_pmu_reset_and_enable(t->group);
+      t->event_count = t->group.events.size();
+    }
+  }
+
+  pthread_mutex_lock(&g_marker.lock);
+  t->next = g_marker.threads;
+  g_marker.threads = t;
+  pthread_mutex_unlock(&g_marker.lock);
+  cpuid_marker_tls_thread = t;
+  pthread_setspecific(g_marker.thread_key, t);
+  return t;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void marker_print_row(FILE* out, const char* region, const char* thread,
+                      uint64 calls, uint64 counted_calls, uint64 tsc_cycles,
+                      const uint64* counts) {
+  double ms = cpuid_tsc_cycles_to_ns(g_marker.clock, tsc_cycles) / 1e6;
+  fprintf(out, "%-24s %-6s %12llu %12.3f %12.1f", region, thread,
+          (unsigned long long) calls, ms, calls ? double(tsc_cycles) / calls : 0.0);
+
+  if (!g_marker.events.empty()) fprintf(out, " %12llu", (unsigned long long) counted_calls);
+
+  double cycles = 0, instructions = 0;
+  for (size_t i = 0; i < g_marker.events.size(); ++i) {
+    double per_call = counted_calls ? double(counts[i]) / counted_calls : 0.0;
+    fprintf(out, " %14.1f", per_call);
+    if (g_marker.events[i].name == "cycles")       cycles = per_call;
+    if (g_marker.events[i].name == "instructions") instructions = per_call;
+  }
+  if (cycles > 0 && instructions > 0) fprintf(out, " %6.2f", instructions / cycles);
+  fprintf(out, "\n");
+}
+
+void marker_add_row(FILE* out, const char* region, const char* thread,
+                    const cpuid_marker_region& r, cpuid_marker_region& sum, int& active) {
+  if (r.calls == 0) return;
+  marker_print_row(out, region, thread, r.calls, r.counted_calls, r.tsc_cycles, r.counts);
+  sum.calls += r.calls;
+  sum.counted_calls += r.counted_calls;
+  sum.tsc_cycles += r.tsc_cycles;
+  for (int i = 0; i < CPUID_MARKER_MAX_EVENTS; ++i) sum.counts[i] += r.counts[i];
+  ++active;
+}
+
+void cpuid_marker_report(FILE* out) {
+  // Held throughout so that exiting threads wait to free their slots.
+  pthread_mutex_lock(&g_marker.lock);
+  const std::vector<std::string>& names = g_marker.names;
+  const std::string& unavailable = g_marker.unavailable;
+
+  std::vector<cpuid_marker_thread*> threads;
+  for (cpuid_marker_thread* t = g_marker.threads; t; t = t->next) {
+    threads.insert(threads.begin(), t);
+  }
+
+  fprintf(out, "cpuid marker report: %d threads (%u exited), TSC at %.0f MHz\n",
+          int(threads.size() + g_marker.exited_threads), g_marker.exited_threads,
+          g_marker.clock.tsc_hz / 1e6);
+  if (g_marker.events.empty()) {
+    fprintf(out, "counters: none available on this PMU\n");
+  } else if (!unavailable.empty()) {
+    fprintf(out, "counters: not counted on some threads: %s\n", unavailable.c_str());
+  }
+
+  fprintf(out, "%-24s %-6s %12s %12s %12s", "region", "thread", "calls", "ms", "tsc/call");
+  if (!g_marker.events.empty()) fprintf(out, " %12s", "counted");
+  for (size_t i = 0; i < g_marker.events.size(); ++i) {
+    fprintf(out, " %14s", (g_marker.events[i].name + "/call").c_str());
+  }
+  if (!g_marker.events.empty()) fprintf(out, " %6s", "ipc");
+  fprintf(out, "\n");
+
+  // Racy reads of slots other threads write; a row may mix two calls.
+  size_t regions = names.size() < CPUID_MARKER_MAX_REGIONS ? names.size()
+                                                           : CPUID_MARKER_MAX_REGIONS;
+  for (size_t id = 0; id < regions; ++id) {
+    cpuid_marker_region sum;
+    memset(&sum, 0, sizeof(sum));
+    int active = 0;
+    for (size_t k = 0; k < threads.size(); ++k) {
+      char thread[16];
+      snprintf(thread, sizeof(thread), "%u", threads[k]->thread_index);
+      marker_add_row(out, names[id].c_str(), thread, threads[k]->regions[id], sum, active);
+    }
+    marker_add_row(out, names[id].c_str(), "exited", g_marker.exited[id], sum, active);
+    if (active > 1) {
+      marker_print_row(out, names[id].c_str(), "all", sum.calls, sum.counted_calls,
+                       sum.tsc_cycles, sum.counts);
+    }
+  }
+  pthread_mutex_unlock(&g_marker.lock);
+  fflush(out);
+}
+
+void marker_report_to_path() {
+  if (g_marker.report_path.empty()) {
+    cpuid_marker_report(stderr);
+    return;
+  }
+  FILE* out = fopen(g_marker.report_path.c_str(), "a");
+  if (!out) return;
+  cpuid_marker_report(out);
+  fclose(out);
+}
+
+void marker_report_at_exit() {
+  marker_report_to_path();
+}
+
+// Reporting is not async-signal-safe, so the handler only wakes a
+// thread that does it.
+void marker_signal_handler(int) {
+  char c = 0;
+  ssize_t ignored = write(g_marker.wake[1], &c, 1);
+  (void) ignored;
+}
+
+void* marker_reporter(void*) {
+  char c;
+  while (read(g_marker.wake[0], &c, 1) == 1) {
+    marker_report_to_path();
+  }
+  return NULL;
+}
+
+// Undoes a cpuid_marker_init that failed part way. Closing the write
+// end makes the reporter's read return 0, so it can be joined.
+void marker_unwind(bool pipe_open, bool reporter_started) {
+  if (pipe_open) {
+    close(g_marker.wake[1]);
+    if (reporter_started) pthread_join(g_marker.reporter, NULL);
+    close(g_marker.wake[0]);
+  }
+  g_marker.events.clear();
+  g_marker.report_path.clear();
+}
+
+bool cpuid_marker_init(const cpuid_info& info, const cpuid_tsc_clock& clock,
+                       const char* report_path, int report_signal) {
+  if (g_marker.initialized) return false;
+  g_marker.info = info;
+  g_marker.clock = clock;
+  g_marker.report_path = report_path ? report_path : "";
+  cpuid_marker_select_events(info, g_marker.events);
+
+  if (report_signal) {
+    if (pipe(g_marker.wake) != 0) {
+      marker_unwind(false, false);
+      return false;
+    }
+    if (pthread_create(&g_marker.reporter, NULL, marker_reporter, NULL) != 0) {
+      marker_unwind(true, false);
+      return false;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = marker_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(report_signal, &sa, NULL) != 0) {
+      marker_unwind(true, true);
+      return false;
+    }
+  }
+  atexit(marker_report_at_exit);
+
+  __atomic_store_n(&g_marker.initialized, true, __ATOMIC_RELEASE);
+  return true;
+}
@@ -0,0 +1,147 @@
+#ifndef CPUID_MARKER_H
+#define CPUID_MARKER_H
+
+// Region markers with hardware counters, in the style of LIKWID's
+// marker API.
+//
+//   void handle_request() {
+//     REGION_START("handle_request");
+//     ...
+//     REGION_STOP("handle_request");
+//   }
+//
+// Each thread owns preallocated slots, one per region, that accumulate
+// the calls, TSC cycles and counter deltas spent between a start and
+// its stop. The counters are a perf_event group opened on the thread
+// the first time it enters any region (or at cpuid_marker_thread_init);
+// after that, start and stop are RDTSC plus one RDPMC per event, with
+// no system calls. A call during which some counter could not be read
+// with RDPMC (the event was off the PMU, or the kernel disallows RDPMC)
+// still adds to calls and time but not to the counts; `counted_calls`
+// says how many calls the counts cover. Re-entering a region that is
+// already running on the thread only bumps a depth count.
+//
+// cpuid_marker_init picks the events from the PMU: the fixed-counter
+// events first, then as many generic ones as fit in one group. The
+// report is written at exit and whenever the report signal arrives.
+
+#include <cstdio>
+
+#include "cpuid_pmu.h"
+#include "cpuid_tsc.h"
+
+#define CPUID_MARKER_MAX_REGIONS 64
+#define CPUID_MARKER_MAX_EVENTS  8
+
+struct cpuid_marker_region {
+  uint64 calls;
+  uint64 counted_calls;
+  uint64 tsc_cycles;
+  uint64 counts[CPUID_MARKER_MAX_EVENTS];
+
+  // The call in progress.
+  int depth;
+  bool start_counted;
+  uint64 start_tsc;
+  uint64 start_counts[CPUID_MARKER_MAX_EVENTS];
+} __attribute__((aligned(64)));
+
+struct cpuid_marker_thread {
+  uint thread_index;
+  int event_count;                 // 0 if the group could not be opened
+  cpuid_pmu_group group;
+  cpuid_marker_thread* next;       // registry of live threads, newest first
+  cpuid_marker_region regions[CPUID_MARKER_MAX_REGIONS];
+};
+
+// Chooses the events and installs the exit and signal reports. On
+// failure nothing is left installed and it may be called again.
+// `report_path` NULL means stderr; `report_signal` 0 means no signal.
+// Without usable counters regions are still timed, and the report says
+// why there are no counts.
+bool cpuid_marker_init(const cpuid_info&, const cpuid_tsc_clock&,
+                       const char* report_path, int report_signal);
+
+// The events cpuid_marker_init would choose.
+void cpuid_marker_select_events(const cpuid_info&, std::vector<cpuid_pmu_event_spec>&);
+
+// Returns the region's slot index; the same name always gets the same
+// one. Regions past CPUID_MARKER_MAX_REGIONS get an index the markers
+// ignore.
+uint cpuid_marker_register(const char* name);
+
+// Allocates the calling thread's slots and opens its counters. Called
+// implicitly by the first marker on a thread; returns NULL before
+// cpuid_marker_init. At thread exit the counters are closed, the slots
+// freed, and their totals kept for the report's "exited" rows.
+cpuid_marker_thread* cpuid_marker_thread_init();
+
+// Writes the report now. Counts of regions still running are as of
+// their last stop.
+void cpuid_marker_report(FILE*);
+
+extern __thread cpuid_marker_thread* cpuid_marker_tls_thread;
+
+//////////////////////////////////////////////////////////////////////
+
+inline bool cpuid_marker_read_counts(const cpuid_marker_thread* t, uint64* counts) {
+#ifdef __linux__
+  for (int i = 0; i < t->event_count; ++i) {
+    if (!cpuid_pmu_rdpmc_one(t->group, i, counts[i])) return false;
+  }
+  return t->event_count > 0;
+#else
+  (void) t;
+  (void) counts;
+  return false;
+#endif
+}
+
+inline void cpuid_marker_start(uint id) {
+  cpuid_marker_thread* t = cpuid_marker_tls_thread;
+  if (!t && !(t = cpuid_marker_thread_init())) return;
+  if (id >= CPUID_MARKER_MAX_REGIONS) return;
+
+  cpuid_marker_region& r = t->regions[id];
+  if (r.depth++ != 0) return;
+  r.start_counted = cpuid_marker_read_counts(t, r.start_counts);
+  r.start_tsc = cpuid_rdtsc();
+}
+
+inline void cpuid_marker_stop(uint id) {
+  uint64 end_tsc = cpuid_rdtsc();
+  cpuid_marker_thread* t = cpuid_marker_tls_thread;
+  if (!t || id >= CPUID_MARKER_MAX_REGIONS) return;
+
+  cpuid_marker_region& r = t->regions[id];
+  if (r.depth == 0 || --r.depth != 0) return;
+
+  uint64 end_counts[CPUID_MARKER_MAX_EVENTS];
+  if (r.start_counted && cpuid_marker_read_counts(t, end_counts)) {
+    for (int i = 0; i < t->event_count; ++i) {
+      r.counts[i] += end_counts[i] - r.start_counts[i];
+    }
+    ++r.counted_calls;
+  }
+  r.tsc_cycles += end_tsc - r.start_tsc;
+  ++r.calls;
+}
+
+#define CPUID_REGION_START(name)                                              \
+  do {                                                                        \
+    static const uint cpuid_marker_id_ = cpuid_marker_register(name);         \
+    cpuid_marker_start(cpuid_marker_id_);                                     \
+  } while (0)
+
+#define CPUID_REGION_STOP(name)                                               \
+  do {                                                                        \
+    static const uint cpuid_marker_id_ = cpuid_marker_register(name);         \
+    cpuid_marker_stop(cpuid_marker_id_);                                      \
+  } while (0)
+
+#ifndef CPUID_MARKER_NO_SHORT_NAMES
+#define REGION_START(name) CPUID_REGION_START(name)
+#define REGION_STOP(name)  CPUID_REGION_STOP(name)
+#endif
+
+#endif
@@ -0,0 +1,187 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#endif
+
+#include "cpuid_os.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+
+#ifdef __linux__
+
+bool cpuid_os_allowed_cpus(std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return false;
+  }
+
+  cpus.clear();
+  for (int i = 0; i < CPU_SETSIZE; ++i) {
+    if (CPU_ISSET(i, &set)) {
+      cpus.push_back(i);
+    }
+  }
+  return !cpus.empty();
+}
+
+// /sys/devices/system/cpu/online is a list of ranges: "0-3,8-11".
+bool cpuid_os_online_cpus(std::vector<int>& cpus) {
+  std::ifstream in("/sys/devices/system/cpu/online");
+  std::string list;
+  if (!(in >> list)) {
+    return false;
+  }
+
+  cpus.clear();
+  std::istringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    int first = 0, last = 0;
+    char dash;
+    std::istringstream r(range);
+    if (!(r >> first)) return false;
+    if (!(r >> dash >> last)) last = first;
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return !cpus.empty();
+}
+
+bool cpuid_os_set_allowed_cpus(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+      CPU_SET(cpus[i], &set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+bool cpuid_os_pin_current_thread(int cpu) {
+  std::vector<int> cpus(1, cpu);
+  if (!cpuid_os_set_allowed_cpus(cpus)) {
+    return false;
+  }
+  // sched_setaffinity migrates us before returning, but be explicit.
+  sched_yield();
+  return true;
+}
+
+int cpuid_os_current_cpu() {
+  return sched_getcpu();
+}
+
+// Reads the limit in one cgroup directory; -1 means no limit there.
+double cgroup_cpu_quota_in(const std::string& dir, bool v2) {
+  long long quota = -1, period = 0;
+  if (v2) {
+    std::ifstream in((dir + "/cpu.max").c_str());
+    std::string max;
+    if (!(in >> max >> period) || max == "max") return -1;
+    quota = atoll(max.c_str());
+  } else {
+    std::ifstream q((dir + "/cpu.cfs_quota_us").c_str());
+    std::ifstream p((dir + "/cpu.cfs_period_us").c_str());
+    if (!(q >> quota) || !(p >> period)) return -1;
+  }
+  if (quota <= 0 || period <= 0) return -1;
+  return double(quota) / double(period);
+}
+
+// Walks from the process's cgroup up to the mount root.
+double cgroup_cpu_quota_along(const std::string& mount, std::string path, bool v2) {
+  double tightest = -1;
+  for (;;) {
+    double q = cgroup_cpu_quota_in(mount + path, v2);
+    if (q > 0 && (tightest < 0 || q < tightest)) tightest = q;
+    if (path.empty() || path == "/") break;
+    std::string::size_type slash = path.rfind('/');
+    path = (slash == std::string::npos || slash == 0) ? "/" : path.substr(0, slash);
+  }
+  return tightest;
+}
+
+double cpuid_os_cpu_quota() {
+  std::ifstream in("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(in, line)) {
+    // hierarchy-ID:controller-list:cgroup-path
+    std::string::size_type a = line.find(':');
+    std::string::size_type b = line.find(':', a + 1);
+    if (a == std::string::npos || b == std::string::npos) continue;
+    std::string controllers = line.substr(a + 1, b - a - 1);
+    std::string path = line.substr(b + 1);
+
+    if (line.substr(0, a) == "0" && controllers.empty()) {
+      double q = cgroup_cpu_quota_along("/sys/fs/cgroup", path, true);
+      if (q < 0) q = cgroup_cpu_quota_along("/sys/fs/cgroup/unified", path, true);
+      if (q > 0) return q;
+      continue;
+    }
+
+    std::stringstream names(controllers);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+      if (name != "cpu") continue;
+      // Usually mounted under the full controller list, with symlinks
+      // for each controller; inside a container the path may be "/".
+      double q = cgroup_cpu_quota_along("/sys/fs/cgroup/" + controllers, path, false);
+      if (q < 0) q = cgroup_cpu_quota_along("/sys/fs/cgroup/cpu", "/", false);
+      if (q > 0) return q;
+    }
+  }
+  return -1;
+}
+
+std::string cpuid_os_clocksource() {
+  std::ifstream in("/sys/devices/system/clocksource/clocksource0/current_clocksource");
+  std::string name;
+  in >> name;
+  return name;
+}
+
+#else // no affinity interface
+
+bool cpuid_os_allowed_cpus(std::vector<int>& cpus) {
+  cpus.clear();
+  return false;
+}
+
+bool cpuid_os_online_cpus(std::vector<int>& cpus) {
+  cpus.clear();
+  return false;
+}
+
+bool cpuid_os_set_allowed_cpus(const std::vector<int>&) {
+  return false;
+}
+
+bool cpuid_os_pin_current_thread(int) {
+  return false;
+}
+
+int cpuid_os_current_cpu() {
+  return -1;
+}
+
+double cpuid_os_cpu_quota() {
+  return -1;
+}
+
+std::string cpuid_os_clocksource() {
+  return "";
+}
+
+#endif
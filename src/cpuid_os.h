@@ -0,0 +1,38 @@
+#ifndef CPUID_OS_H
+#define CPUID_OS_H
+
+// Thin wrappers around the OS scheduler interfaces needed to run code
+// on a particular logical processor. On platforms without thread
+// affinity support these report failure and leave the caller in place.
+
+#include <string>
+#include <vector>
+
+// Fills `cpus` with the OS indices of the CPUs the calling thread may
+// run on. Returns false if the set could not be determined.
+bool cpuid_os_allowed_cpus(std::vector<int>& cpus);
+
+// Fills `cpus` with the OS indices of every online CPU, whether or not
+// we may run there. Returns false if the set could not be determined.
+bool cpuid_os_online_cpus(std::vector<int>& cpus);
+
+// Restricts the calling thread to exactly the given CPUs.
+bool cpuid_os_set_allowed_cpus(const std::vector<int>& cpus);
+
+// Restricts the calling thread to a single CPU.
+bool cpuid_os_pin_current_thread(int cpu);
+
+// OS index of the CPU the calling thread is running on, or -1.
+int cpuid_os_current_cpu();
+
+// CPU bandwidth available to this process's cgroup (CFS quota divided
+// by period, from cgroup v2 cpu.max or v1 cpu.cfs_quota_us), taking the
+// tightest limit along the hierarchy. Returns -1 if unlimited or unknown.
+double cpuid_os_cpu_quota();
+
+// The kernel's current clocksource ("tsc", "kvm-clock", "hpet", ...),
+// or "" if unknown. A kernel that keeps "tsc" has checked the TSC is
+// stable and synchronized.
+std::string cpuid_os_clocksource();
+
+#endif
@@ -0,0 +1,496 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "cpuid_pmu.h"
+
+const char* cpuid_pmu_access_name(cpuid_pmu_access access) {
+  switch (access) {
+    case CPUID_PMU_OK:            return "ok";
+    case CPUID_PMU_NO_PERF:       return "no_perf";
+    case CPUID_PMU_NO_PMU:        return "no_pmu";
+    case CPUID_PMU_NOT_PERMITTED: return "not_permitted";
+    case CPUID_PMU_TOO_MANY:      return "too_many_events";
+    case CPUID_PMU_OPEN_FAILED:   return "open_failed";
+  }
+  return "?";
+}
+
+// AMD has no leaf 0xA. Counters are 48 bits wide; PerfMonV2 parts
+// count them in leaf 0x80000022, older ones have six with PerfCtrExtCore
+// and four without.
+void pmu_counters(const cpuid_info& info, int& gp, int& ff, uint& gp_width, uint& ff_width) {
+  const tag_processor_features::tag_pm_features& pm = info.processor_features.pm_features;
+  if (std::string("AuthenticAMD") == info.vendor_id) {
+    if (pm.gp_counters_per_processor) {
+      gp = pm.gp_counters_per_processor;
+    } else {
+      gp = cpuid_has_feature(info, "perfctr-core") ? 6 : 4;
+    }
+    ff = 0;
+    gp_width = ff_width = 48;
+    return;
+  }
+  gp = pm.version_id ? pm.gp_counters_per_processor : 0;
+  ff = 0;
+  for (int i = 0; i < 32; ++i) {
+    if (cpuid_pmu_fixed_counter_supported(info, i)) ++ff;
+  }
+  gp_width = pm.gp_counter_bitwidth;
+  ff_width = pm.ff_counter_bitwidth ? pm.ff_counter_bitwidth : gp_width;
+}
+
+int cpuid_pmu_max_group_events(const cpuid_info& info) {
+  int gp, ff;
+  uint gw, fw;
+  pmu_counters(info, gp, ff, gw, fw);
+  return gp + ff;
+}
+
+cpuid_pmu_event_spec cpuid_pmu_hardware_event(const char* name, uint64 perf_hw_id) {
+  cpuid_pmu_event_spec e;
+  e.name = name;
+#ifdef __linux__
+  e.type = PERF_TYPE_HARDWARE;
+#else
+  e.type = 0;
+#endif
+  e.config = perf_hw_id;
+  e.fixed_counter = -1;
+  return e;
+}
+
+bool cpuid_pmu_fixed_counter_supported(const cpuid_info& info, int index) {
+  const tag_processor_features::tag_pm_features& pm = info.processor_features.pm_features;
+  if (pm.version_id < 2 || index < 0 || index >= 32) return false;
+  return ((pm.ff_counter_mask >> index) & 1) || index < pm.ff_counter_count;
+}
+
+#ifdef __linux__
+#define PMU_HW(x)   PERF_TYPE_HARDWARE, PERF_COUNT_HW_##x
+#define PMU_RAW(x)  PERF_TYPE_RAW, x
+#else
+#define PMU_HW(x)   0, 0
+#define PMU_RAW(x)  0, x
+#endif
+
+struct pmu_arch_event {
+  const char* name;
+  int ebx_bit;
+  uint type;
+  uint64 config;        // umask << 8 | event select, for raw events
+  int fixed_counter;
+};
+
+// CPUID.0AH:EBX, in bit order. The generic perf events map to exactly
+// these encodings on Intel and let perf use the fixed counters.
+const pmu_arch_event pmu_intel_arch_events[] = {
+  { "cycles",                 0, PMU_HW(CPU_CYCLES),          1 },
+  { "instructions",           1, PMU_HW(INSTRUCTIONS),        0 },
+  { "ref-cycles",             2, PMU_HW(REF_CPU_CYCLES),      2 },
+  { "llc-references",         3, PMU_HW(CACHE_REFERENCES),   -1 },
+  { "llc-misses",             4, PMU_HW(CACHE_MISSES),       -1 },
+  { "branches",               5, PMU_HW(BRANCH_INSTRUCTIONS), -1 },
+  { "branch-misses",          6, PMU_HW(BRANCH_MISSES),      -1 },
+  { "topdown-slots",          7, PMU_RAW(0x01a4),             3 },
+  { "topdown-backend-bound",  8, PMU_RAW(0x02a4),            -1 },
+  { "topdown-bad-spec",       9, PMU_RAW(0x0073),            -1 },
+  { "topdown-fe-bound",      10, PMU_RAW(0x019c),            -1 },
+  { "topdown-retiring",      11, PMU_RAW(0x02c2),            -1 },
+  { "lbr-inserts",           12, PMU_RAW(0x01e4),            -1 }
+};
+
+const pmu_arch_event pmu_amd_core_events[] = {
+  { "cycles",        -1, PMU_HW(CPU_CYCLES),          -1 },
+  { "instructions",  -1, PMU_HW(INSTRUCTIONS),        -1 },
+  { "branches",      -1, PMU_HW(BRANCH_INSTRUCTIONS), -1 },
+  { "branch-misses", -1, PMU_HW(BRANCH_MISSES),       -1 }
+};
+
+cpuid_pmu_event_spec pmu_spec(const pmu_arch_event& a) {
+  cpuid_pmu_event_spec e;
+  e.name = a.name;
+  e.type = a.type;
+  e.config = a.config;
+  e.fixed_counter = a.fixed_counter;
+  return e;
+}
+
+void cpuid_pmu_available_events(const cpuid_info& info,
+                                std::vector<cpuid_pmu_event_spec>& events) {
+  events.clear();
+  if (std::string("AuthenticAMD") == info.vendor_id) {
+    const int count = sizeof(pmu_amd_core_events) / sizeof(pmu_amd_core_events[0]);
+    for (int i = 0; i < count; ++i) {
+      events.push_back(pmu_spec(pmu_amd_core_events[i]));
+    }
+    return;
+  }
+
+  const tag_processor_features::tag_pm_features& pm = info.processor_features.pm_features;
+  if (pm.version_id == 0) return;
+  const int count = sizeof(pmu_intel_arch_events) / sizeof(pmu_intel_arch_events[0]);
+  for (int i = 0; i < count; ++i) {
+    const pmu_arch_event& a = pmu_intel_arch_events[i];
+    if (a.ebx_bit >= pm.gp_counter_events) continue;
+    if ((pm.arch_events_unavailable >> a.ebx_bit) & 1) continue;
+
+    cpuid_pmu_event_spec e = pmu_spec(a);
+    if (!cpuid_pmu_fixed_counter_supported(info, e.fixed_counter)) {
+      e.fixed_counter = -1;
+    } else if (e.fixed_counter == 3) {
+      // perf's pseudo-encoding for the slots fixed counter.
+      e.config = 0x0400;
+    }
+    events.push_back(e);
+  }
+}
+
+bool cpuid_pmu_find_event(const cpuid_info& info, const char* name,
+                          cpuid_pmu_event_spec& event) {
+  std::vector<cpuid_pmu_event_spec> events;
+  cpuid_pmu_available_events(info, events);
+  for (size_t i = 0; i < events.size(); ++i) {
+    if (events[i].name == name) {
+      event = events[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef __linux__
+
+int cpuid_pmu_paranoid() {
+  FILE* f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+  if (!f) return -100;
+  int level = -100;
+  if (fscanf(f, "%d", &level) != 1) level = -100;
+  fclose(f);
+  return level;
+}
+
+bool pmu_fail(cpuid_pmu_group& g, cpuid_pmu_access access, const std::string& reason) {
+  cpuid_pmu_close(g);
+  g.access = access;
+  g.reason = reason;
+  return false;
+}
+
+bool cpuid_pmu_open(cpuid_pmu_group& g, const cpuid_info& info,
+                    const std::vector<cpuid_pmu_event_spec>& events) {
+  g.events = events;
+  g.fds.clear();
+  g.pages.clear();
+  g.rdpmc = false;
+  g.access = CPUID_PMU_OK;
+  g.reason.clear();
+
+  int gp, ff;
+  pmu_counters(info, gp, ff, g.gp_width, g.ff_width);
+  if (gp == 0) {
+    return pmu_fail(g, CPUID_PMU_NO_PMU, "leaf 0xA reports no general-purpose counters");
+  }
+  if (events.empty() || int(events.size()) > gp + ff) {
+    char buf[96];
+    snprintf(buf, sizeof(buf), "%d events; %d general-purpose and %d fixed counters",
+             int(events.size()), gp, ff);
+    return pmu_fail(g, CPUID_PMU_TOO_MANY, buf);
+  }
+
+  int paranoid = cpuid_pmu_paranoid();
+  long page_size = sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; i < events.size(); ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = i == 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP
+                     | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, g.fds.empty() ? -1 : g.fds[0], 0);
+    if (fd < 0) {
+      int err = errno;
+      char buf[160];
+      if (err == ENOSYS) {
+        return pmu_fail(g, CPUID_PMU_NO_PERF, "perf_event_open not supported by this kernel");
+      } else if (err == EACCES || err == EPERM) {
+        snprintf(buf, sizeof(buf),
+                 "perf_event_paranoid is %d; user-space counting needs <= 2 "
+                 "or CAP_PERFMON", paranoid);
+        return pmu_fail(g, CPUID_PMU_NOT_PERMITTED, buf);
+      } else if (err == ENOENT || err == EOPNOTSUPP || err == ENODEV) {
+        snprintf(buf, sizeof(buf), "%s: not supported by this PMU (%s)",
+                 events[i].name.c_str(), strerror(err));
+        return pmu_fail(g, CPUID_PMU_NO_PMU, buf);
+      }
+      snprintf(buf, sizeof(buf), "%s: %s", events[i].name.c_str(), strerror(err));
+      return pmu_fail(g, CPUID_PMU_OPEN_FAILED, buf);
+    }
+    g.fds.push_back(fd);
+
+    void* page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+    g.pages.push_back(page == MAP_FAILED ? NULL : page);
+  }
+
+  // The kernel accepts groups it can never schedule; find out now.
+  std::vector<uint64> values(events.size());
+  uint64 enabled, running;
+  cpuid_pmu_reset_and_enable(g);
+  bool ok = cpuid_pmu_read_syscall(g, &values[0], enabled, running);
+  cpuid_pmu_disable(g);
+  if (!ok || running == 0) {
+    return pmu_fail(g, CPUID_PMU_TOO_MANY, "the group does not fit on the PMU");
+  }
+
+  g.rdpmc = true;
+  for (size_t i = 0; i < g.pages.size(); ++i) {
+    volatile struct perf_event_mmap_page* pc = (volatile struct perf_event_mmap_page*) g.pages[i];
+    if (!pc || !pc->cap_user_rdpmc) g.rdpmc = false;
+  }
+  return true;
+}
+
+void cpuid_pmu_close(cpuid_pmu_group& g) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; i < g.pages.size(); ++i) {
+    if (g.pages[i]) munmap(g.pages[i], page_size);
+  }
+  for (size_t i = g.fds.size(); i-- > 0; ) {
+    close(g.fds[i]);
+  }
+  g.pages.clear();
+  g.fds.clear();
+  g.rdpmc = false;
+}
+
+void cpuid_pmu_reset_and_enable(cpuid_pmu_group& g) {
+  if (g.fds.empty()) return;
+  ioctl(g.fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(g.fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void cpuid_pmu_disable(cpuid_pmu_group& g) {
+  if (g.fds.empty()) return;
+  ioctl(g.fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+bool cpuid_pmu_read_syscall(const cpuid_pmu_group& g, uint64* values,
+                            uint64& time_enabled, uint64& time_running) {
+  if (g.fds.empty()) return false;
+  // nr, time_enabled, time_running, values...
+  std::vector<uint64> buf(3 + g.fds.size());
+  ssize_t bytes = buf.size() * sizeof(uint64);
+  if (read(g.fds[0], &buf[0], bytes) != bytes || buf[0] != g.fds.size()) {
+    return false;
+  }
+  time_enabled = buf[1];
+  time_running = buf[2];
+  for (size_t i = 0; i < g.fds.size(); ++i) {
+    values[i] = buf[3 + i];
+  }
+  return true;
+}
+
+bool cpuid_pmu_read(const cpuid_pmu_group& g, uint64* values) {
+  if (g.rdpmc) {
+    size_t i = 0;
+    for (; i < g.pages.size(); ++i) {
+      if (!cpuid_pmu_rdpmc_one(g, i, values[i])) break;
+    }
+    if (i == g.pages.size()) return true;
+  }
+  uint64 enabled, running;
+  return cpuid_pmu_read_syscall(g, values, enabled, running);
+}
+
+#else
+
+int cpuid_pmu_paranoid() { return -100; }
+
+bool cpuid_pmu_open(cpuid_pmu_group& g, const cpuid_info&,
+                    const std::vector<cpuid_pmu_event_spec>& events) {
+  g.events = events;
+  g.rdpmc = false;
+  g.access = CPUID_PMU_NO_PERF;
+  g.reason = "perf_event_open is Linux-only";
+  return false;
+}
+
+void cpuid_pmu_close(cpuid_pmu_group& g) {
+  g.fds.clear();
+  g.pages.clear();
+}
+
+void cpuid_pmu_reset_and_enable(cpuid_pmu_group&) {}
+void cpuid_pmu_disable(cpuid_pmu_group&) {}
+
+bool cpuid_pmu_read_syscall(const cpuid_pmu_group&, uint64*, uint64&, uint64&) {
+  return false;
+}
+
+bool cpuid_pmu_read(const cpuid_pmu_group&, uint64*) {
+  return false;
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////
+
+// The Linux NMI watchdog holds a cycles event for as long as it runs:
+// on Intel it takes fixed counter 1, on AMD a general-purpose counter.
+bool pmu_nmi_watchdog() {
+  FILE* f = fopen("/proc/sys/kernel/nmi_watchdog", "r");
+  if (!f) return false;
+  int on = 0;
+  if (fscanf(f, "%d", &on) != 1) on = 0;
+  fclose(f);
+  return on != 0;
+}
+
+bool cpuid_pmu_partition(const cpuid_info& info, const std::vector<cpuid_pmu_event_spec>& events,
+                         std::vector<std::vector<int> >& groups) {
+  int gp, ff;
+  uint gw, fw;
+  pmu_counters(info, gp, ff, gw, fw);
+  bool watchdog = pmu_nmi_watchdog();
+  bool amd = std::string("AuthenticAMD") == info.vendor_id;
+  if (watchdog && amd) --gp;
+
+  std::vector<int> fixed, general;
+  std::vector<bool> fixed_taken(32, false);
+  if (watchdog && !amd) fixed_taken[1] = true;
+  for (size_t i = 0; i < events.size(); ++i) {
+    int fc = events[i].fixed_counter;
+    if (fc >= 0 && fc < 32 && !fixed_taken[fc]) {
+      fixed_taken[fc] = true;
+      fixed.push_back(i);
+    } else {
+      general.push_back(i);
+    }
+  }
+
+  groups.clear();
+  if (!general.empty() && gp <= 0) return false;
+  int n = general.empty() ? 1 : (int(general.size()) + gp - 1) / gp;
+  groups.resize(n, fixed);
+  // Round-robin, so the groups are balanced and every event gets a
+  // similar number of repetitions.
+  for (size_t k = 0; k < general.size(); ++k) {
+    groups[k % n].push_back(general[k]);
+  }
+  return !events.empty();
+}
+
+void cpuid_pmu_schedule_reset(cpuid_pmu_schedule& s) {
+  s.active = -1;
+  s.repetitions = 0;
+  s.counted.assign(s.events.size(), 0);
+  s.sum.assign(s.events.size(), 0.0);
+  s.sum_squares.assign(s.events.size(), 0.0);
+  s.multiplexed.assign(s.events.size(), false);
+}
+
+bool cpuid_pmu_schedule_init(cpuid_pmu_schedule& s, const cpuid_info& info,
+                             const std::vector<cpuid_pmu_event_spec>& events) {
+  s.events = events;
+  s.groups.clear();
+  s.access = CPUID_PMU_OK;
+  s.reason.clear();
+  cpuid_pmu_schedule_reset(s);
+
+  if (!cpuid_pmu_partition(info, events, s.members)) {
+    s.access = CPUID_PMU_NO_PMU;
+    s.reason = "no general-purpose counters to schedule events on";
+    return false;
+  }
+
+  s.groups.resize(s.members.size());
+  for (size_t g = 0; g < s.members.size(); ++g) {
+    std::vector<cpuid_pmu_event_spec> specs;
+    for (size_t k = 0; k < s.members[g].size(); ++k) {
+      specs.push_back(events[s.members[g][k]]);
+    }
+    if (!cpuid_pmu_open(s.groups[g], info, specs)) {
+      s.access = s.groups[g].access;
+      s.reason = s.groups[g].reason;
+      cpuid_pmu_schedule_free(s);
+      return false;
+    }
+  }
+  return true;
+}
+
+void cpuid_pmu_schedule_free(cpuid_pmu_schedule& s) {
+  for (size_t g = 0; g < s.groups.size(); ++g) {
+    cpuid_pmu_close(s.groups[g]);
+  }
+  s.groups.clear();
+  s.active = -1;
+}
+
+void cpuid_pmu_schedule_begin(cpuid_pmu_schedule& s) {
+  if (s.groups.empty()) return;
+  s.active = s.repetitions % s.groups.size();
+  cpuid_pmu_reset_and_enable(s.groups[s.active]);
+}
+
+bool cpuid_pmu_schedule_end(cpuid_pmu_schedule& s) {
+  if (s.active < 0) return false;
+  cpuid_pmu_group& g = s.groups[s.active];
+  cpuid_pmu_disable(g);
+
+  std::vector<uint64> values(g.events.size());
+  uint64 enabled = 0, running = 0;
+  bool ok = cpuid_pmu_read_syscall(g, &values[0], enabled, running) && running > 0;
+  if (ok) {
+    double scale = running < enabled ? double(enabled) / double(running) : 1.0;
+    const std::vector<int>& members = s.members[s.active];
+    for (size_t k = 0; k < members.size(); ++k) {
+      int e = members[k];
+      double v = double(values[k]) * scale;
+      ++s.counted[e];
+      s.sum[e] += v;
+      s.sum_squares[e] += v * v;
+      if (scale != 1.0) s.multiplexed[e] = true;
+    }
+  }
+  ++s.repetitions;
+  s.active = -1;
+  return ok;
+}
+
+void cpuid_pmu_schedule_results(const cpuid_pmu_schedule& s, std::vector<tag_pmu_count>& out) {
+  out.clear();
+  for (size_t e = 0; e < s.events.size(); ++e) {
+    tag_pmu_count c;
+    c.name = s.events[e].name;
+    c.repetitions = s.counted[e];
+    c.multiplexed = s.multiplexed[e];
+    c.mean = c.standard_error = 0;
+    int n = c.repetitions;
+    if (n > 0) {
+      c.mean = s.sum[e] / n;
+    }
+    if (n > 1) {
+      double var = (s.sum_squares[e] - n * c.mean * c.mean) / (n - 1);
+      c.standard_error = var > 0 ? sqrt(var / n) : 0;
+    }
+    out.push_back(c);
+  }
+}
@@ -0,0 +1,183 @@
+#ifndef CPUID_PMU_H
+#define CPUID_PMU_H
+
+// Hardware performance counters read from userspace. Events are opened
+// as one perf_event group on the calling thread, so they are scheduled
+// onto the PMU together and their counts cover the same instructions.
+// A group holds at most the general-purpose counters from leaf 0xA
+// plus, for events the fixed counters implement, the fixed counters.
+//
+// Each event's perf mmap page tells us which hardware counter it is on.
+// While the kernel allows it (cap_user_rdpmc), reading is an RDPMC plus
+// the kernel's saved offset, with no system call. The raw counter is
+// only gp_counter_bitwidth (or ff_counter_bitwidth) bits wide and is
+// sign-extended from there before adding the offset. When RDPMC is not
+// allowed the counts are read with read(2) instead.
+//
+// Unprivileged use needs perf_event_paranoid <= 2 (user-space counting
+// of our own threads); a refusal is reported, not treated as fatal.
+
+#include "cpuid.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+enum cpuid_pmu_access {
+  CPUID_PMU_OK,
+  CPUID_PMU_NO_PERF,        // no perf_event_open on this OS/kernel
+  CPUID_PMU_NO_PMU,         // no architectural PMU, or not exposed to us
+  CPUID_PMU_NOT_PERMITTED,  // perf_event_paranoid or capabilities
+  CPUID_PMU_TOO_MANY,       // more events than counters
+  CPUID_PMU_OPEN_FAILED
+};
+
+struct cpuid_pmu_group {
+  std::vector<cpuid_pmu_event_spec> events;
+  std::vector<int> fds;          // fds[0] leads
+  std::vector<void*> pages;      // perf_event_mmap_page per event
+  uint gp_width;
+  uint ff_width;
+  bool rdpmc;                    // every event readable without a syscall
+  cpuid_pmu_access access;
+  std::string reason;            // why access != CPUID_PMU_OK
+};
+
+// General-purpose plus fixed counters; the most events one group can hold.
+int cpuid_pmu_max_group_events(const cpuid_info&);
+
+// /proc/sys/kernel/perf_event_paranoid, or -100 if unreadable.
+int cpuid_pmu_paranoid();
+
+// Opens the events as a disabled group on the calling thread.
+bool cpuid_pmu_open(cpuid_pmu_group&, const cpuid_info&,
+                    const std::vector<cpuid_pmu_event_spec>&);
+void cpuid_pmu_close(cpuid_pmu_group&);
+
+// Reset and start, or stop, the whole group. These are system calls;
+// keep them out of measured regions.
+void cpuid_pmu_reset_and_enable(cpuid_pmu_group&);
+void cpuid_pmu_disable(cpuid_pmu_group&);
+
+// Reads every count with read(2), along with the time the group was
+// enabled and actually running on the PMU.
+bool cpuid_pmu_read_syscall(const cpuid_pmu_group&, uint64* values,
+                            uint64& time_enabled, uint64& time_running);
+
+// Reads every count, with RDPMC where possible.
+bool cpuid_pmu_read(const cpuid_pmu_group&, uint64* values);
+
+const char* cpuid_pmu_access_name(cpuid_pmu_access);
+
+// Generic events every perf PMU driver maps.
+cpuid_pmu_event_spec cpuid_pmu_hardware_event(const char* name, uint64 perf_hw_id);
+
+// Architectural events, from leaf 0xA on Intel: an event is available
+// if its EBX bit is within the EAX[31:24]-bit vector and clear. Events
+// a supported fixed counter implements carry its index. On AMD, which
+// has no leaf 0xA, the core events perf maps on every Zen part.
+// Profiling code should only open events from this list, which
+// cpuid_introspect() keeps in info.available_events.
+void cpuid_pmu_available_events(const cpuid_info&, std::vector<cpuid_pmu_event_spec>&);
+
+// Finds an available event by name; false if absent.
+bool cpuid_pmu_find_event(const cpuid_info&, const char* name, cpuid_pmu_event_spec&);
+
+// Fixed counter i exists if ECX[i] is set or i < EDX[4:0].
+bool cpuid_pmu_fixed_counter_supported(const cpuid_info&, int index);
+
+//////////////////////////////////////////////////////////////////////
+
+// Measuring more events than there are counters. Rather than let perf
+// time-multiplex one oversized group, the events are split into the
+// fewest groups that each fit the hardware, and a repeated measurement
+// rotates through them: repetition r counts only group r % n. Events a
+// fixed counter implements ride along in every group for free, so
+// cycles and instructions are counted on every repetition.
+//
+// Each event's count is the mean over the repetitions that counted it,
+// with the standard error of that mean as its confidence. Counter
+// constraints of individual events (some only run on counters 0-3) are
+// not modelled; perf rejects such groups at open, which is reported.
+
+// Splits events into groups; returns false if some event cannot fit
+// anywhere. Indices refer to `events`.
+bool cpuid_pmu_partition(const cpuid_info&, const std::vector<cpuid_pmu_event_spec>& events,
+                         std::vector<std::vector<int> >& groups);
+
+struct cpuid_pmu_schedule {
+  std::vector<cpuid_pmu_event_spec> events;
+  std::vector<std::vector<int> > members;   // per group, indices into events
+  std::vector<cpuid_pmu_group> groups;
+  int active;                               // group counting now, or -1
+  int repetitions;
+
+  // Per event, over the repetitions that counted it.
+  std::vector<int> counted;
+  std::vector<double> sum;
+  std::vector<double> sum_squares;
+  std::vector<bool> multiplexed;            // perf time-sliced it anyway
+
+  cpuid_pmu_access access;
+  std::string reason;
+};
+
+struct tag_pmu_count {
+  std::string name;
+  int repetitions;         // that counted this event
+  double mean;             // per repetition
+  double standard_error;   // of the mean; 0 with one repetition
+  bool multiplexed;
+};
+
+bool cpuid_pmu_schedule_init(cpuid_pmu_schedule&, const cpuid_info&,
+                             const std::vector<cpuid_pmu_event_spec>& events);
+void cpuid_pmu_schedule_free(cpuid_pmu_schedule&);
+
+// Clears the accumulated counts; the rotation starts over.
+void cpuid_pmu_schedule_reset(cpuid_pmu_schedule&);
+
+// Bracket one repetition. Both are system calls.
+void cpuid_pmu_schedule_begin(cpuid_pmu_schedule&);
+bool cpuid_pmu_schedule_end(cpuid_pmu_schedule&);
+
+void cpuid_pmu_schedule_results(const cpuid_pmu_schedule&, std::vector<tag_pmu_count>&);
+
+//////////////////////////////////////////////////////////////////////
+
+inline uint64 cpuid_rdpmc(uint counter) {
+  uint lo, hi;
+  __asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+  return (uint64(hi) << 32) | lo;
+}
+
+#ifdef __linux__
+// Returns false if the event is not on a counter we may RDPMC right now.
+inline bool cpuid_pmu_rdpmc_one(const cpuid_pmu_group& g, size_t i, uint64& value) {
+  volatile struct perf_event_mmap_page* pc = (volatile struct perf_event_mmap_page*) g.pages[i];
+  uint seq;
+  uint64 count;
+  do {
+    seq = pc->lock;
+    __asm__ __volatile__("" ::: "memory");
+    uint index = pc->index;
+    count = pc->offset;
+    if (!pc->cap_user_rdpmc || index == 0) return false;
+
+    // The kernel's width wins; fixed counters are selected with bit 30
+    // of the RDPMC index. With no width the sign extension is undefined.
+    uint counter = index - 1;
+    uint width = pc->pmc_width;
+    if (width == 0) width = (counter & (1U << 30)) ? g.ff_width : g.gp_width;
+    if (width == 0 || width > 64) return false;
+    uint64 raw = cpuid_rdpmc(counter) << (64 - width);
+    count += uint64(int64(raw) >> (64 - width));
+
+    __asm__ __volatile__("" ::: "memory");
+  } while (pc->lock != seq);
+  value = count;
+  return true;
+}
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <pthread.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "cpuid_le.h"
+#include "cpuid_probe.h"
+
+__thread cpuid_probe_ring* cpuid_probe_tls_ring = NULL;
+
+struct probe_state {
+  pthread_mutex_t names_lock;
+  std::vector<std::string> names;
+  size_t names_written;
+
+  // Rings are pushed with CAS. Draining them, and unlinking the ring
+  // of an exited thread, happen under drain_lock.
+  cpuid_probe_ring* rings;
+  uint next_thread_index;
+  pthread_mutex_t drain_lock;
+  pthread_once_t key_once;
+  pthread_key_t ring_key;
+
+  cpuid_tsc_clock clock;
+  FILE* out;
+  int interval_ms;
+  pthread_t drainer;
+  volatile int running;
+  std::vector<unsigned char> scratch;
+};
+
+probe_state g_probe = { PTHREAD_MUTEX_INITIALIZER, std::vector<std::string>(), 0, NULL, 0,
+                        PTHREAD_MUTEX_INITIALIZER, PTHREAD_ONCE_INIT };
+
+void cpuid_probe_decode_header(const unsigned char* p, cpuid_probe_file_header& h) {
+  memcpy(h.magic, p, sizeof(h.magic));
+  h.version  = cpuid_get_le32(p + 8);
+  h.reserved = cpuid_get_le32(p + 12);
+  h.tsc_hz   = cpuid_get_le64(p + 16);
+}
+
+void cpuid_probe_decode_chunk(const unsigned char* p, cpuid_probe_chunk_header& h) {
+  h.kind          = cpuid_get_le32(p + 0);
+  h.count         = cpuid_get_le32(p + 4);
+  h.payload_bytes = cpuid_get_le32(p + 8);
+  h.reserved      = cpuid_get_le32(p + 12);
+}
+
+void cpuid_probe_decode_event(const unsigned char* p, cpuid_probe_file_event& e) {
+  e.probe_id     = cpuid_get_le32(p + 0);
+  e.thread_index = cpuid_get_le32(p + 4);
+  e.start_ns     = cpuid_get_le64(p + 8);
+  e.duration_ns  = cpuid_get_le64(p + 16);
+}
+
+void probe_unlink(cpuid_probe_ring* ring) {
+  cpuid_probe_ring* head = ring;
+  if (__atomic_compare_exchange_n(&g_probe.rings, &head, ring->next, false,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  // Newer rings were pushed ahead of this one. Pushes only write the
+  // list head, so the links behind it belong to the lock holder.
+  cpuid_probe_ring* prev = head;
+  while (prev->next != ring) prev = prev->next;
+  prev->next = ring->next;
+}
+
+void probe_drain_ring(cpuid_probe_ring* ring, uint64 head);
+void probe_write_names();
+
+// Thread-exit destructor for the ring key.
+void probe_thread_exit(void* p) {
+  cpuid_probe_ring* ring = (cpuid_probe_ring*) p;
+  pthread_mutex_lock(&g_probe.drain_lock);
+  if (g_probe.out) {
+    probe_write_names();
+    probe_drain_ring(ring, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+    fflush(g_probe.out);
+  }
+  probe_unlink(ring);
+  pthread_mutex_unlock(&g_probe.drain_lock);
+  cpuid_probe_tls_ring = NULL;
+  free(ring);
+}
+
+void probe_create_key() {
+  if (pthread_key_create(&g_probe.ring_key, probe_thread_exit) != 0) abort();
+}
+
+uint cpuid_probe_register(const char* name) {
+  pthread_mutex_lock(&g_probe.names_lock);
+  uint id = g_probe.names.size();
+  g_probe.names.push_back(name);
+  pthread_mutex_unlock(&g_probe.names_lock);
+  return id;
+}
+
+cpuid_probe_ring* cpuid_probe_thread_init() {
+  if (cpuid_probe_tls_ring) return cpuid_probe_tls_ring;
+  pthread_once(&g_probe.key_once, probe_create_key);
+
+  void* mem = NULL;
+  if (posix_memalign(&mem, 128, sizeof(cpuid_probe_ring)) != 0) abort();
+  cpuid_probe_ring* ring = (cpuid_probe_ring*) mem;
+  memset(ring, 0, sizeof(*ring));
+  ring->thread_index = __atomic_fetch_add(&g_probe.next_thread_index, 1, __ATOMIC_RELAXED);
+
+  ring->next = __atomic_load_n(&g_probe.rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&g_probe.rings, &ring->next, ring, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+  cpuid_probe_tls_ring = ring;
+  pthread_setspecific(g_probe.ring_key, ring);
+  return ring;
+}
+
+void probe_write_chunk(uint kind, uint count, const void* payload, uint bytes) {
+  unsigned char h[CPUID_PROBE_CHUNK_HEADER_SIZE];
+  cpuid_put_le32(h + 0, kind);
+  cpuid_put_le32(h + 4, count);
+  cpuid_put_le32(h + 8, bytes);
+  cpuid_put_le32(h + 12, 0);
+  fwrite(h, sizeof(h), 1, g_probe.out);
+  if (bytes) fwrite(payload, 1, bytes, g_probe.out);
+}
+
+uint64 probe_tsc_to_ns(uint64 tsc) {
+  const cpuid_tsc_clock& c = g_probe.clock;
+  if (tsc >= c.base_tsc) return c.base_ns + cpuid_tsc_cycles_to_ns(c, tsc - c.base_tsc);
+  uint64 back = cpuid_tsc_cycles_to_ns(c, c.base_tsc - tsc);
+  return back < c.base_ns ? c.base_ns - back : 0;
+}
+
+void probe_write_names() {
+  pthread_mutex_lock(&g_probe.names_lock);
+  for (; g_probe.names_written < g_probe.names.size(); ++g_probe.names_written) {
+    const std::string& name = g_probe.names[g_probe.names_written];
+    probe_write_chunk(CPUID_PROBE_CHUNK_NAME, g_probe.names_written, name.data(), name.size());
+  }
+  pthread_mutex_unlock(&g_probe.names_lock);
+}
+
+// Writes the ring's events below `head`, then any new drops.
+void probe_drain_ring(cpuid_probe_ring* ring, uint64 head) {
+  uint64 tail = ring->tail;
+  g_probe.scratch.resize((head - tail) * CPUID_PROBE_FILE_EVENT_SIZE);
+  unsigned char* p = g_probe.scratch.empty() ? NULL : &g_probe.scratch[0];
+  for (; tail != head; ++tail, p += CPUID_PROBE_FILE_EVENT_SIZE) {
+    const cpuid_probe_event& e = ring->events[tail & (CPUID_PROBE_RING_EVENTS - 1)];
+    cpuid_put_le32(p + 0, e.probe_id);
+    cpuid_put_le32(p + 4, e.thread_index);
+    cpuid_put_le64(p + 8, probe_tsc_to_ns(e.start));
+    cpuid_put_le64(p + 16, e.end > e.start ? cpuid_tsc_cycles_to_ns(g_probe.clock, e.end - e.start) : 0);
+  }
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+  if (!g_probe.scratch.empty()) {
+    probe_write_chunk(CPUID_PROBE_CHUNK_EVENTS, g_probe.scratch.size() / CPUID_PROBE_FILE_EVENT_SIZE,
+                      &g_probe.scratch[0], g_probe.scratch.size());
+  }
+
+  // Racy read of a counter only the producer writes; any drops we
+  // miss now are reported next time.
+  uint64 dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+  if (dropped != ring->dropped_reported) {
+    probe_write_chunk(CPUID_PROBE_CHUNK_DROPS, uint(dropped - ring->dropped_reported), NULL, 0);
+    ring->dropped_reported = dropped;
+  }
+}
+
+void probe_drain_once() {
+  pthread_mutex_lock(&g_probe.drain_lock);
+
+  // Snapshot the rings first: every event below the snapshot was
+  // recorded after its probe's name was registered, so writing the
+  // names next keeps them ahead of the events in the file.
+  std::vector<std::pair<cpuid_probe_ring*, uint64> > heads;
+  cpuid_probe_ring* ring = __atomic_load_n(&g_probe.rings, __ATOMIC_ACQUIRE);
+  for (; ring; ring = ring->next) {
+    heads.push_back(std::make_pair(ring, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)));
+  }
+
+  probe_write_names();
+  for (size_t i = 0; i < heads.size(); ++i) {
+    probe_drain_ring(heads[i].first, heads[i].second);
+  }
+  fflush(g_probe.out);
+  pthread_mutex_unlock(&g_probe.drain_lock);
+}
+
+void* probe_drainer(void*) {
+  struct timespec pause = { g_probe.interval_ms / 1000,
+                            (g_probe.interval_ms % 1000) * 1000000L };
+  while (__atomic_load_n(&g_probe.running, __ATOMIC_ACQUIRE)) {
+    nanosleep(&pause, NULL);
+    probe_drain_once();
+  }
+  return NULL;
+}
+
+bool cpuid_probe_start(const char* path, const cpuid_tsc_clock& clock, int interval_ms) {
+  if (g_probe.out) return false;
+  FILE* out = fopen(path, "wb");
+  if (!out) return false;
+
+  unsigned char h[CPUID_PROBE_FILE_HEADER_SIZE];
+  memcpy(h, CPUID_PROBE_FILE_MAGIC, 8);
+  cpuid_put_le32(h + 8, CPUID_PROBE_FILE_VERSION);
+  cpuid_put_le32(h + 12, 0);
+  cpuid_put_le64(h + 16, clock.tsc_hz);
+  fwrite(h, sizeof(h), 1, out);
+
+  // Exiting threads look at `out` under the drain lock.
+  pthread_mutex_lock(&g_probe.drain_lock);
+  g_probe.clock = clock;
+  g_probe.interval_ms = interval_ms > 0 ? interval_ms : 1;
+  g_probe.names_written = 0;
+  g_probe.out = out;
+  pthread_mutex_unlock(&g_probe.drain_lock);
+
+  g_probe.running = 1;
+  if (pthread_create(&g_probe.drainer, NULL, probe_drainer, NULL) != 0) {
+    g_probe.running = 0;
+    pthread_mutex_lock(&g_probe.drain_lock);
+    g_probe.out = NULL;
+    pthread_mutex_unlock(&g_probe.drain_lock);
+    fclose(out);
+    return false;
+  }
+  return true;
+}
+
+void cpuid_probe_stop() {
+  if (!g_probe.out) return;
+  __atomic_store_n(&g_probe.running, 0, __ATOMIC_RELEASE);
+  pthread_join(g_probe.drainer, NULL);
+  probe_drain_once();
+  pthread_mutex_lock(&g_probe.drain_lock);
+  fclose(g_probe.out);
+  g_probe.out = NULL;
+  pthread_mutex_unlock(&g_probe.drain_lock);
+}
@@ -0,0 +1,154 @@
+#ifndef CPUID_PROBE_H
+#define CPUID_PROBE_H
+
+// Scoped TSC probes for production hot paths.
+//
+//   void handle_request() {
+//     CPUID_PROBE_SCOPE("handle_request");
+//     ...
+//   }
+//
+// Each thread writes (probe id, start, end) into its own
+// single-producer ring; recording takes no locks and allocates
+// nothing. A background drainer empties the rings, converts cycles to
+// nanoseconds with the calibrated TSC clock and appends the events to
+// a compact binary file, which probe_summary reads back. Events that
+// arrive while a ring is full are counted and dropped.
+//
+// The reads are unfenced RDTSC: a probe costs tens of cycles, and
+// out-of-order skew at that scale is below what such probes resolve.
+
+#include "cpuid_tsc.h"
+
+#define CPUID_PROBE_RING_EVENTS 4096   // per thread; a power of two
+
+struct cpuid_probe_event {
+  uint   probe_id;
+  uint   thread_index;
+  uint64 start;
+  uint64 end;
+};
+
+struct cpuid_probe_ring {
+  // Producer side.
+  uint64 head __attribute__((aligned(128)));
+  uint64 cached_tail;
+  uint64 dropped;
+
+  // Consumer side.
+  uint64 tail __attribute__((aligned(128)));
+  uint64 dropped_reported;
+
+  uint thread_index;
+  cpuid_probe_ring* next;   // registry of live rings, newest first
+  cpuid_probe_event events[CPUID_PROBE_RING_EVENTS];
+};
+
+// Starts the drainer writing to `path` every `interval_ms`.
+bool cpuid_probe_start(const char* path, const cpuid_tsc_clock&, int interval_ms);
+
+// Drains everything recorded so far, then stops the drainer.
+void cpuid_probe_stop();
+
+// Returns a stable ID for the name; names may repeat.
+uint cpuid_probe_register(const char* name);
+
+// Allocates the calling thread's ring. Called implicitly by the first
+// probe on a thread; call it at thread start to keep that off the
+// hot path. When the thread exits, what is left in its ring is written
+// out (if the drainer is running) and the ring is freed.
+cpuid_probe_ring* cpuid_probe_thread_init();
+
+extern __thread cpuid_probe_ring* cpuid_probe_tls_ring;
+
+//////////////////////////////////////////////////////////////////////
+
+inline void cpuid_probe_record(uint probe_id, uint64 start, uint64 end) {
+  cpuid_probe_ring* ring = cpuid_probe_tls_ring;
+  if (!ring) ring = cpuid_probe_thread_init();
+
+  uint64 head = ring->head;
+  if (head - ring->cached_tail >= CPUID_PROBE_RING_EVENTS) {
+    ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - ring->cached_tail >= CPUID_PROBE_RING_EVENTS) {
+      ++ring->dropped;
+      return;
+    }
+  }
+
+  cpuid_probe_event& e = ring->events[head & (CPUID_PROBE_RING_EVENTS - 1)];
+  e.probe_id = probe_id;
+  e.thread_index = ring->thread_index;
+  e.start = start;
+  e.end = end;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+struct cpuid_probe_scope {
+  uint probe_id;
+  uint64 start;
+
+  explicit cpuid_probe_scope(uint id) : probe_id(id), start(cpuid_rdtsc()) {}
+  ~cpuid_probe_scope() { cpuid_probe_record(probe_id, start, cpuid_rdtsc()); }
+};
+
+#define CPUID_PROBE_CONCAT_(a, b) a##b
+#define CPUID_PROBE_CONCAT(a, b) CPUID_PROBE_CONCAT_(a, b)
+
+#define CPUID_PROBE_SCOPE(name)                                              \
+  static const uint CPUID_PROBE_CONCAT(cpuid_probe_id_, __LINE__)            \
+      = cpuid_probe_register(name);                                          \
+  cpuid_probe_scope CPUID_PROBE_CONCAT(cpuid_probe_scope_, __LINE__)(        \
+      CPUID_PROBE_CONCAT(cpuid_probe_id_, __LINE__))
+
+//////////////////////////////////////////////////////////////////////
+
+// On-disk format, little-endian and packed; the structs below are the
+// decoded forms. A header, then chunks. Name chunks always precede the
+// first event chunk that uses the name.
+//
+//   header, 24 bytes: 0 "CPUIDPRB", 8 u32 version, 12 u32 reserved,
+//                     16 u64 tsc_hz
+//   chunk header, 16 bytes: 0 u32 kind, 4 u32 count, 8 u32 payload_bytes,
+//                           12 u32 reserved
+//   event, 24 bytes: 0 u32 probe_id, 4 u32 thread_index, 8 u64 start_ns,
+//                    16 u64 duration_ns
+#define CPUID_PROBE_FILE_MAGIC   "CPUIDPRB"
+#define CPUID_PROBE_FILE_VERSION 1
+
+#define CPUID_PROBE_FILE_HEADER_SIZE  24
+#define CPUID_PROBE_CHUNK_HEADER_SIZE 16
+#define CPUID_PROBE_FILE_EVENT_SIZE   24
+
+enum cpuid_probe_chunk_kind {
+  CPUID_PROBE_CHUNK_NAME   = 1,  // payload: name bytes; `count` is the probe id
+  CPUID_PROBE_CHUNK_EVENTS = 2,  // payload: `count` events
+  CPUID_PROBE_CHUNK_DROPS  = 3   // payload: none; `count` events were dropped
+};
+
+struct cpuid_probe_file_header {
+  char   magic[8];
+  uint   version;
+  uint   reserved;
+  uint64 tsc_hz;
+};
+
+struct cpuid_probe_chunk_header {
+  uint kind;
+  uint count;
+  uint payload_bytes;
+  uint reserved;
+};
+
+struct cpuid_probe_file_event {
+  uint   probe_id;
+  uint   thread_index;
+  uint64 start_ns;   // CLOCK_MONOTONIC-compatible when the TSC is invariant
+  uint64 duration_ns;
+};
+
+void cpuid_probe_decode_header(const unsigned char*, cpuid_probe_file_header&);
+void cpuid_probe_decode_chunk(const unsigned char*, cpuid_probe_chunk_header&);
+void cpuid_probe_decode_event(const unsigned char*, cpuid_probe_file_event&);
+
+#endif
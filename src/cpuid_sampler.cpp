@@ -0,0 +1,506 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#include "cpuid_os.h"
+#include "cpuid_sampler.h"
+#include "cpuid_tsc.h"
+
+void cpuid_sampler_default_options(cpuid_sampler_options& o) {
+  o.pid = 0;
+  o.frequency_hz = 997;   // off the beat of timer ticks
+  o.callchain = true;
+  o.ring_pages = 64;
+}
+
+// Open addressing, keyed by (pid, frames). Frames live in one arena,
+// leaf first, with perf's context markers already dropped.
+struct sampler_stack {
+  uint64 hash;
+  uint pid;
+  uint depth;
+  size_t frames;   // index into the arena
+  uint64 count;    // 0: empty slot
+};
+
+struct cpuid_sampler_table {
+  std::vector<sampler_stack> slots;
+  std::vector<uint64> arena;
+  size_t used;
+
+  cpuid_sampler_table() : slots(1024), used(0) {
+    memset(&slots[0], 0, slots.size() * sizeof(slots[0]));
+  }
+};
+
+// A callchain in place: entry i is the u64 at base[(offset + 8i) & mask].
+// The ring is a power of two bytes and records are 8-byte aligned, so
+// no entry straddles the wrap.
+struct sampler_chain {
+  const char* base;
+  uint64 mask;
+  uint64 offset;
+  uint64 count;
+
+  uint64 at(uint64 i) const {
+    return *(const uint64*) (base + ((offset + 8 * i) & mask));
+  }
+};
+
+#ifdef __linux__
+#define SAMPLER_CONTEXT_MARKER(ip) ((ip) >= (uint64) PERF_CONTEXT_MAX)
+#else
+#define SAMPLER_CONTEXT_MARKER(ip) false
+#endif
+
+uint64 sampler_mix(uint64 h, uint64 v) {
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+uint64 sampler_hash(uint pid, const sampler_chain& c, uint& depth) {
+  uint64 h = sampler_mix(0, pid);
+  depth = 0;
+  for (uint64 i = 0; i < c.count; ++i) {
+    uint64 ip = c.at(i);
+    if (SAMPLER_CONTEXT_MARKER(ip)) continue;
+    h = sampler_mix(h, ip);
+    ++depth;
+  }
+  return h;
+}
+
+bool sampler_same(const cpuid_sampler_table& t, const sampler_stack& s,
+                  const sampler_chain& c) {
+  size_t j = s.frames;
+  for (uint64 i = 0; i < c.count; ++i) {
+    uint64 ip = c.at(i);
+    if (SAMPLER_CONTEXT_MARKER(ip)) continue;
+    if (t.arena[j++] != ip) return false;
+  }
+  return true;
+}
+
+void sampler_grow(cpuid_sampler_table& t) {
+  std::vector<sampler_stack> old(t.slots.size() * 2);
+  memset(&old[0], 0, old.size() * sizeof(old[0]));
+  old.swap(t.slots);
+  uint64 mask = t.slots.size() - 1;
+  for (size_t i = 0; i < old.size(); ++i) {
+    if (!old[i].count) continue;
+    uint64 k = old[i].hash & mask;
+    while (t.slots[k].count) k = (k + 1) & mask;
+    t.slots[k] = old[i];
+  }
+}
+
+void sampler_add(cpuid_sampler_table& t, uint pid, const sampler_chain& c, uint64 count) {
+  uint depth;
+  uint64 hash = sampler_hash(pid, c, depth);
+  if (depth == 0) return;
+
+  uint64 mask = t.slots.size() - 1;
+  uint64 k = hash & mask;
+  for (; t.slots[k].count; k = (k + 1) & mask) {
+    sampler_stack& s = t.slots[k];
+    if (s.hash == hash && s.pid == pid && s.depth == depth && sampler_same(t, s, c)) {
+      s.count += count;
+      return;
+    }
+  }
+
+  sampler_stack& s = t.slots[k];
+  s.hash = hash;
+  s.pid = pid;
+  s.depth = depth;
+  s.frames = t.arena.size();
+  s.count = count;
+  for (uint64 i = 0; i < c.count; ++i) {
+    uint64 ip = c.at(i);
+    if (!SAMPLER_CONTEXT_MARKER(ip)) t.arena.push_back(ip);
+  }
+  if (++t.used * 10 > t.slots.size() * 7) sampler_grow(t);
+}
+
+struct cpuid_sampler_reader {
+  std::vector<int> cpus;
+  std::vector<int> fds;
+  std::vector<void*> rings;
+  int pin_cpu;               // -1: not allowed anywhere in the domain
+  size_t page_size;
+  size_t data_bytes;
+  bool callchain;
+
+  cpuid_sampler_table table;
+  uint64 samples;
+  uint64 lost;
+  volatile int running;
+#ifdef __linux__
+  pthread_t thread;
+#endif
+};
+
+//////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+void sampler_drain(cpuid_sampler_reader& r, void* ring) {
+  volatile struct perf_event_mmap_page* pc = (volatile struct perf_event_mmap_page*) ring;
+  uint64 head = __atomic_load_n(&pc->data_head, __ATOMIC_ACQUIRE);
+  uint64 tail = pc->data_tail;
+  const char* data = (const char*) ring + r.page_size;
+  uint64 mask = r.data_bytes - 1;
+
+  while (tail < head) {
+    const struct perf_event_header* h
+        = (const struct perf_event_header*) (data + (tail & mask));
+    if (h->size == 0) break;
+    sampler_chain at = { data, mask, tail + sizeof(*h), 0 };
+
+    if (h->type == PERF_RECORD_SAMPLE) {
+      // u64 ip; u32 pid, tid; then, with callchains, u64 nr; u64 ips[nr].
+      uint pid = uint(at.at(1));
+      sampler_chain chain = { data, mask, at.offset, 1 };
+      if (r.callchain) {
+        uint64 nr = at.at(2);
+        if (nr > 0) {
+          chain.offset = at.offset + 24;
+          chain.count = nr;
+        }
+      }
+      sampler_add(r.table, pid, chain, 1);
+      ++r.samples;
+    } else if (h->type == PERF_RECORD_LOST) {
+      r.lost += at.at(1);   // u64 id; u64 lost
+    }
+    tail += h->size;
+  }
+  __atomic_store_n(&pc->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+void* sampler_reader_main(void* arg) {
+  cpuid_sampler_reader& r = *(cpuid_sampler_reader*) arg;
+  if (r.pin_cpu >= 0) cpuid_os_pin_current_thread(r.pin_cpu);
+
+  std::vector<struct pollfd> fds(r.fds.size());
+  for (size_t i = 0; i < fds.size(); ++i) {
+    fds[i].fd = r.fds[i];
+    fds[i].events = POLLIN;
+  }
+  while (__atomic_load_n(&r.running, __ATOMIC_ACQUIRE)) {
+    poll(&fds[0], fds.size(), 100);
+    for (size_t i = 0; i < r.rings.size(); ++i) sampler_drain(r, r.rings[i]);
+  }
+  for (size_t i = 0; i < r.rings.size(); ++i) sampler_drain(r, r.rings[i]);
+  return NULL;
+}
+
+int sampler_open(struct perf_event_attr& attr, int pid, int cpu) {
+  return syscall(__NR_perf_event_open, &attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Core cycles per sample, capped so -period fits the counter.
+uint64 sampler_cycles_period(const cpuid_info& info, int frequency_hz) {
+  const tag_processor_features& f = info.processor_features;
+  double hz = f.tsc_features.max_mhz ? f.tsc_features.max_mhz * 1e6
+            : f.tsc_features.base_mhz ? f.tsc_features.base_mhz * 1e6
+            : double(cpuid_tsc_calibrate_hz(20));
+  uint64 period = uint64(hz / frequency_hz);
+
+  int width = std::string("AuthenticAMD") == info.vendor_id ? 48
+            : f.pm_features.gp_counter_bitwidth;
+  if (width > 1 && width < 64) {
+    uint64 cap = (1ULL << (width - 1)) - 1;
+    if (period > cap) period = cap;
+  }
+  return period ? period : 1;
+}
+
+bool sampler_fail(cpuid_sampler& s, const std::string& reason) {
+  s.reason = reason;
+  cpuid_sampler_free(s);
+  return false;
+}
+
+bool cpuid_sampler_start(cpuid_sampler& s, const cpuid_info& info,
+                         const cpuid_sampler_options& options) {
+  s.options = options;
+  s.readers.clear();
+  s.maps.clear();
+  s.merged = NULL;
+  s.samples = s.lost = 0;
+  s.reason.clear();
+
+  if (options.ring_pages <= 0 || (options.ring_pages & (options.ring_pages - 1))
+      || options.frequency_hz <= 0) {
+    s.reason = "ring_pages must be a power of two and frequency_hz positive";
+    return false;
+  }
+  const std::vector<std::vector<int> >& domains = info.processor_groups[CPUID_LEVEL_LLC];
+  if (domains.empty()) {
+    s.reason = "no logical processors enumerated";
+    return false;
+  }
+
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID
+                   | (options.callchain ? PERF_SAMPLE_CALLCHAIN : 0);
+  attr.disabled = 1;
+  attr.inherit = options.pid >= 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.exclude_callchain_kernel = 1;
+  attr.watermark = 1;
+  attr.wakeup_watermark = options.ring_pages * sysconf(_SC_PAGESIZE) / 4;
+
+  bool pmu = std::string("AuthenticAMD") == info.vendor_id
+          || info.processor_features.pm_features.version_id > 0;
+  int first_cpu = domains[0][0];
+  int probe = -1;
+  if (pmu) {
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.sample_period = sampler_cycles_period(info, options.frequency_hz);
+    probe = sampler_open(attr, options.pid, first_cpu);
+    s.event = "cycles";
+  }
+  if (probe < 0) {
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_CPU_CLOCK;
+    attr.sample_period = 1000000000ULL / options.frequency_hz;
+    probe = sampler_open(attr, options.pid, first_cpu);
+    s.event = "cpu-clock";
+  }
+  if (probe < 0) {
+    return sampler_fail(s, std::string("perf_event_open: ") + strerror(errno));
+  }
+  close(probe);
+  s.period = attr.sample_period;
+
+  // Events go on every online CPU: the process being profiled, or
+  // everything, may run where we may not. Enumeration only visited our
+  // own CPUs, so the others' domains are unknown; they share one
+  // unpinned reader. Our allowed set only decides where readers run.
+  std::vector<std::vector<int> > reader_cpus(domains);
+  std::vector<int> online, allowed, elsewhere;
+  cpuid_os_online_cpus(online);
+  cpuid_os_allowed_cpus(allowed);
+  for (size_t i = 0; i < online.size(); ++i) {
+    bool enumerated = false;
+    for (size_t d = 0; d < domains.size() && !enumerated; ++d) {
+      enumerated = std::find(domains[d].begin(), domains[d].end(), online[i]) != domains[d].end();
+    }
+    if (!enumerated) elsewhere.push_back(online[i]);
+  }
+  if (!elsewhere.empty()) reader_cpus.push_back(elsewhere);
+
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  for (size_t d = 0; d < reader_cpus.size(); ++d) {
+    cpuid_sampler_reader* r = new cpuid_sampler_reader;
+    r->cpus = reader_cpus[d];
+    r->pin_cpu = -1;
+    r->page_size = page_size;
+    r->data_bytes = options.ring_pages * page_size;
+    r->callchain = options.callchain;
+    r->samples = r->lost = 0;
+    r->running = 0;
+    s.readers.push_back(r);
+
+    for (size_t i = 0; i < r->cpus.size(); ++i) {
+      int cpu = r->cpus[i];
+      if (r->pin_cpu < 0 && std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+        r->pin_cpu = cpu;
+      }
+      int fd = sampler_open(attr, options.pid, cpu);
+      if (fd < 0) {
+        char buf[96];
+        snprintf(buf, sizeof(buf), "perf_event_open on CPU %d: %s", cpu, strerror(errno));
+        return sampler_fail(s, buf);
+      }
+      r->fds.push_back(fd);
+      void* ring = mmap(NULL, page_size + r->data_bytes, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+      if (ring == MAP_FAILED) {
+        return sampler_fail(s, std::string("mmap of the ring buffer: ") + strerror(errno));
+      }
+      r->rings.push_back(ring);
+    }
+  }
+
+  for (size_t d = 0; d < s.readers.size(); ++d) {
+    cpuid_sampler_reader* r = s.readers[d];
+    r->running = 1;
+    if (pthread_create(&r->thread, NULL, sampler_reader_main, r) != 0) {
+      r->running = 0;
+      cpuid_sampler_stop(s);
+      return sampler_fail(s, "could not start a reader thread");
+    }
+  }
+  for (size_t d = 0; d < s.readers.size(); ++d) {
+    for (size_t i = 0; i < s.readers[d]->fds.size(); ++i) {
+      ioctl(s.readers[d]->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  return true;
+}
+
+void cpuid_sampler_stop(cpuid_sampler& s) {
+  for (size_t d = 0; d < s.readers.size(); ++d) {
+    cpuid_sampler_reader* r = s.readers[d];
+    for (size_t i = 0; i < r->fds.size(); ++i) {
+      ioctl(r->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    if (r->running) {
+      __atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+      pthread_join(r->thread, NULL);
+    }
+  }
+
+  delete s.merged;
+  s.merged = new cpuid_sampler_table;
+  s.samples = s.lost = 0;
+  for (size_t d = 0; d < s.readers.size(); ++d) {
+    const cpuid_sampler_reader* r = s.readers[d];
+    const cpuid_sampler_table& t = r->table;
+    for (size_t k = 0; k < t.slots.size(); ++k) {
+      const sampler_stack& st = t.slots[k];
+      if (!st.count) continue;
+      sampler_chain c = { (const char*) &t.arena[st.frames], ~0ULL, 0, st.depth };
+      sampler_add(*s.merged, st.pid, c, st.count);
+    }
+    s.samples += r->samples;
+    s.lost += r->lost;
+  }
+}
+
+void cpuid_sampler_free(cpuid_sampler& s) {
+  for (size_t d = 0; d < s.readers.size(); ++d) {
+    cpuid_sampler_reader* r = s.readers[d];
+    for (size_t i = 0; i < r->rings.size(); ++i) {
+      munmap(r->rings[i], r->page_size + r->data_bytes);
+    }
+    for (size_t i = 0; i < r->fds.size(); ++i) close(r->fds[i]);
+    delete r;
+  }
+  s.readers.clear();
+  delete s.merged;
+  s.merged = NULL;
+}
+
+void cpuid_sampler_refresh_maps(cpuid_sampler& s) {
+  if (s.options.pid <= 0) return;
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/maps", s.options.pid);
+  FILE* f = fopen(path, "r");
+  if (!f) return;
+
+  std::vector<cpuid_sampler_mapping> maps;
+  char line[512];
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long long start, end, offset;
+    char perms[8];
+    int name_at = 0;
+    if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %n", &start, &end, perms, &offset,
+               &name_at) < 4 || perms[2] != 'x') {
+      continue;
+    }
+    cpuid_sampler_mapping m = { start, end, offset, std::string(line + name_at) };
+    if (!m.path.empty() && m.path[m.path.size() - 1] == '\n') m.path.erase(m.path.size() - 1);
+    maps.push_back(m);
+  }
+  fclose(f);
+  if (!maps.empty()) s.maps.swap(maps);
+}
+
+std::string sampler_symbolize(const cpuid_sampler& s, uint64 ip) {
+  char buf[256];
+  if (s.options.pid == 0) {
+    // dl is only filled in when dladdr succeeds; otherwise fall back
+    // to the mappings.
+    Dl_info dl;
+    if (dladdr((void*) ip, &dl)) {
+      if (dl.dli_sname) return dl.dli_sname;
+      if (dl.dli_fname) {
+        const char* base = strrchr(dl.dli_fname, '/');
+        snprintf(buf, sizeof(buf), "%s+0x%llx", base ? base + 1 : dl.dli_fname,
+                 (unsigned long long) (ip - (uint64) dl.dli_fbase));
+        return buf;
+      }
+    }
+  }
+  for (size_t i = 0; i < s.maps.size(); ++i) {
+    const cpuid_sampler_mapping& m = s.maps[i];
+    if (ip < m.start || ip >= m.end) continue;
+    const char* base = strrchr(m.path.c_str(), '/');
+    snprintf(buf, sizeof(buf), "%s+0x%llx", base ? base + 1 : m.path.c_str(),
+             (unsigned long long) (ip - m.start + m.offset));
+    return buf;
+  }
+  snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long) ip);
+  return buf;
+}
+
+void cpuid_sampler_write_folded(const cpuid_sampler& s, FILE* out) {
+  if (!s.merged) return;
+  std::map<std::string, uint64> folded;
+  const cpuid_sampler_table& t = *s.merged;
+  for (size_t k = 0; k < t.slots.size(); ++k) {
+    const sampler_stack& st = t.slots[k];
+    if (!st.count) continue;
+
+    std::string line;
+    if (s.options.pid < 0) {
+      char pid[24];
+      snprintf(pid, sizeof(pid), "pid-%u", st.pid);
+      line = pid;
+    }
+    // Root first. Return addresses point past the call; step back into
+    // it so the caller's line is the one named.
+    for (uint i = st.depth; i-- > 0;) {
+      uint64 ip = t.arena[st.frames + i];
+      if (!line.empty()) line += ';';
+      line += sampler_symbolize(s, i > 0 ? ip - 1 : ip);
+    }
+    folded[line] += st.count;
+  }
+
+  std::map<std::string, uint64>::const_iterator it;
+  for (it = folded.begin(); it != folded.end(); ++it) {
+    fprintf(out, "%s %llu\n", it->first.c_str(), (unsigned long long) it->second);
+  }
+}
+
+#else
+
+bool cpuid_sampler_start(cpuid_sampler& s, const cpuid_info&, const cpuid_sampler_options& o) {
+  s.options = o;
+  s.merged = NULL;
+  s.samples = s.lost = 0;
+  s.reason = "perf_event is Linux-only";
+  return false;
+}
+
+void cpuid_sampler_stop(cpuid_sampler&) {}
+void cpuid_sampler_free(cpuid_sampler&) {}
+void cpuid_sampler_refresh_maps(cpuid_sampler&) {}
+void cpuid_sampler_write_folded(const cpuid_sampler&, FILE*) {}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CPUID_SAMPLER_H
+#define CPUID_SAMPLER_H
+
+// A minimal sampling profiler on perf_event. One sampling event is
+// opened per online CPU, for one process (and threads it starts after
+// the events are opened) or for everything on the CPU. Each enumerated
+// LLC domain gets one reader thread, pinned inside the domain, and the
+// CPUs outside our cpuset share one more, unpinned. A reader polls its
+// CPUs' ring buffers and parses records where they lie in the mmap'ed
+// ring, reading fields modulo the ring size instead of copying records
+// out. Stacks go into that reader's own hash table, so readers never
+// share anything until cpuid_sampler_stop merges them.
+//
+// The event is core cycles when the PMU allows it, with a period of
+// max frequency / frequency_hz capped below half the counter width
+// (the kernel programs -period into the counter). Without a usable
+// PMU it falls back to the cpu-clock software event.
+//
+// Output is the folded-stack format flamegraph.pl and speedscope read:
+// "root;caller;callee count" per line. Frames are symbolized with
+// dladdr for the calling process, as module+offset from
+// /proc/<pid>/maps for another one, and as raw addresses otherwise.
+
+#include <cstdio>
+
+#include "cpuid.h"
+
+struct cpuid_sampler_options {
+  int pid;                // 0: this process, -1: every process
+  int frequency_hz;       // target samples per second per busy CPU
+  bool callchain;         // user-space stacks, not just the IP
+  int ring_pages;         // data pages per CPU; a power of two
+};
+
+void cpuid_sampler_default_options(cpuid_sampler_options&);
+
+struct cpuid_sampler_table;
+struct cpuid_sampler_reader;
+
+struct cpuid_sampler_mapping {
+  uint64 start;
+  uint64 end;
+  uint64 offset;
+  std::string path;
+};
+
+struct cpuid_sampler {
+  cpuid_sampler_options options;
+  std::string event;                 // "cycles" or "cpu-clock"
+  uint64 period;                     // events (or ns) per sample
+  std::vector<cpuid_sampler_reader*> readers;
+  std::vector<cpuid_sampler_mapping> maps;   // of options.pid, if > 0
+  cpuid_sampler_table* merged;       // after stop
+  uint64 samples;
+  uint64 lost;
+  std::string reason;                // why start failed
+};
+
+// Opens the events and starts the readers. Requires a prior
+// cpuid_enumerate_logical_processors(); fails if it found nothing.
+bool cpuid_sampler_start(cpuid_sampler&, const cpuid_info&, const cpuid_sampler_options&);
+
+// Stops the readers, drains the rings and merges the tables.
+void cpuid_sampler_stop(cpuid_sampler&);
+
+// Snapshots /proc/<pid>/maps for symbolizing another process. Call it
+// while the process is alive; the last good snapshot is kept.
+void cpuid_sampler_refresh_maps(cpuid_sampler&);
+
+// Requires cpuid_sampler_stop.
+void cpuid_sampler_write_folded(const cpuid_sampler&, FILE*);
+
+void cpuid_sampler_free(cpuid_sampler&);
+
+#endif
@@ -0,0 +1,493 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "cpuid_le.h"
+#include "cpuid_snapshot.h"
+
+#define SNAPSHOT_HEADER_SIZE     64
+#define SNAPSHOT_ENTRY_SIZE      32
+#define SNAPSHOT_PROCESSOR_SIZE  128
+#define SNAPSHOT_LEAF_SIZE       24
+#define SNAPSHOT_CACHE_SIZE      40
+#define SNAPSHOT_LP_SIZE         40
+#define SNAPSHOT_NAME_SIZE       32
+
+#define SNAPSHOT_CACHE_INCLUSIVE           1
+#define SNAPSHOT_CACHE_INCLUSIVE_BEHAVIOR  2
+#define SNAPSHOT_CACHE_FULLY_ASSOCIATIVE   4
+#define SNAPSHOT_CACHE_SELF_INITIALIZING   8
+
+static const char snapshot_magic[8] = { 'C', 'P', 'U', 'I', 'D', 'S', 'N', 'P' };
+
+// Smallest record each section needs in version 1.0.
+static const uint snapshot_min_record[CPUID_SNAPSHOT_SECTION_LIMIT] = {
+  0, SNAPSHOT_PROCESSOR_SIZE, SNAPSHOT_LEAF_SIZE, SNAPSHOT_CACHE_SIZE,
+  SNAPSHOT_LP_SIZE, SNAPSHOT_NAME_SIZE, 8
+};
+
+uint snapshot_crc32(uint crc, const unsigned char* p, size_t n) {
+  crc = ~crc;
+  for (size_t i = 0; i < n; ++i) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+uint snapshot_header_crc(const unsigned char* header, size_t header_size) {
+  static const unsigned char zero[4] = { 0, 0, 0, 0 };
+  uint crc = snapshot_crc32(0, header, 40);
+  crc = snapshot_crc32(crc, zero, 4);
+  return snapshot_crc32(crc, header + 44, header_size - 44);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+struct snapshot_builder {
+  std::vector<unsigned char>& out;
+  uint count;
+
+  // Reserves a zeroed, 8-byte aligned section and its table entry.
+  unsigned char* add(uint id, uint record_size, uint records) {
+    size_t offset = (out.size() + 7) & ~size_t(7);
+    size_t size = size_t(record_size) * records;
+    out.resize(offset + size, 0);
+    unsigned char* entry = &out[SNAPSHOT_HEADER_SIZE + count++ * SNAPSHOT_ENTRY_SIZE];
+    cpuid_put_le32(entry + 0, id);
+    cpuid_put_le32(entry + 4, record_size);
+    cpuid_put_le64(entry + 8, offset);
+    cpuid_put_le64(entry + 16, size);
+    cpuid_put_le32(entry + 24, records);
+    return size ? &out[offset] : NULL;
+  }
+};
+
+void cpuid_snapshot_build(const cpuid_info& info, const std::vector<tag_cpuid_leaf>& leaves,
+                          std::vector<unsigned char>& out) {
+  std::vector<const char*> names;
+  cpuid_info::feature_flags::const_iterator it;
+  for (it = info.features.begin(); it != info.features.end(); ++it) {
+    if (it->first.size() < SNAPSHOT_NAME_SIZE) names.push_back(it->first.c_str());
+  }
+
+  const uint sections = CPUID_SNAPSHOT_SECTION_LIMIT - 1;
+  out.assign(SNAPSHOT_HEADER_SIZE + sections * SNAPSHOT_ENTRY_SIZE, 0);
+  snapshot_builder b = { out, 0 };
+
+  // The vector may move as sections are added, so each is filled in
+  // before the next is reserved.
+  unsigned char* p = b.add(CPUID_SNAPSHOT_PROCESSOR, SNAPSHOT_PROCESSOR_SIZE, 1);
+  const tag_processor_signature& sig = info.processor_signature;
+  const tag_apic_id_layout& layout = info.apic_id_layout;
+  memcpy(p, info.vendor_id, sizeof(info.vendor_id));
+  memcpy(p + 16, info.brand_string, sizeof(info.brand_string) - 1);
+  cpuid_put_le32(p + 64, info.max_basic_eax);
+  cpuid_put_le32(p + 68, info.max_ext_eax);
+  cpuid_put_le32(p + 72, sig.full_bit_string);
+  cpuid_put_le32(p + 76, sig.family_code);
+  cpuid_put_le32(p + 80, sig.model_number);
+  cpuid_put_le32(p + 84, sig.stepping_id);
+  cpuid_put_le32(p + 88, sig.extended_family);
+  cpuid_put_le32(p + 92, sig.extended_model);
+  cpuid_put_le32(p + 96, sig.processor_type);
+  cpuid_put_le32(p + 100, info.max_physical_address_size);
+  cpuid_put_le32(p + 104, info.max_linear_address_size);
+  cpuid_put_le32(p + 108, layout.smt_shift);
+  cpuid_put_le32(p + 112, layout.l2_shift);
+  cpuid_put_le32(p + 116, layout.llc_shift);
+  cpuid_put_le32(p + 120, layout.die_shift);
+  cpuid_put_le32(p + 124, layout.package_shift);
+
+  p = b.add(CPUID_SNAPSHOT_LEAVES, SNAPSHOT_LEAF_SIZE, leaves.size());
+  for (size_t i = 0; i < leaves.size(); ++i, p += SNAPSHOT_LEAF_SIZE) {
+    cpuid_put_le32(p + 0, leaves[i].leaf);
+    cpuid_put_le32(p + 4, leaves[i].subleaf);
+    cpuid_put_le32(p + 8, leaves[i].eax);
+    cpuid_put_le32(p + 12, leaves[i].ebx);
+    cpuid_put_le32(p + 16, leaves[i].ecx);
+    cpuid_put_le32(p + 20, leaves[i].edx);
+  }
+
+  const cpuid_info::cache_parameters& caches = info.processor_cache_parameters;
+  p = b.add(CPUID_SNAPSHOT_CACHES, SNAPSHOT_CACHE_SIZE, caches.size());
+  for (size_t i = 0; i < caches.size(); ++i, p += SNAPSHOT_CACHE_SIZE) {
+    const tag_processor_cache_parameter_set& c = caches[i];
+    cpuid_put_le32(p + 0, c.cache_level);
+    cpuid_put_le32(p + 4, c.cache_type);
+    cpuid_put_le32(p + 8, c.ways);
+    cpuid_put_le32(p + 12, c.sets);
+    cpuid_put_le32(p + 16, c.system_coherency_line_size);
+    cpuid_put_le32(p + 20, c.physical_line_partitions);
+    cpuid_put_le32(p + 24, c.max_sharing_threads);
+    cpuid_put_le32(p + 28, c.size_in_bytes);
+    cpuid_put_le32(p + 32, (c.inclusive ? SNAPSHOT_CACHE_INCLUSIVE : 0)
+                  | (c.inclusive_behavior ? SNAPSHOT_CACHE_INCLUSIVE_BEHAVIOR : 0)
+                  | (c.fully_associative ? SNAPSHOT_CACHE_FULLY_ASSOCIATIVE : 0)
+                  | (c.self_initializing_cache_level ? SNAPSHOT_CACHE_SELF_INITIALIZING : 0));
+    cpuid_put_le32(p + 36, c.reserved_APICS);
+  }
+
+  const cpuid_info::logical_processor_list& lps = info.logical_processors;
+  p = b.add(CPUID_SNAPSHOT_LOGICAL_PROCESSORS, SNAPSHOT_LP_SIZE, lps.size());
+  for (size_t i = 0; i < lps.size(); ++i, p += SNAPSHOT_LP_SIZE) {
+    cpuid_put_le32(p + 0, lps[i].os_cpu);
+    cpuid_put_le32(p + 4, lps[i].apic_id);
+    cpuid_put_le32(p + 8, lps[i].smt_id);
+    cpuid_put_le32(p + 12, lps[i].core_id);
+    cpuid_put_le32(p + 16, lps[i].l2_id);
+    cpuid_put_le32(p + 20, lps[i].llc_id);
+    cpuid_put_le32(p + 24, lps[i].die_id);
+    cpuid_put_le32(p + 28, lps[i].node_id);
+    cpuid_put_le32(p + 32, lps[i].package_id);
+  }
+
+  p = b.add(CPUID_SNAPSHOT_FEATURE_NAMES, SNAPSHOT_NAME_SIZE, names.size());
+  for (size_t i = 0; i < names.size(); ++i, p += SNAPSHOT_NAME_SIZE) {
+    memcpy(p, names[i], strlen(names[i]));
+  }
+
+  uint words = (names.size() + 63) / 64;
+  p = b.add(CPUID_SNAPSHOT_FEATURE_BITS, 8, words);
+  for (uint w = 0; w < words; ++w) {
+    uint64 bits = 0;
+    for (uint i = 64 * w; i < names.size() && i < 64 * (w + 1); ++i) {
+      if (info.features.find(names[i])->second) bits |= 1ULL << (i - 64 * w);
+    }
+    cpuid_put_le64(p + 8 * w, bits);
+  }
+
+  // Checksums last, once the data has stopped moving.
+  for (uint i = 0; i < b.count; ++i) {
+    unsigned char* entry = &out[SNAPSHOT_HEADER_SIZE + i * SNAPSHOT_ENTRY_SIZE];
+    uint64 size = cpuid_get_le64(entry + 16);
+    const unsigned char* data = size ? &out[cpuid_get_le64(entry + 8)] : NULL;
+    cpuid_put_le32(entry + 28, snapshot_crc32(0, data, size));
+  }
+  unsigned char* h = &out[0];
+  memcpy(h, snapshot_magic, sizeof(snapshot_magic));
+  cpuid_put_le16(h + 8, CPUID_SNAPSHOT_MAJOR);
+  cpuid_put_le16(h + 10, CPUID_SNAPSHOT_MINOR);
+  cpuid_put_le32(h + 12, SNAPSHOT_HEADER_SIZE);
+  cpuid_put_le64(h + 16, out.size());
+  cpuid_put_le64(h + 24, SNAPSHOT_HEADER_SIZE);
+  cpuid_put_le32(h + 32, b.count);
+  cpuid_put_le32(h + 36, SNAPSHOT_ENTRY_SIZE);
+  cpuid_put_le32(h + 44, snapshot_crc32(0, h + SNAPSHOT_HEADER_SIZE,
+                                        b.count * SNAPSHOT_ENTRY_SIZE));
+  cpuid_put_le32(h + 40, snapshot_header_crc(h, SNAPSHOT_HEADER_SIZE));
+}
+
+//////////////////////////////////////////////////////////////////////
+
+bool snapshot_fail(cpuid_snapshot& s, const char* reason) {
+  s.reason = reason;
+  return false;
+}
+
+// True if the span lies inside the snapshot, without overflowing.
+bool snapshot_in_bounds(const cpuid_snapshot& s, uint64 offset, uint64 size) {
+  return offset <= s.size && size <= s.size - offset;
+}
+
+bool snapshot_terminated(const unsigned char* p, size_t n) {
+  return memchr(p, '\0', n) != NULL;
+}
+
+bool cpuid_snapshot_attach(cpuid_snapshot& s, const void* data, size_t size) {
+  s.data = (const unsigned char*) data;
+  s.size = size;
+  s.mapping = NULL;
+  s.mapping_size = 0;
+  s.major = s.minor = 0;
+  memset(s.sections, 0, sizeof(s.sections));
+  s.reason.clear();
+  const unsigned char* h = s.data;
+
+  if (size < SNAPSHOT_HEADER_SIZE || memcmp(h, snapshot_magic, sizeof(snapshot_magic))) {
+    return snapshot_fail(s, "not a cpuid snapshot");
+  }
+  s.major = cpuid_get_le16(h + 8);
+  s.minor = cpuid_get_le16(h + 10);
+  if (s.major != CPUID_SNAPSHOT_MAJOR) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "snapshot version %u.%u; this reader takes %d.x",
+             s.major, s.minor, CPUID_SNAPSHOT_MAJOR);
+    return snapshot_fail(s, buf);
+  }
+  uint header_size = cpuid_get_le32(h + 12);
+  if (header_size < SNAPSHOT_HEADER_SIZE || header_size > size) {
+    return snapshot_fail(s, "bad header size");
+  }
+  if (cpuid_get_le32(h + 40) != snapshot_header_crc(h, header_size)) {
+    return snapshot_fail(s, "header checksum mismatch");
+  }
+  if (cpuid_get_le64(h + 16) > size) {
+    return snapshot_fail(s, "snapshot is truncated");
+  }
+  s.size = cpuid_get_le64(h + 16);
+
+  uint64 table = cpuid_get_le64(h + 24);
+  uint count = cpuid_get_le32(h + 32);
+  uint entry_size = cpuid_get_le32(h + 36);
+  if (entry_size < SNAPSHOT_ENTRY_SIZE || (table & 7)
+      || !snapshot_in_bounds(s, table, uint64(count) * entry_size)) {
+    return snapshot_fail(s, "bad section table");
+  }
+  if (cpuid_get_le32(h + 44) != snapshot_crc32(0, s.data + table, uint64(count) * entry_size)) {
+    return snapshot_fail(s, "section table checksum mismatch");
+  }
+
+  for (uint i = 0; i < count; ++i) {
+    const unsigned char* e = s.data + table + uint64(i) * entry_size;
+    uint id = cpuid_get_le32(e + 0);
+    uint record_size = cpuid_get_le32(e + 4);
+    uint64 offset = cpuid_get_le64(e + 8);
+    uint64 bytes = cpuid_get_le64(e + 16);
+    uint records = cpuid_get_le32(e + 24);
+    if (id == 0 || id >= CPUID_SNAPSHOT_SECTION_LIMIT) continue;   // newer than us
+
+    if ((offset & 7) || !snapshot_in_bounds(s, offset, bytes)
+        || bytes != uint64(records) * record_size) {
+      return snapshot_fail(s, "section outside the snapshot");
+    }
+    if (records > 0 && record_size < snapshot_min_record[id]) {
+      return snapshot_fail(s, "section records too small");
+    }
+    if (cpuid_get_le32(e + 28) != snapshot_crc32(0, s.data + offset, bytes)) {
+      return snapshot_fail(s, "section checksum mismatch");
+    }
+    cpuid_snapshot_section& sec = s.sections[id];
+    sec.base = records ? s.data + offset : NULL;
+    sec.count = records;
+    sec.record_size = record_size;
+  }
+
+  // Strings must end inside their fields, so accessors can hand out
+  // pointers into the mapping.
+  const cpuid_snapshot_section& proc = s.sections[CPUID_SNAPSHOT_PROCESSOR];
+  if (proc.count != 1) {
+    return snapshot_fail(s, "no processor record");
+  }
+  if (!snapshot_terminated(proc.base, 16) || !snapshot_terminated(proc.base + 16, 48)) {
+    return snapshot_fail(s, "unterminated vendor or brand string");
+  }
+  // The lookups binary-search these two sections.
+  const cpuid_snapshot_section& leaves = s.sections[CPUID_SNAPSHOT_LEAVES];
+  for (uint i = 1; i < leaves.count; ++i) {
+    const unsigned char* p = leaves.base + uint64(i) * leaves.record_size;
+    const unsigned char* q = p - leaves.record_size;
+    uint64 at = (uint64(cpuid_get_le32(p)) << 32) | cpuid_get_le32(p + 4);
+    uint64 before = (uint64(cpuid_get_le32(q)) << 32) | cpuid_get_le32(q + 4);
+    if (at <= before) {
+      return snapshot_fail(s, "leaf records are not sorted");
+    }
+  }
+  const cpuid_snapshot_section& names = s.sections[CPUID_SNAPSHOT_FEATURE_NAMES];
+  for (uint i = 0; i < names.count; ++i) {
+    if (!snapshot_terminated(names.base + uint64(i) * names.record_size, names.record_size)) {
+      return snapshot_fail(s, "unterminated feature name");
+    }
+    if (i > 0 && strcmp(cpuid_snapshot_feature_name(s, i - 1),
+                        cpuid_snapshot_feature_name(s, i)) >= 0) {
+      return snapshot_fail(s, "feature names are not sorted");
+    }
+  }
+  if (uint64(s.sections[CPUID_SNAPSHOT_FEATURE_BITS].count) * 64 < names.count) {
+    return snapshot_fail(s, "feature bits missing");
+  }
+  return true;
+}
+
+bool cpuid_snapshot_open(cpuid_snapshot& s, const char* path) {
+  s.mapping = NULL;
+  s.mapping_size = 0;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    s.reason = std::string(path) + ": " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return snapshot_fail(s, "empty file");
+  }
+  void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    return snapshot_fail(s, "mmap failed");
+  }
+  bool ok = cpuid_snapshot_attach(s, p, st.st_size);
+  s.mapping = p;
+  s.mapping_size = st.st_size;
+  if (!ok) {
+    std::string reason = s.reason;
+    cpuid_snapshot_close(s);
+    s.reason = reason;
+  }
+  return ok;
+}
+
+void cpuid_snapshot_close(cpuid_snapshot& s) {
+  if (s.mapping) munmap(s.mapping, s.mapping_size);
+  s.mapping = NULL;
+  s.mapping_size = 0;
+  s.data = NULL;
+  s.size = 0;
+  memset(s.sections, 0, sizeof(s.sections));
+}
+
+//////////////////////////////////////////////////////////////////////
+
+const unsigned char* snapshot_record(const cpuid_snapshot& s, cpuid_snapshot_section_id id,
+                                     uint i) {
+  const cpuid_snapshot_section& sec = s.sections[id];
+  return i < sec.count ? sec.base + uint64(i) * sec.record_size : NULL;
+}
+
+const char* cpuid_snapshot_vendor_id(const cpuid_snapshot& s) {
+  return (const char*) s.sections[CPUID_SNAPSHOT_PROCESSOR].base;
+}
+
+const char* cpuid_snapshot_brand_string(const cpuid_snapshot& s) {
+  return (const char*) s.sections[CPUID_SNAPSHOT_PROCESSOR].base + 16;
+}
+
+uint cpuid_snapshot_count(const cpuid_snapshot& s, cpuid_snapshot_section_id id) {
+  return s.sections[id].count;
+}
+
+void snapshot_read_leaf(const unsigned char* p, tag_cpuid_leaf& l) {
+  l.leaf    = cpuid_get_le32(p + 0);
+  l.subleaf = cpuid_get_le32(p + 4);
+  l.eax     = cpuid_get_le32(p + 8);
+  l.ebx     = cpuid_get_le32(p + 12);
+  l.ecx     = cpuid_get_le32(p + 16);
+  l.edx     = cpuid_get_le32(p + 20);
+}
+
+bool cpuid_snapshot_leaf(const cpuid_snapshot& s, uint i, tag_cpuid_leaf& l) {
+  const unsigned char* p = snapshot_record(s, CPUID_SNAPSHOT_LEAVES, i);
+  if (!p) return false;
+  snapshot_read_leaf(p, l);
+  return true;
+}
+
+bool cpuid_snapshot_find_leaf(const cpuid_snapshot& s, uint leaf, uint subleaf,
+                              tag_cpuid_leaf& l) {
+  uint64 key = (uint64(leaf) << 32) | subleaf;
+  uint lo = 0, hi = s.sections[CPUID_SNAPSHOT_LEAVES].count;
+  while (lo < hi) {
+    uint mid = lo + (hi - lo) / 2;
+    const unsigned char* p = snapshot_record(s, CPUID_SNAPSHOT_LEAVES, mid);
+    uint64 at = (uint64(cpuid_get_le32(p)) << 32) | cpuid_get_le32(p + 4);
+    if (at == key) {
+      snapshot_read_leaf(p, l);
+      return true;
+    }
+    if (at < key) lo = mid + 1;
+    else hi = mid;
+  }
+  return false;
+}
+
+bool cpuid_snapshot_cache(const cpuid_snapshot& s, uint i, tag_processor_cache_parameter_set& c) {
+  const unsigned char* p = snapshot_record(s, CPUID_SNAPSHOT_CACHES, i);
+  if (!p) return false;
+  uint flags = cpuid_get_le32(p + 32);
+  c.cache_level                   = cpuid_get_le32(p + 0);
+  c.cache_type                    = cpuid_get_le32(p + 4);
+  c.ways                          = cpuid_get_le32(p + 8);
+  c.sets                          = cpuid_get_le32(p + 12);
+  c.system_coherency_line_size    = cpuid_get_le32(p + 16);
+  c.physical_line_partitions      = cpuid_get_le32(p + 20);
+  c.max_sharing_threads           = cpuid_get_le32(p + 24);
+  c.size_in_bytes                 = cpuid_get_le32(p + 28);
+  c.inclusive                     = flags & SNAPSHOT_CACHE_INCLUSIVE;
+  c.inclusive_behavior            = flags & SNAPSHOT_CACHE_INCLUSIVE_BEHAVIOR;
+  c.fully_associative             = flags & SNAPSHOT_CACHE_FULLY_ASSOCIATIVE;
+  c.self_initializing_cache_level = flags & SNAPSHOT_CACHE_SELF_INITIALIZING;
+  c.reserved_APICS                = cpuid_get_le32(p + 36);
+  return true;
+}
+
+bool cpuid_snapshot_logical_processor(const cpuid_snapshot& s, uint i, tag_logical_processor& lp) {
+  const unsigned char* p = snapshot_record(s, CPUID_SNAPSHOT_LOGICAL_PROCESSORS, i);
+  if (!p) return false;
+  lp.os_cpu     = int(cpuid_get_le32(p + 0));
+  lp.apic_id    = cpuid_get_le32(p + 4);
+  lp.smt_id     = cpuid_get_le32(p + 8);
+  lp.core_id    = cpuid_get_le32(p + 12);
+  lp.l2_id      = cpuid_get_le32(p + 16);
+  lp.llc_id     = cpuid_get_le32(p + 20);
+  lp.die_id     = cpuid_get_le32(p + 24);
+  lp.node_id    = cpuid_get_le32(p + 28);
+  lp.package_id = cpuid_get_le32(p + 32);
+  return true;
+}
+
+const char* cpuid_snapshot_feature_name(const cpuid_snapshot& s, uint i) {
+  return (const char*) snapshot_record(s, CPUID_SNAPSHOT_FEATURE_NAMES, i);
+}
+
+bool snapshot_feature_bit(const cpuid_snapshot& s, uint i) {
+  const unsigned char* word = snapshot_record(s, CPUID_SNAPSHOT_FEATURE_BITS, i / 64);
+  return (cpuid_get_le64(word) >> (i % 64)) & 1;
+}
+
+int cpuid_snapshot_feature(const cpuid_snapshot& s, const char* name) {
+  uint lo = 0, hi = s.sections[CPUID_SNAPSHOT_FEATURE_NAMES].count;
+  while (lo < hi) {
+    uint mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(cpuid_snapshot_feature_name(s, mid), name);
+    if (cmp == 0) return snapshot_feature_bit(s, mid);
+    if (cmp < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return -1;
+}
+
+void cpuid_snapshot_load(const cpuid_snapshot& s, cpuid_info& info) {
+  const unsigned char* p = s.sections[CPUID_SNAPSHOT_PROCESSOR].base;
+  tag_processor_signature& sig = info.processor_signature;
+  tag_apic_id_layout& layout = info.apic_id_layout;
+  strncpy(info.vendor_id, (const char*) p, sizeof(info.vendor_id) - 1);
+  strncpy(info.brand_string, (const char*) p + 16, sizeof(info.brand_string) - 1);
+  info.max_basic_eax             = cpuid_get_le32(p + 64);
+  info.max_ext_eax               = cpuid_get_le32(p + 68);
+  sig.full_bit_string            = cpuid_get_le32(p + 72);
+  sig.family_code                = cpuid_get_le32(p + 76);
+  sig.model_number               = cpuid_get_le32(p + 80);
+  sig.stepping_id                = cpuid_get_le32(p + 84);
+  sig.extended_family            = cpuid_get_le32(p + 88);
+  sig.extended_model             = cpuid_get_le32(p + 92);
+  sig.processor_type             = cpuid_get_le32(p + 96);
+  info.max_physical_address_size = cpuid_get_le32(p + 100);
+  info.max_linear_address_size   = cpuid_get_le32(p + 104);
+  layout.smt_shift               = int(cpuid_get_le32(p + 108));
+  layout.l2_shift                = int(cpuid_get_le32(p + 112));
+  layout.llc_shift               = int(cpuid_get_le32(p + 116));
+  layout.die_shift               = int(cpuid_get_le32(p + 120));
+  layout.package_shift           = int(cpuid_get_le32(p + 124));
+
+  info.processor_cache_parameters.resize(cpuid_snapshot_count(s, CPUID_SNAPSHOT_CACHES));
+  for (uint i = 0; i < info.processor_cache_parameters.size(); ++i) {
+    cpuid_snapshot_cache(s, i, info.processor_cache_parameters[i]);
+  }
+  info.logical_processors.resize(cpuid_snapshot_count(s, CPUID_SNAPSHOT_LOGICAL_PROCESSORS));
+  for (uint i = 0; i < info.logical_processors.size(); ++i) {
+    cpuid_snapshot_logical_processor(s, i, info.logical_processors[i]);
+  }
+  info.features.clear();
+  for (uint i = 0; i < cpuid_snapshot_count(s, CPUID_SNAPSHOT_FEATURE_NAMES); ++i) {
+    info.features[cpuid_snapshot_feature_name(s, i)] = snapshot_feature_bit(s, i);
+  }
+}
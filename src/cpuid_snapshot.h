@@ -0,0 +1,110 @@
+#ifndef CPUID_SNAPSHOT_H
+#define CPUID_SNAPSHOT_H
+
+// A binary snapshot of introspection results, for handing them to
+// other processes without running CPUID again or parsing text. The file
+// is little-endian and every part is 8-byte aligned, so a reader mmaps
+// it and reads fields where they lie:
+//
+//   offset 0   header (header_size bytes, 64 in version 1.0)
+//     0 "CPUIDSNP"       16 u64 file_size          36 u32 section_entry_size
+//     8 u16 major        24 u64 section_table_off  40 u32 header_crc
+//    10 u16 minor        32 u32 section_count      44 u32 section_table_crc
+//    12 u32 header_size  48 reserved, zero
+//   section table: section_count entries of section_entry_size bytes
+//     0 u32 id   4 u32 record_size   8 u64 offset   16 u64 size
+//    24 u32 count   28 u32 crc
+//   section data: count records of record_size bytes each
+//
+// Readers reject another major version. Minor versions only grow the
+// header, append fields to records or add sections, so a reader takes
+// sizes from the file, reads the fields it knows and skips section ids
+// it does not. Checksums are CRC-32 as in zlib; header_crc is taken
+// with its own field zeroed.
+//
+// Records in version 1.0 (u32 unless noted):
+//   PROCESSOR, 128 bytes, one record
+//     0 char[16] vendor_id, 16 char[48] brand_string, 64 max_basic_eax,
+//     68 max_ext_eax, 72 signature (leaf 1 EAX), 76 family_code,
+//     80 model_number, 84 stepping_id, 88 extended_family,
+//     92 extended_model, 96 processor_type, 100 physical_address_bits,
+//     104 linear_address_bits, 108 i32 smt_shift, l2_shift, llc_shift,
+//     die_shift, package_shift
+//   LEAVES, 24 bytes, sorted by (leaf, subleaf)
+//     leaf, subleaf, eax, ebx, ecx, edx
+//   CACHES, 40 bytes
+//     level, type, ways, sets, line_size, line_partitions,
+//     max_sharing_threads, size_bytes, flags (1 inclusive,
+//     2 inclusive_behavior, 4 fully_associative, 8 self_initializing),
+//     reserved_apics
+//   LOGICAL_PROCESSORS, 40 bytes
+//     i32 os_cpu, apic_id, smt_id, core_id, l2_id, llc_id, die_id,
+//     node_id, package_id, zero
+//   FEATURE_NAMES, 32 bytes: NUL-padded names in strcmp order
+//   FEATURE_BITS, 8 bytes: u64 words; bit i is FEATURE_NAMES[i]
+
+#include "cpuid.h"
+
+#define CPUID_SNAPSHOT_MAJOR 1
+#define CPUID_SNAPSHOT_MINOR 0
+
+enum cpuid_snapshot_section_id {
+  CPUID_SNAPSHOT_PROCESSOR = 1,
+  CPUID_SNAPSHOT_LEAVES,
+  CPUID_SNAPSHOT_CACHES,
+  CPUID_SNAPSHOT_LOGICAL_PROCESSORS,
+  CPUID_SNAPSHOT_FEATURE_NAMES,
+  CPUID_SNAPSHOT_FEATURE_BITS,
+  CPUID_SNAPSHOT_SECTION_LIMIT
+};
+
+// Serializes info and the raw leaves from cpuid_dump_leaves(). Feature
+// names longer than 31 bytes are left out.
+void cpuid_snapshot_build(const cpuid_info&, const std::vector<tag_cpuid_leaf>&,
+                          std::vector<unsigned char>& out);
+
+struct cpuid_snapshot_section {
+  const unsigned char* base;   // NULL if absent
+  uint count;
+  uint record_size;
+};
+
+struct cpuid_snapshot {
+  const unsigned char* data;
+  size_t size;
+  uint major;
+  uint minor;
+  cpuid_snapshot_section sections[CPUID_SNAPSHOT_SECTION_LIMIT];
+  void* mapping;               // from cpuid_snapshot_open
+  size_t mapping_size;
+  std::string reason;          // why open or attach failed
+};
+
+// Maps the file read-only and validates it, checksums included.
+bool cpuid_snapshot_open(cpuid_snapshot&, const char* path);
+
+// Validates a snapshot already in memory; the bytes must outlive it.
+bool cpuid_snapshot_attach(cpuid_snapshot&, const void* data, size_t size);
+
+void cpuid_snapshot_close(cpuid_snapshot&);
+
+// Accessors read the mapped bytes in place. Strings point into the
+// mapping. Indexed accessors return false past the end.
+const char* cpuid_snapshot_vendor_id(const cpuid_snapshot&);
+const char* cpuid_snapshot_brand_string(const cpuid_snapshot&);
+uint cpuid_snapshot_count(const cpuid_snapshot&, cpuid_snapshot_section_id);
+bool cpuid_snapshot_leaf(const cpuid_snapshot&, uint i, tag_cpuid_leaf&);
+bool cpuid_snapshot_find_leaf(const cpuid_snapshot&, uint leaf, uint subleaf, tag_cpuid_leaf&);
+bool cpuid_snapshot_cache(const cpuid_snapshot&, uint i, tag_processor_cache_parameter_set&);
+bool cpuid_snapshot_logical_processor(const cpuid_snapshot&, uint i, tag_logical_processor&);
+const char* cpuid_snapshot_feature_name(const cpuid_snapshot&, uint i);
+
+// 1 or 0, or -1 if the snapshot does not record the feature.
+int cpuid_snapshot_feature(const cpuid_snapshot&, const char* name);
+
+// Copies everything the snapshot records into info. The decoded
+// feature structures (perfmon, trace, TSC...) are not in version 1.0;
+// they stay as constructed, and the raw leaves hold their sources.
+void cpuid_snapshot_load(const cpuid_snapshot&, cpuid_info&);
+
+#endif
@@ -0,0 +1,200 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <cstdlib>
+#include <cstring>
+
+#include "cpuid_sync.h"
+
+// Each node is a header followed by one value slot per child, rounded
+// up to whole lines. Children write their slot, then bump `count`; the
+// last to arrive combines the slots and carries the result upward.
+struct sync_node {
+  int count;
+  int expected;
+  int parent;        // node index, or -1 at the root
+  int parent_slot;
+  int sense;
+  int pad;
+  int64 result;
+  int64 slots[1];    // really `expected` of them
+};
+
+inline sync_node* sync_node_at(cpuid_sync_tree& tree, int index) {
+  return (sync_node*) (tree.nodes + tree.line_size * index);
+}
+
+inline void cpu_relax() {
+#if defined(__i386__) || defined(__x86_64__)
+  __asm__ __volatile__("pause" ::: "memory");
+#endif
+}
+
+int64 sync_combine(int64 a, int64 b, cpuid_reduce_op op) {
+  switch (op) {
+    case CPUID_REDUCE_SUM: return a + b;
+    case CPUID_REDUCE_MIN: return b < a ? b : a;
+    case CPUID_REDUCE_MAX: return b > a ? b : a;
+  }
+  return a;
+}
+
+int64 sync_arrive(cpuid_sync_tree& tree, int index, int slot,
+                  int64 value, cpuid_reduce_op op, int sense) {
+  sync_node* node = sync_node_at(tree, index);
+  node->slots[slot] = value;
+
+  if (__atomic_add_fetch(&node->count, 1, __ATOMIC_ACQ_REL) != node->expected) {
+    while (__atomic_load_n(&node->sense, __ATOMIC_ACQUIRE) != sense) {
+      cpu_relax();
+    }
+    return node->result;
+  }
+
+  int64 total = node->slots[0];
+  for (int i = 1; i < node->expected; ++i) {
+    total = sync_combine(total, node->slots[i], op);
+  }
+  // Nobody else touches the node until we flip its sense.
+  node->count = 0;
+
+  int64 result = total;
+  if (node->parent >= 0) {
+    result = sync_arrive(tree, node->parent, node->parent_slot, total, op, sense);
+  }
+  node->result = result;
+  __atomic_store_n(&node->sense, sense, __ATOMIC_RELEASE);
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// A participant (node < 0) or a tree node, waiting for a parent.
+struct sync_unit {
+  int rank;
+  int node;
+  uint keys[5];   // core, L2, LLC, package, machine
+};
+
+int sync_line_size(const cpuid_info& info) {
+  int line = 0;
+  for (size_t i = 0; i < info.processor_cache_parameters.size(); ++i) {
+    if (info.processor_cache_parameters[i].system_coherency_line_size > line) {
+      line = info.processor_cache_parameters[i].system_coherency_line_size;
+    }
+  }
+  return line >= int(sizeof(int64)) ? line : 64;
+}
+
+bool cpuid_sync_tree_init(cpuid_sync_tree& tree, const cpuid_info& info,
+                          const std::vector<int>& os_cpus) {
+  int n = os_cpus.size();
+  if (n == 0) return false;
+
+  std::vector<sync_unit> units;
+  for (int r = 0; r < n; ++r) {
+    sync_unit u = { r, -1, { 0, 0, 0, 0, 0 } };
+    bool found = false;
+    for (size_t i = 0; i < info.logical_processors.size(); ++i) {
+      const tag_logical_processor& lp = info.logical_processors[i];
+      if (lp.os_cpu != os_cpus[r]) continue;
+      u.keys[0] = lp.core_id;
+      u.keys[1] = lp.l2_id;
+      u.keys[2] = lp.llc_id;
+      u.keys[3] = lp.package_id;
+      found = true;
+    }
+    if (!found) {
+      u.keys[0] = u.keys[1] = u.keys[2] = u.keys[3] = ~uint(r);
+    }
+    units.push_back(u);
+  }
+
+  // Build bottom-up, creating a node only where a level merges units.
+  std::vector<std::vector<int> > children; // node -> child units
+  std::vector<std::vector<sync_unit> > members;
+  for (int level = 0; level < 5; ++level) {
+    std::map<uint, std::vector<sync_unit> > groups;
+    for (size_t i = 0; i < units.size(); ++i) {
+      groups[units[i].keys[level]].push_back(units[i]);
+    }
+
+    std::vector<sync_unit> next;
+    std::map<uint, std::vector<sync_unit> >::iterator it;
+    for (it = groups.begin(); it != groups.end(); ++it) {
+      if (it->second.size() == 1 && !(level == 4 && it->second[0].node < 0)) {
+        next.push_back(it->second[0]);
+        continue;
+      }
+      sync_unit parent = it->second[0];
+      parent.rank = -1;
+      parent.node = members.size();
+      members.push_back(it->second);
+      next.push_back(parent);
+    }
+    units = next;
+  }
+
+  tree.num_nodes = members.size();
+  tree.line_size = sync_line_size(info);
+  // Nodes are indexed in line-size units; a wide node spans several.
+  std::vector<int> first_line(tree.num_nodes);
+  int lines = 0;
+  for (int i = 0; i < tree.num_nodes; ++i) {
+    first_line[i] = lines;
+    int bytes = sizeof(sync_node) + sizeof(int64) * (members[i].size() - 1);
+    lines += (bytes + tree.line_size - 1) / tree.line_size;
+  }
+
+  if (posix_memalign((void**) &tree.nodes, tree.line_size, lines * tree.line_size) != 0) {
+    tree.nodes = NULL;
+    return false;
+  }
+  memset(tree.nodes, 0, lines * tree.line_size);
+
+  tree.leaf_of.assign(n, -1);
+  tree.slot_of.assign(n, 0);
+  for (int i = 0; i < tree.num_nodes; ++i) {
+    sync_node* node = sync_node_at(tree, first_line[i]);
+    node->expected = members[i].size();
+    node->parent = -1;
+    for (size_t k = 0; k < members[i].size(); ++k) {
+      const sync_unit& child = members[i][k];
+      if (child.node < 0) {
+        tree.leaf_of[child.rank] = first_line[i];
+        tree.slot_of[child.rank] = k;
+      } else {
+        sync_node* c = sync_node_at(tree, first_line[child.node]);
+        c->parent = first_line[i];
+        c->parent_slot = k;
+      }
+    }
+  }
+  return true;
+}
+
+void cpuid_sync_tree_free(cpuid_sync_tree& tree) {
+  free(tree.nodes);
+  tree.nodes = NULL;
+}
+
+void cpuid_sync_thread_init(cpuid_sync_thread& self, cpuid_sync_tree& tree, int rank) {
+  self.tree = &tree;
+  self.leaf = tree.leaf_of[rank];
+  self.slot = tree.slot_of[rank];
+  self.sense = 0;
+}
+
+int64 cpuid_allreduce(cpuid_sync_thread& self, int64 value, cpuid_reduce_op op) {
+  self.sense = !self.sense;
+  return sync_arrive(*self.tree, self.leaf, self.slot, value, op, self.sense);
+}
+
+void cpuid_barrier(cpuid_sync_thread& self) {
+  cpuid_allreduce(self, 0, CPUID_REDUCE_SUM);
+}
+
+int64 cpuid_broadcast(cpuid_sync_thread& self, int64 value, bool is_root) {
+  return cpuid_allreduce(self, is_root ? value : 0, CPUID_REDUCE_SUM);
+}
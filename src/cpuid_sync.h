@@ -0,0 +1,47 @@
+#ifndef CPUID_SYNC_H
+#define CPUID_SYNC_H
+
+// Barrier, all-reduce and broadcast over a combining tree shaped like
+// the machine: threads on one core meet first, then cores sharing an
+// L2, then an LLC, then a package, then packages. Each tree node sits
+// on its own coherency line, so a thread only ever spins on a line
+// shared with its nearest neighbours.
+
+#include "cpuid.h"
+
+enum cpuid_reduce_op {
+  CPUID_REDUCE_SUM,
+  CPUID_REDUCE_MIN,
+  CPUID_REDUCE_MAX
+};
+
+struct cpuid_sync_tree {
+  int line_size;               // node stride; system_coherency_line_size
+  int num_nodes;
+  char* nodes;                 // line aligned; nodes are indexed by line
+  std::vector<int> leaf_of;    // participant rank -> leaf node
+  std::vector<int> slot_of;    // participant rank -> slot in its leaf
+};
+
+// One per participating thread; not shared.
+struct cpuid_sync_thread {
+  cpuid_sync_tree* tree;
+  int leaf;
+  int slot;
+  int sense;
+};
+
+// Participant `rank` is expected to run on os_cpus[rank]. Requires a
+// prior cpuid_enumerate_logical_processors(); CPUs it did not see are
+// treated as a package of their own.
+bool cpuid_sync_tree_init(cpuid_sync_tree&, const cpuid_info&,
+                          const std::vector<int>& os_cpus);
+void cpuid_sync_tree_free(cpuid_sync_tree&);
+
+void cpuid_sync_thread_init(cpuid_sync_thread&, cpuid_sync_tree&, int rank);
+
+void  cpuid_barrier(cpuid_sync_thread&);
+int64 cpuid_allreduce(cpuid_sync_thread&, int64 value, cpuid_reduce_op);
+int64 cpuid_broadcast(cpuid_sync_thread&, int64 value, bool is_root);
+
+#endif
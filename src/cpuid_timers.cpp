@@ -0,0 +1,146 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <time.h>
+#include <algorithm>
+
+#include "cpuid_locate.h"
+#include "cpuid_os.h"
+#include "cpuid_timers.h"
+
+const int kTimerBatch = 16;
+const int kTimerWarmupCalls = 1000;
+const int kTimerCostSamples = 2000;
+const int kTimerResolutionSteps = 64;
+const double kTimerResolutionSeconds = 0.05;
+
+uint64 timers_clock_ns(clockid_t id) {
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return uint64(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64 timers_monotonic()       { return timers_clock_ns(CLOCK_MONOTONIC); }
+uint64 timers_monotonic_raw()   { return timers_clock_ns(CLOCK_MONOTONIC_RAW); }
+uint64 timers_realtime_coarse() { return timers_clock_ns(CLOCK_REALTIME_COARSE); }
+
+uint64 timers_rdtscp() {
+  uint lo, hi, aux;
+  __asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+  return (uint64(hi) << 32) | lo;
+}
+
+uint64 timers_rdpid_rdtsc() {
+  cpuid_rdpid();
+  return cpuid_rdtsc();
+}
+
+struct timers_candidate {
+  const char* name;
+  const char* feature;    // required, or NULL
+  uint64 (*read)();
+  bool in_tsc_cycles;     // else nanoseconds
+};
+
+const timers_candidate timers_candidates[] = {
+  { "clock_monotonic",       NULL,     timers_monotonic,       false },
+  { "clock_monotonic_raw",   NULL,     timers_monotonic_raw,   false },
+  { "clock_realtime_coarse", NULL,     timers_realtime_coarse, false },
+  { "rdtsc",                 NULL,     cpuid_rdtsc,            true  },
+  { "rdtscp",                "rdtscp", timers_rdtscp,          true  },
+  { "lfence_rdtsc",          NULL,     cpuid_lfence_rdtsc,     true  },
+  { "rdpid_rdtsc",           "rdpid",  timers_rdpid_rdtsc,     true  }
+};
+
+double timers_cost_cycles(const cpuid_info& info, const cpuid_tsc_fences& fences,
+                          uint64 (*read)()) {
+  for (int i = 0; i < kTimerWarmupCalls; ++i) read();
+
+  std::vector<uint64> batches(kTimerCostSamples);
+  for (int s = 0; s < kTimerCostSamples; ++s) {
+    uint64 begin = cpuid_tsc_read(fences.begin);
+    for (int i = 0; i < kTimerBatch; ++i) read();
+    uint64 end = cpuid_tsc_read(fences.end);
+    batches[s] = end - begin;
+  }
+  tag_sample_distribution d;
+  cpuid_summarize_samples(batches, d);
+
+  cpuid_info::timer_overhead_map::const_iterator it = info.timer_overheads.find("fenced_region");
+  double overhead = it == info.timer_overheads.end() ? 0 : it->second.median;
+  return std::max(0.0, (d.median - overhead) / kTimerBatch);
+}
+
+double timers_resolution(const cpuid_tsc_clock& clock, const timers_candidate& c) {
+  uint64 smallest = ~0ULL;
+  uint64 deadline = cpuid_rdtsc() + uint64(clock.tsc_hz * kTimerResolutionSeconds);
+  uint64 prev = c.read();
+  for (int steps = 0; steps < kTimerResolutionSteps && cpuid_rdtsc() < deadline; ) {
+    uint64 now = c.read();
+    if (now == prev) continue;
+    if (now > prev) smallest = std::min(smallest, now - prev);
+    prev = now;
+    ++steps;
+  }
+  if (smallest == ~0ULL) return -1;
+  return c.in_tsc_cycles ? double(cpuid_tsc_cycles_to_ns(clock, smallest)) : double(smallest);
+}
+
+const tag_timer_source* timers_find(const tag_timer_comparison& cmp, const char* name) {
+  for (size_t i = 0; i < cmp.sources.size(); ++i) {
+    if (cmp.sources[i].name == name && cmp.sources[i].available) return &cmp.sources[i];
+  }
+  return NULL;
+}
+
+void timers_recommend(const cpuid_info& info, tag_timer_comparison& cmp) {
+  bool invariant = cpuid_has_feature(info, "invariant-tsc");
+  bool hypervisor = cpuid_has_feature(info, "hypervisor");
+
+  const tag_timer_source* tsc = timers_find(cmp, "rdtsc");
+  const tag_timer_source* mono = timers_find(cmp, "clock_monotonic");
+
+  cmp.recommended = "clock_monotonic";
+  if (!invariant) {
+    cmp.reason = "TSC is not invariant";
+  } else if (hypervisor && cmp.kernel_clocksource != "tsc") {
+    // The host may migrate us or rescale the TSC; the guest kernel's
+    // paravirtual clock follows that, raw TSC reads do not.
+    cmp.reason = "running under a hypervisor and the kernel does not use the TSC";
+  } else if (tsc && mono && tsc->cost_cycles >= mono->cost_cycles) {
+    cmp.reason = "RDTSC is no cheaper than the vDSO (trapped or emulated)";
+  } else {
+    cmp.recommended = "rdtsc";
+    cmp.reason = hypervisor
+        ? "invariant TSC that the guest kernel also trusts"
+        : "invariant TSC";
+  }
+}
+
+void cpuid_compare_timers(const cpuid_info& info, const cpuid_tsc_clock& clock,
+                          tag_timer_comparison& cmp) {
+  cmp.sources.clear();
+  cmp.kernel_clocksource = cpuid_os_clocksource();
+
+  cpuid_tsc_fences fences;
+  cpuid_tsc_select_fences(info, fences);
+
+  const int count = sizeof(timers_candidates) / sizeof(timers_candidates[0]);
+  for (int i = 0; i < count; ++i) {
+    const timers_candidate& c = timers_candidates[i];
+    tag_timer_source s;
+    s.name = c.name;
+    s.cost_cycles = s.cost_ns = s.resolution_ns = -1;
+
+    s.available = !c.feature || cpuid_has_feature(info, c.feature);
+    if (s.available) {
+      s.cost_cycles = timers_cost_cycles(info, fences, c.read);
+      s.cost_ns = s.cost_cycles * 1e9 / clock.tsc_hz;
+      s.resolution_ns = timers_resolution(clock, c);
+    }
+    cmp.sources.push_back(s);
+  }
+
+  timers_recommend(info, cmp);
+}
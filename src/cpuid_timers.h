@@ -0,0 +1,34 @@
+#ifndef CPUID_TIMERS_H
+#define CPUID_TIMERS_H
+
+// Side-by-side cost and resolution of the clocks a tracing layer could
+// timestamp with, and a recommendation for this host.
+//
+// Cost is per call, in TSC cycles and nanoseconds, from batches of
+// back-to-back calls. Resolution is the smallest nonzero step seen
+// between consecutive reads: the clock's tick for coarse clocks, and
+// roughly the call cost for the fine-grained ones.
+
+#include "cpuid.h"
+#include "cpuid_tsc.h"
+
+struct tag_timer_source {
+  std::string name;
+  bool available;
+  double cost_cycles;     // TSC cycles per call, median
+  double cost_ns;
+  double resolution_ns;
+};
+
+struct tag_timer_comparison {
+  std::vector<tag_timer_source> sources;
+  std::string kernel_clocksource;  // "" if unknown
+  std::string recommended;         // one of the source names
+  std::string reason;
+};
+
+// Requires a prior cpuid_introspect(). Takes a few tens of
+// milliseconds, mostly waiting on the coarse clock to tick.
+void cpuid_compare_timers(const cpuid_info&, const cpuid_tsc_clock&, tag_timer_comparison&);
+
+#endif
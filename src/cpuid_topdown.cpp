@@ -0,0 +1,290 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <cstdio>
+
+#include "cpuid_topdown.h"
+
+const char* cpuid_topdown_method_name(cpuid_topdown_method method) {
+  switch (method) {
+    case CPUID_TOPDOWN_UNSUPPORTED:  return "unsupported";
+    case CPUID_TOPDOWN_INTEL_SLOTS:  return "intel_slots";
+    case CPUID_TOPDOWN_INTEL_CYCLES: return "intel_cycles";
+    case CPUID_TOPDOWN_AMD_ZEN:      return "amd_zen";
+  }
+  return "?";
+}
+
+#ifdef __linux__
+#define TOPDOWN_RAW PERF_TYPE_RAW
+#else
+#define TOPDOWN_RAW 0
+#endif
+
+struct topdown_event {
+  const char* name;
+  uint64 config;   // raw encoding: cmask << 24 | edge << 18 | umask << 8 | event
+};
+
+// Skylake, Cascade Lake, Kaby/Coffee/Comet Lake. Per the SDM's event
+// tables for these cores.
+const topdown_event topdown_skylake_events[] = {
+  { "idq_uops_not_delivered.core",                            0x019c },
+  { "uops_issued.any",                                        0x010e },
+  { "uops_retired.retire_slots",                              0x02c2 },
+  { "int_misc.recovery_cycles",                               0x010d },
+  { "idq_uops_not_delivered.cycles_0_uops_deliv.core",        0x0400019c },
+  { "br_misp_retired.all_branches",                           0x00c5 },
+  { "machine_clears.count",                                   0x010401c3 },
+  { "cycle_activity.stalls_total",                            0x040004a3 },
+  { "cycle_activity.stalls_mem_any",                          0x140014a3 },
+  { "exe_activity.bound_on_stores",                           0x40a6 }
+};
+
+// Zen 4 and Zen 5 (PPR "Core Performance Monitor Counters"). Event
+// selects above 0xFF put bits 11:8 in config bits 35:32.
+const topdown_event topdown_zen_events[] = {
+  { "de_no_dispatch_per_slot.no_ops_from_frontend",           0x1000001a0ULL },
+  { "de_no_dispatch_per_slot.backend_stalls",                 0x100001ea0ULL },
+  { "de_no_dispatch_per_slot.smt_contention",                 0x1000060a0ULL },
+  { "de_src_op_disp.all",                                     0x07aa },
+  { "ex_ret_ops",                                             0x00c1 },
+  { "de_no_dispatch_per_slot.no_ops_from_frontend.cmask6",    0x1060001a0ULL },
+  { "ex_ret_brn_misp",                                        0x00c3 },
+  { "resyncs_or_nc_redirects",                                0x0096 },
+  { "ex_no_retire.load_not_complete",                         0xa2d6 },
+  { "ex_no_retire.not_complete",                              0x02d6 },
+  { "ex_ret_ucode_ops",                                       0x1000000c1ULL }
+};
+
+const char* const topdown_slots_events[] = {
+  "topdown-slots", "topdown-fe-bound", "topdown-bad-spec",
+  "topdown-backend-bound", "topdown-retiring"
+};
+
+uint topdown_family(const tag_processor_signature& sig) {
+  return sig.family_code == 0xF ? sig.family_code + sig.extended_family : sig.family_code;
+}
+
+uint topdown_model(const tag_processor_signature& sig) {
+  if (sig.family_code == 0x6 || sig.family_code == 0xF) {
+    return (sig.extended_model << 4) | sig.model_number;
+  }
+  return sig.model_number;
+}
+
+bool topdown_intel_skylake(uint family, uint model) {
+  if (family != 6) return false;
+  switch (model) {
+    case 0x4E: case 0x5E:  // Skylake
+    case 0x55:             // Skylake-SP, Cascade Lake, Cooper Lake
+    case 0x8E: case 0x9E:  // Kaby, Coffee, Whiskey, Amber Lake
+    case 0xA5: case 0xA6:  // Comet Lake
+      return true;
+  }
+  return false;
+}
+
+bool topdown_amd_zen4(uint family, uint model) {
+  if (family >= 0x1A) return true;
+  if (family != 0x19) return false;
+  return (model >= 0x10 && model <= 0x1F) || (model >= 0x60 && model <= 0x7F)
+      || (model >= 0xA0 && model <= 0xAF);
+}
+
+// Adds the events from a table, plus (a fixed-counter) cycles.
+bool topdown_add_table(const cpuid_info& info, cpuid_topdown_plan& plan,
+                       const topdown_event* table, int count) {
+  cpuid_pmu_event_spec cycles;
+  if (!cpuid_pmu_find_event(info, "cycles", cycles)) {
+    plan.reason = "no core cycles event";
+    return false;
+  }
+  plan.events.push_back(cycles);
+  for (int i = 0; i < count; ++i) {
+    cpuid_pmu_event_spec e;
+    e.name = table[i].name;
+    e.type = TOPDOWN_RAW;
+    e.config = table[i].config;
+    e.fixed_counter = -1;
+    plan.events.push_back(e);
+  }
+  return true;
+}
+
+bool cpuid_topdown_select(const cpuid_info& info, cpuid_topdown_plan& plan) {
+  plan.method = CPUID_TOPDOWN_UNSUPPORTED;
+  plan.events.clear();
+  plan.reason.clear();
+
+  const tag_processor_signature& sig = info.processor_signature;
+  uint family = topdown_family(sig);
+  uint model = topdown_model(sig);
+  char buf[128];
+
+  if (std::string("AuthenticAMD") == info.vendor_id) {
+    if (!topdown_amd_zen4(family, model)) {
+      snprintf(buf, sizeof(buf), "family %02Xh model %02Xh has no dispatch-slot "
+               "events (PMCx1A0 needs Zen 4 or later)", family, model);
+      plan.reason = buf;
+      return false;
+    }
+    if (!topdown_add_table(info, plan, topdown_zen_events,
+                           sizeof(topdown_zen_events) / sizeof(topdown_zen_events[0]))) {
+      return false;
+    }
+    plan.method = CPUID_TOPDOWN_AMD_ZEN;
+    return true;
+  }
+
+  if (info.processor_features.pm_features.version_id == 0) {
+    plan.reason = "leaf 0xA reports no architectural PMU";
+    return false;
+  }
+
+  // The architectural events are the same everywhere they are
+  // enumerated, so prefer them over model tables.
+  const int slots_count = sizeof(topdown_slots_events) / sizeof(topdown_slots_events[0]);
+  for (int i = 0; i < slots_count; ++i) {
+    cpuid_pmu_event_spec e;
+    if (!cpuid_pmu_find_event(info, topdown_slots_events[i], e)) break;
+    plan.events.push_back(e);
+  }
+  if (int(plan.events.size()) == slots_count) {
+    plan.method = CPUID_TOPDOWN_INTEL_SLOTS;
+    return true;
+  }
+  plan.events.clear();
+
+  if (topdown_intel_skylake(family, model)) {
+    if (!topdown_add_table(info, plan, topdown_skylake_events,
+                           sizeof(topdown_skylake_events) / sizeof(topdown_skylake_events[0]))) {
+      return false;
+    }
+    plan.method = CPUID_TOPDOWN_INTEL_CYCLES;
+    return true;
+  }
+
+  snprintf(buf, sizeof(buf), "family %02Xh model %02Xh: no architectural top-down "
+           "events and no known model-specific ones", family, model);
+  plan.reason = buf;
+  return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+struct topdown_counts {
+  const std::vector<tag_pmu_count>& counts;
+  std::string missing;
+
+  explicit topdown_counts(const std::vector<tag_pmu_count>& c) : counts(c) {}
+
+  double operator[](const char* name) {
+    for (size_t i = 0; i < counts.size(); ++i) {
+      if (counts[i].name == name && counts[i].repetitions > 0) return counts[i].mean;
+    }
+    if (missing.empty()) missing = name;
+    return 0;
+  }
+};
+
+double topdown_ratio(double num, double den) {
+  return den > 0 ? num / den : 0;
+}
+
+void topdown_clear(tag_topdown& t) {
+  t.frontend_bound = t.bad_speculation = t.backend_bound = t.retiring = -1;
+  t.smt_contention = -1;
+  t.fetch_latency = t.fetch_bandwidth = -1;
+  t.branch_mispredicts = t.machine_clears = -1;
+  t.memory_bound = t.core_bound = -1;
+  t.light_operations = t.heavy_operations = -1;
+}
+
+void topdown_intel_slots(topdown_counts& c, tag_topdown& t, double& slots) {
+  slots = c["topdown-slots"];
+  t.frontend_bound  = topdown_ratio(c["topdown-fe-bound"], slots);
+  t.bad_speculation = topdown_ratio(c["topdown-bad-spec"], slots);
+  t.backend_bound   = topdown_ratio(c["topdown-backend-bound"], slots);
+  t.retiring        = topdown_ratio(c["topdown-retiring"], slots);
+}
+
+void topdown_intel_cycles(topdown_counts& c, tag_topdown& t, double& slots) {
+  slots = 4 * c["cycles"];
+  double retire_slots = c["uops_retired.retire_slots"];
+  t.frontend_bound  = topdown_ratio(c["idq_uops_not_delivered.core"], slots);
+  t.bad_speculation = topdown_ratio(c["uops_issued.any"] - retire_slots
+                                    + 4 * c["int_misc.recovery_cycles"], slots);
+  t.retiring        = topdown_ratio(retire_slots, slots);
+  t.backend_bound   = 1 - t.frontend_bound - t.bad_speculation - t.retiring;
+
+  t.fetch_latency = topdown_ratio(
+      4 * c["idq_uops_not_delivered.cycles_0_uops_deliv.core"], slots);
+  t.fetch_bandwidth = t.frontend_bound - t.fetch_latency;
+
+  double mispredicts = c["br_misp_retired.all_branches"];
+  double clears = c["machine_clears.count"];
+  t.branch_mispredicts = t.bad_speculation * topdown_ratio(mispredicts, mispredicts + clears);
+  t.machine_clears = t.bad_speculation - t.branch_mispredicts;
+
+  // TMA's backend-bound cycles also include cycles with one port busy;
+  // without those events, memory's share is taken of stalled cycles.
+  double stores = c["exe_activity.bound_on_stores"];
+  t.memory_bound = t.backend_bound * topdown_ratio(c["cycle_activity.stalls_mem_any"] + stores,
+                                                   c["cycle_activity.stalls_total"] + stores);
+  t.core_bound = t.backend_bound - t.memory_bound;
+}
+
+void topdown_amd_zen(topdown_counts& c, tag_topdown& t, double& slots) {
+  slots = 6 * c["cycles"];
+  double retired = c["ex_ret_ops"];
+  t.frontend_bound  = topdown_ratio(c["de_no_dispatch_per_slot.no_ops_from_frontend"], slots);
+  t.bad_speculation = topdown_ratio(c["de_src_op_disp.all"] - retired, slots);
+  t.backend_bound   = topdown_ratio(c["de_no_dispatch_per_slot.backend_stalls"], slots);
+  t.smt_contention  = topdown_ratio(c["de_no_dispatch_per_slot.smt_contention"], slots);
+  t.retiring        = topdown_ratio(retired, slots);
+
+  t.fetch_latency = topdown_ratio(
+      6 * c["de_no_dispatch_per_slot.no_ops_from_frontend.cmask6"], slots);
+  t.fetch_bandwidth = t.frontend_bound - t.fetch_latency;
+
+  double mispredicts = c["ex_ret_brn_misp"];
+  double resyncs = c["resyncs_or_nc_redirects"];
+  t.branch_mispredicts = t.bad_speculation * topdown_ratio(mispredicts, mispredicts + resyncs);
+  t.machine_clears = t.bad_speculation - t.branch_mispredicts;
+
+  t.memory_bound = t.backend_bound * topdown_ratio(c["ex_no_retire.load_not_complete"],
+                                                   c["ex_no_retire.not_complete"]);
+  t.core_bound = t.backend_bound - t.memory_bound;
+
+  t.heavy_operations = topdown_ratio(c["ex_ret_ucode_ops"], slots);
+  t.light_operations = t.retiring - t.heavy_operations;
+}
+
+bool cpuid_topdown_compute(const cpuid_topdown_plan& plan, const std::vector<tag_pmu_count>& counts,
+                           tag_topdown& t, std::string& reason) {
+  topdown_clear(t);
+  topdown_counts c(counts);
+  double slots = 0;
+  switch (plan.method) {
+    case CPUID_TOPDOWN_INTEL_SLOTS:  topdown_intel_slots(c, t, slots); break;
+    case CPUID_TOPDOWN_INTEL_CYCLES: topdown_intel_cycles(c, t, slots); break;
+    case CPUID_TOPDOWN_AMD_ZEN:      topdown_amd_zen(c, t, slots); break;
+    case CPUID_TOPDOWN_UNSUPPORTED:
+      reason = plan.reason;
+      return false;
+  }
+
+  if (!c.missing.empty()) {
+    reason = c.missing + " was never counted";
+    topdown_clear(t);
+    return false;
+  }
+  if (slots <= 0) {
+    reason = "no slots elapsed";
+    topdown_clear(t);
+    return false;
+  }
+  return true;
+}
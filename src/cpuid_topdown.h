@@ -0,0 +1,69 @@
+#ifndef CPUID_TOPDOWN_H
+#define CPUID_TOPDOWN_H
+
+// Top-down microarchitecture analysis: where the pipeline's issue
+// slots went. Level 1 splits every slot into frontend bound, bad
+// speculation, backend bound or retiring; level 2 splits each of those
+// once more. The events and formulas depend on the core:
+//
+//   intel_slots   Leaf 0xA enumerates the architectural top-down
+//                 events (EBX bits 7-11), which count slots directly.
+//                 Level 1 only.
+//   intel_cycles  Skylake-derived cores. Slots are 4 per core cycle
+//                 and the categories come from uop issue/retire
+//                 counts (Yasin's original method). Counts are per
+//                 hardware thread, so the result is exact only while
+//                 the SMT sibling is idle.
+//   amd_zen       Zen 4 and later: 6 dispatch slots per cycle, with
+//                 PMCx1A0 saying why a slot went unused. Adds the
+//                 share of slots lost to the SMT sibling.
+//
+// Anything else -- older or unrecognised cores, Zen 1-3, a hypervisor
+// that hides the PMU -- is reported as unsupported with a reason; no
+// numbers are made up from events that mean something else there.
+
+#include "cpuid_pmu.h"
+
+enum cpuid_topdown_method {
+  CPUID_TOPDOWN_UNSUPPORTED,
+  CPUID_TOPDOWN_INTEL_SLOTS,
+  CPUID_TOPDOWN_INTEL_CYCLES,
+  CPUID_TOPDOWN_AMD_ZEN
+};
+
+struct cpuid_topdown_plan {
+  cpuid_topdown_method method;
+  std::vector<cpuid_pmu_event_spec> events;  // count these, then compute
+  std::string reason;                        // why unsupported
+};
+
+// Fractions of all slots; -1 where the method cannot tell.
+struct tag_topdown {
+  double frontend_bound;
+  double bad_speculation;
+  double backend_bound;
+  double retiring;
+  double smt_contention;       // amd_zen only
+
+  // Level 2.
+  double fetch_latency;        // frontend_bound = fetch_latency + fetch_bandwidth
+  double fetch_bandwidth;
+  double branch_mispredicts;   // bad_speculation = branch_mispredicts + machine_clears
+  double machine_clears;
+  double memory_bound;         // backend_bound = memory_bound + core_bound
+  double core_bound;
+  double light_operations;     // retiring = light_operations + heavy_operations
+  double heavy_operations;
+};
+
+bool cpuid_topdown_select(const cpuid_info&, cpuid_topdown_plan&);
+
+// Computes from counts of the plan's events (any common scale, e.g.
+// per iteration). Returns false, with a reason, if some event was never
+// counted or no slots elapsed.
+bool cpuid_topdown_compute(const cpuid_topdown_plan&, const std::vector<tag_pmu_count>&,
+                           tag_topdown&, std::string& reason);
+
+const char* cpuid_topdown_method_name(cpuid_topdown_method);
+
+#endif
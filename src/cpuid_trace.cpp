@@ -0,0 +1,170 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <cstdio>
+
+#include "cpuid_trace.h"
+
+const char* cpuid_trace_method_name(cpuid_trace_method method) {
+  switch (method) {
+    case CPUID_TRACE_NONE:     return "none";
+    case CPUID_TRACE_ARCH_LBR: return "arch_lbr";
+    case CPUID_TRACE_PT:       return "processor_trace";
+  }
+  return "?";
+}
+
+const char* cpuid_trace_output_name(cpuid_trace_output output) {
+  switch (output) {
+    case CPUID_TRACE_OUTPUT_NONE:         return "none";
+    case CPUID_TRACE_OUTPUT_SINGLE_RANGE: return "single_range";
+    case CPUID_TRACE_OUTPUT_TOPA_MULTI:   return "topa_multi";
+    case CPUID_TRACE_OUTPUT_TOPA_SINGLE:  return "topa_single";
+  }
+  return "?";
+}
+
+void cpuid_trace_default_request(cpuid_trace_request& r) {
+  r.every_branch = false;
+  r.history_branches = 0;
+  r.call_stack = false;
+  r.timing = false;
+  r.cycle_accurate = false;
+  r.ptwrite = false;
+  r.address_filters = 0;
+}
+
+// Highest set bit, or -1.
+int trace_highest_encoding(uint mask) {
+  int n = -1;
+  for (int i = 0; i < 32; ++i) {
+    if ((mask >> i) & 1) n = i;
+  }
+  return n;
+}
+
+void trace_clear(cpuid_trace_config& c) {
+  c.method = CPUID_TRACE_NONE;
+  c.output = CPUID_TRACE_OUTPUT_NONE;
+  c.mtc = false;
+  c.mtc_period = -1;
+  c.cyc = false;
+  c.cyc_threshold = -1;
+  c.psb_frequency = -1;
+  c.ptwrite = false;
+  c.address_filters = 0;
+  c.lbr_depth = 0;
+  c.lbr_call_stack = false;
+  c.reason.clear();
+}
+
+// The smallest supported depth that covers the request; deeper LBRs
+// cost more to save and restore on context switch.
+bool trace_select_lbr(const cpuid_info& info, const cpuid_trace_request& r,
+                      cpuid_trace_config& c, std::string& why_not) {
+  const tag_processor_features::tag_arch_lbr_features& lbr
+      = info.processor_features.arch_lbr_features;
+  if (!cpuid_has_feature(info, "arch-lbr") || lbr.depth_mask == 0) {
+    why_not = "no architectural LBRs";
+    return false;
+  }
+  if (r.call_stack && !lbr.call_stack) {
+    why_not = "LBRs lack call-stack mode";
+    return false;
+  }
+  if ((r.timing || r.cycle_accurate) && !lbr.timed_lbr) {
+    why_not = "LBRs are not timed";
+    return false;
+  }
+
+  int depth = 0;
+  for (int n = 0; n < 8; ++n) {
+    if (!((lbr.depth_mask >> n) & 1)) continue;
+    depth = 8 * (n + 1);
+    if (depth >= r.history_branches) break;
+  }
+  if (depth < r.history_branches) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "LBRs hold at most %d branches", depth);
+    why_not = buf;
+    return false;
+  }
+  c.method = CPUID_TRACE_ARCH_LBR;
+  c.lbr_depth = depth;
+  c.lbr_call_stack = r.call_stack;
+  return true;
+}
+
+bool trace_select_pt(const cpuid_info& info, const cpuid_trace_request& r,
+                     cpuid_trace_config& c, std::string& why_not) {
+  const tag_processor_features::tag_pt_features& pt = info.processor_features.pt_features;
+  if (!cpuid_has_feature(info, "processor-trace")) {
+    why_not = "no Processor Trace";
+    return false;
+  }
+  if (r.ptwrite && !pt.ptwrite) {
+    why_not = "Processor Trace lacks PTWRITE";
+    return false;
+  }
+  if (r.address_filters > 0 && (!pt.ip_filtering || r.address_filters > pt.address_ranges)) {
+    char buf[80];
+    snprintf(buf, sizeof(buf), "%d address filters requested, %d available",
+             r.address_filters, pt.ip_filtering ? pt.address_ranges : 0);
+    why_not = buf;
+    return false;
+  }
+  if (r.cycle_accurate && !pt.psb_cyc_configurable) {
+    why_not = "Processor Trace lacks cycle-accurate mode";
+    return false;
+  }
+
+  if (pt.single_range_output) {
+    c.output = CPUID_TRACE_OUTPUT_SINGLE_RANGE;
+  } else if (pt.topa && pt.topa_multiple_entries) {
+    c.output = CPUID_TRACE_OUTPUT_TOPA_MULTI;
+  } else if (pt.topa) {
+    c.output = CPUID_TRACE_OUTPUT_TOPA_SINGLE;
+  } else {
+    why_not = "Processor Trace can only write to a trace transport";
+    return false;
+  }
+
+  c.method = CPUID_TRACE_PT;
+  if ((r.timing || r.cycle_accurate) && pt.mtc) {
+    c.mtc = true;
+    c.mtc_period = trace_highest_encoding(pt.mtc_period_mask);
+  }
+  if (r.cycle_accurate) {
+    c.cyc = true;
+    c.cyc_threshold = trace_highest_encoding(pt.cycle_threshold_mask);
+  }
+  if (pt.psb_cyc_configurable) {
+    c.psb_frequency = trace_highest_encoding(pt.psb_frequency_mask);
+  }
+  c.ptwrite = r.ptwrite;
+  c.address_filters = r.address_filters;
+  if (r.timing && !pt.mtc) {
+    c.reason = "no MTC packets; timing comes from TSC packets at PSBs only";
+  }
+  return true;
+}
+
+bool cpuid_trace_select(const cpuid_info& info, const cpuid_trace_request& r,
+                        cpuid_trace_config& c) {
+  trace_clear(c);
+  std::string lbr_why, pt_why;
+
+  // LBRs can't give a full trace, PTWRITE data or restrict by address.
+  if (!r.every_branch && !r.ptwrite && r.address_filters == 0) {
+    if (trace_select_lbr(info, r, c, lbr_why)) return true;
+  } else {
+    lbr_why = "request needs Processor Trace";
+  }
+  if (!r.call_stack && trace_select_pt(info, r, c, pt_why)) return true;
+  if (r.call_stack) pt_why = "call stacks come from LBRs";
+
+  trace_clear(c);
+  c.reason = lbr_why + "; " + pt_why;
+  return false;
+}
@@ -0,0 +1,42 @@
+#ifndef CPUID_TRACE_H
+#define CPUID_TRACE_H
+
+// Choosing how to record control flow on this CPU. Architectural LBRs
+// cost nothing until sampled and are the cheapest way to get the last
+// few dozen branches (with call-stack mode, a shadow call stack).
+// Processor Trace records every branch but writes packets to memory
+// continuously; the cheapest PT setup is the one that writes the fewest
+// packets the consumer still needs:
+//
+//   output    single-range needs no table walks; else multi-entry ToPA.
+//   timing    off unless asked for. When asked for, MTC at the longest
+//             period; cycle-accurate (CYC) mode only on request, and
+//             then with the highest cycle threshold.
+//   PSB       the least frequent sync packets on offer.
+//
+// Periods and thresholds are the encodings the IA32_RTIT_CTL fields
+// take (a period of 2^n crystal clocks or cycles), not times.
+
+#include "cpuid.h"
+
+struct cpuid_trace_request {
+  bool every_branch;       // a full trace, not recent history
+  int history_branches;    // with LBRs: at least this many, 0 for any
+  bool call_stack;         // LBR call-stack mode
+  bool timing;             // timestamps in the trace
+  bool cycle_accurate;     // cycle counts between packets
+  bool ptwrite;            // the traced program emits PTWRITE
+  int address_filters;     // IP ranges to restrict PT to
+};
+
+void cpuid_trace_default_request(cpuid_trace_request&);
+
+// Returns false, with a reason, if nothing on this CPU satisfies the
+// request. cpuid_introspect() keeps the choices for the default request
+// and for a full trace in info.branch_history_trace and info.full_trace.
+bool cpuid_trace_select(const cpuid_info&, const cpuid_trace_request&, cpuid_trace_config&);
+
+const char* cpuid_trace_method_name(cpuid_trace_method);
+const char* cpuid_trace_output_name(cpuid_trace_output);
+
+#endif
@@ -0,0 +1,235 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+#include <pthread.h>
+#include <time.h>
+
+#include "cpuid_os.h"
+#include "cpuid_tsc.h"
+
+const char* cpuid_tsc_source_name(cpuid_tsc_source source) {
+  switch (source) {
+    case CPUID_TSC_FROM_HYPERVISOR:     return "hypervisor";
+    case CPUID_TSC_FROM_CRYSTAL:        return "crystal";
+    case CPUID_TSC_FROM_BASE_FREQUENCY: return "base_frequency";
+    case CPUID_TSC_CALIBRATED:          return "calibrated";
+  }
+  return "?";
+}
+
+const char* cpuid_tsc_read_name(cpuid_tsc_read_kind kind) {
+  switch (kind) {
+    case CPUID_TSC_RDTSC:               return "rdtsc";
+    case CPUID_TSC_LFENCE_RDTSC:        return "lfence_rdtsc";
+    case CPUID_TSC_RDTSCP_LFENCE:       return "rdtscp_lfence";
+    case CPUID_TSC_MFENCE_LFENCE_RDTSC: return "mfence_lfence_rdtsc";
+  }
+  return "?";
+}
+
+void cpuid_tsc_select_fences(const cpuid_info& info, cpuid_tsc_fences& fences) {
+  bool lfence_orders = std::string("GenuineIntel") == info.vendor_id
+                    || cpuid_has_feature(info, "lfence-serializing");
+  fences.begin = lfence_orders ? CPUID_TSC_LFENCE_RDTSC : CPUID_TSC_MFENCE_LFENCE_RDTSC;
+  fences.end   = cpuid_has_feature(info, "rdtscp") ? CPUID_TSC_RDTSCP_LFENCE : fences.begin;
+}
+
+#define INT64_MIN_VALUE (-0x7FFFFFFFFFFFFFFFLL - 1)
+#define INT64_MAX_VALUE   0x7FFFFFFFFFFFFFFFLL
+
+uint64 monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Pairs a TSC reading with a CLOCK_MONOTONIC reading, keeping the
+// attempt with the tightest TSC bracket around the clock read.
+void tsc_monotonic_pair(uint64& tsc, uint64& ns) {
+  uint64 best = ~0ULL;
+  for (int i = 0; i < 16; ++i) {
+    uint64 before = cpuid_lfence_rdtsc();
+    uint64 now = monotonic_ns();
+    uint64 after = cpuid_lfence_rdtsc();
+    if (after - before < best) {
+      best = after - before;
+      tsc = before + (after - before) / 2;
+      ns = now;
+    }
+  }
+}
+
+uint64 cpuid_tsc_calibrate_hz(int ms) {
+  uint64 tsc0, ns0, tsc1, ns1;
+  tsc_monotonic_pair(tsc0, ns0);
+
+  struct timespec pause = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&pause, NULL);
+
+  tsc_monotonic_pair(tsc1, ns1);
+  if (ns1 <= ns0) return 0;
+  return uint64(double(tsc1 - tsc0) * 1e9 / double(ns1 - ns0));
+}
+
+bool cpuid_tsc_clock_init(cpuid_tsc_clock& clock, const cpuid_info& info) {
+  const tag_processor_features::tag_tsc_features& tsc
+      = info.processor_features.tsc_features;
+
+  clock.invariant = cpuid_has_feature(info, "invariant-tsc");
+
+  if (tsc.hypervisor_tsc_khz != 0) {
+    clock.source = CPUID_TSC_FROM_HYPERVISOR;
+    clock.tsc_hz = uint64(tsc.hypervisor_tsc_khz) * 1000;
+  } else if (tsc.crystal_ratio_denominator != 0 && tsc.crystal_ratio_numerator != 0
+             && tsc.crystal_hz != 0) {
+    clock.source = CPUID_TSC_FROM_CRYSTAL;
+    clock.tsc_hz = uint64(tsc.crystal_hz) * tsc.crystal_ratio_numerator
+                 / tsc.crystal_ratio_denominator;
+  } else if (tsc.crystal_ratio_denominator != 0 && tsc.crystal_ratio_numerator != 0
+             && tsc.base_mhz != 0) {
+    // SDM: on parts that enumerate the ratio but not the crystal, the
+    // TSC runs at the nominal (base) frequency.
+    clock.source = CPUID_TSC_FROM_BASE_FREQUENCY;
+    clock.tsc_hz = uint64(tsc.base_mhz) * 1000000;
+  } else {
+    clock.source = CPUID_TSC_CALIBRATED;
+    clock.tsc_hz = cpuid_tsc_calibrate_hz(100);
+  }
+  if (clock.tsc_hz == 0) return false;
+
+  // Largest shift whose multiplier still fits in 32 bits, so that each
+  // half-product fits in 64.
+  clock.shift = 32;
+  while (clock.shift > 0
+         && (1000000000ULL << clock.shift) / clock.tsc_hz > 0xFFFFFFFFULL) {
+    --clock.shift;
+  }
+  clock.mult = (1000000000ULL << clock.shift) / clock.tsc_hz;
+
+  tsc_monotonic_pair(clock.base_tsc, clock.base_ns);
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+const int kSyncRounds = 2000;
+const int kWarpRounds = 20000;
+
+struct tsc_sync_shared {
+  uint64 seq       __attribute__((aligned(128)));
+  uint64 remote_tsc;
+  int lock         __attribute__((aligned(128)));
+  uint64 last_tsc;
+  int64 max_backwards;
+
+  int remote_cpu;
+  cpuid_tsc_read_kind read;
+  volatile int remote_pinned;
+};
+
+// Both sides take the lock, read the TSC, and compare with the last
+// value either of them read; a smaller value means time went backwards.
+void tsc_warp_check(tsc_sync_shared& s) {
+  for (int i = 0; i < kWarpRounds; ++i) {
+    while (__atomic_test_and_set(&s.lock, __ATOMIC_ACQUIRE)) {}
+    uint64 prev = s.last_tsc;
+    uint64 now = cpuid_tsc_read(s.read);
+    s.last_tsc = now;
+    if (now < prev && int64(prev - now) > s.max_backwards) {
+      s.max_backwards = prev - now;
+    }
+    __atomic_clear(&s.lock, __ATOMIC_RELEASE);
+  }
+}
+
+void* tsc_sync_remote(void* arg) {
+  tsc_sync_shared& s = *(tsc_sync_shared*) arg;
+  s.remote_pinned = cpuid_os_pin_current_thread(s.remote_cpu) ? 1 : -1;
+  if (s.remote_pinned < 0) return NULL;
+
+  for (uint64 r = 0; r < uint64(kSyncRounds); ++r) {
+    while (__atomic_load_n(&s.seq, __ATOMIC_ACQUIRE) != 2 * r + 1) {}
+    s.remote_tsc = cpuid_tsc_read(s.read);
+    __atomic_store_n(&s.seq, 2 * r + 2, __ATOMIC_RELEASE);
+  }
+  tsc_warp_check(s);
+  return NULL;
+}
+
+bool tsc_sync_one(tag_tsc_sync_cpu& result, cpuid_tsc_read_kind read) {
+  tsc_sync_shared s;
+  s.seq = 0;
+  s.remote_tsc = 0;
+  s.lock = 0;
+  s.last_tsc = 0;
+  s.max_backwards = 0;
+  s.remote_cpu = result.os_cpu;
+  s.read = read;
+  s.remote_pinned = 0;
+
+  pthread_t remote;
+  if (pthread_create(&remote, NULL, tsc_sync_remote, &s) != 0) return false;
+  while (s.remote_pinned == 0) {}
+  if (s.remote_pinned < 0) {
+    pthread_join(remote, NULL);
+    return false;
+  }
+
+  result.offset_min = INT64_MIN_VALUE;
+  result.offset_max = INT64_MAX_VALUE;
+  for (uint64 r = 0; r < uint64(kSyncRounds); ++r) {
+    uint64 t0 = cpuid_tsc_read(read);
+    __atomic_store_n(&s.seq, 2 * r + 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&s.seq, __ATOMIC_ACQUIRE) != 2 * r + 2) {}
+    uint64 t2 = cpuid_tsc_read(read);
+    uint64 t1 = s.remote_tsc;
+
+    int64 lo = int64(t1 - t2);
+    int64 hi = int64(t1 - t0);
+    if (lo > result.offset_min) result.offset_min = lo;
+    if (hi < result.offset_max) result.offset_max = hi;
+  }
+  tsc_warp_check(s);
+  pthread_join(remote, NULL);
+
+  result.max_backwards = s.max_backwards;
+  result.synchronized = result.offset_min <= 0 && result.offset_max >= 0
+                     && result.max_backwards == 0;
+  return true;
+}
+
+bool cpuid_tsc_check_sync(const cpuid_info& info, tag_tsc_sync_report& report) {
+  report.invariant_tsc = cpuid_has_feature(info, "invariant-tsc");
+  report.tsc_adjust = cpuid_has_feature(info, "ia32_tsc_adjust");
+  report.all_synchronized = false;
+  report.unchecked_cpus = 0;
+  report.cpus.clear();
+  report.reference_cpu = -1;
+  if (info.logical_processors.empty()) return false;
+
+  std::vector<int> allowed;
+  if (!cpuid_os_allowed_cpus(allowed)) return false;
+
+  cpuid_tsc_fences fences;
+  cpuid_tsc_select_fences(info, fences);
+
+  report.reference_cpu = info.logical_processors[0].os_cpu;
+  bool ok = cpuid_os_pin_current_thread(report.reference_cpu);
+  report.all_synchronized = ok;
+  for (size_t i = 1; ok && i < info.logical_processors.size(); ++i) {
+    tag_tsc_sync_cpu cpu;
+    cpu.os_cpu = info.logical_processors[i].os_cpu;
+    if (!tsc_sync_one(cpu, fences.begin)) {
+      // Unverified is not synchronized.
+      ++report.unchecked_cpus;
+      report.all_synchronized = false;
+      continue;
+    }
+    report.all_synchronized &= cpu.synchronized;
+    report.cpus.push_back(cpu);
+  }
+
+  cpuid_os_set_allowed_cpus(allowed);
+  return ok;
+}
@@ -0,0 +1,141 @@
+#ifndef CPUID_TSC_H
+#define CPUID_TSC_H
+
+// A clock built on the TSC. The frequency comes from the hypervisor's
+// TSC leaf, then the crystal ratio in leaf 0x15. A part that enumerates
+// the ratio but not the crystal runs the TSC at its base frequency, so
+// leaf 0x16's base frequency is used as the TSC frequency. Otherwise it
+// is calibrated against CLOCK_MONOTONIC. Cycle counts convert to
+// nanoseconds with a fixed-point multiply and shift.
+//
+// Converting a cycle delta is always allowed. Reading the time of day
+// is not unless the TSC is invariant: a TSC that stops or changes rate
+// in deep C-states or under frequency scaling is not a clock.
+
+#include "cpuid.h"
+
+enum cpuid_tsc_source {
+  CPUID_TSC_FROM_HYPERVISOR,
+  CPUID_TSC_FROM_CRYSTAL,       // leaf 0x15
+  CPUID_TSC_FROM_BASE_FREQUENCY, // leaf 0x16 base; leaf 0x15 without a crystal
+  CPUID_TSC_CALIBRATED
+};
+
+struct cpuid_tsc_clock {
+  uint64 tsc_hz;
+  cpuid_tsc_source source;
+  bool invariant;
+
+  // ns = (cycles * mult) >> shift, computed in two 32-bit halves.
+  uint64 mult;
+  int shift;
+
+  // CLOCK_MONOTONIC nanoseconds at base_tsc.
+  uint64 base_tsc;
+  uint64 base_ns;
+};
+
+bool cpuid_tsc_clock_init(cpuid_tsc_clock&, const cpuid_info&);
+
+// Measures the TSC frequency against CLOCK_MONOTONIC over `ms`.
+uint64 cpuid_tsc_calibrate_hz(int ms);
+
+const char* cpuid_tsc_source_name(cpuid_tsc_source);
+
+// Cross-core TSC agreement, relative to a reference CPU. Each CPU
+// answers a few thousand pings from the reference; a reply stamped t1
+// between the reference's t0 and t2 bounds the offset to
+// [t1 - t2, t1 - t0], and the tightest bounds over all rounds are kept.
+// The two CPUs then take turns under a lock reading the TSC and
+// comparing with the last value either saw, to catch time going
+// backwards between them.
+struct tag_tsc_sync_cpu {
+  int os_cpu;
+  int64 offset_min;       // bounds on (this CPU's TSC - reference TSC)
+  int64 offset_max;
+  int64 max_backwards;    // largest backwards step observed; 0 if none
+  bool synchronized;      // offset bounds include 0 and never backwards
+};
+
+struct tag_tsc_sync_report {
+  int reference_cpu;
+  bool invariant_tsc;
+  bool tsc_adjust;        // IA32_TSC_ADJUST lets the OS fix offsets
+  bool all_synchronized;  // safe to subtract TSCs taken on different CPUs;
+                          // false unless every CPU was checked
+  int unchecked_cpus;     // could not be pinned to, so not in `cpus`
+  std::vector<tag_tsc_sync_cpu> cpus;
+};
+
+// Requires a prior cpuid_enumerate_logical_processors(). Returns false
+// if threads could not be pinned, in which case nothing was checked.
+// CPUs that cannot be pinned to individually are counted as unchecked.
+bool cpuid_tsc_check_sync(const cpuid_info&, tag_tsc_sync_report&);
+
+//////////////////////////////////////////////////////////////////////
+
+// Timestamp reads with different ordering guarantees. A region is
+// timed with a "begin" read that waits for earlier work to finish and
+// an "end" read that also keeps later work from starting early.
+//
+// Intel documents LFENCE as waiting for all prior instructions to
+// complete locally. On AMD it only does so when leaf 0x80000021
+// EAX[2] says LFENCE is always dispatch serializing; otherwise MFENCE
+// must precede it. RDTSCP waits for prior instructions on both. The
+// kinds are declared in cpuid.h; cpuid_introspect() keeps this CPU's
+// choice in info.tsc_fences.
+// Chooses the cheapest reads that are correctly ordered on this CPU.
+void cpuid_tsc_select_fences(const cpuid_info&, cpuid_tsc_fences&);
+
+const char* cpuid_tsc_read_name(cpuid_tsc_read_kind);
+
+inline uint64 cpuid_rdtsc() {
+  uint lo, hi;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return (uint64(hi) << 32) | lo;
+}
+
+inline uint64 cpuid_lfence_rdtsc() {
+  uint lo, hi;
+  __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+  return (uint64(hi) << 32) | lo;
+}
+
+inline uint64 cpuid_rdtscp_lfence() {
+  uint lo, hi, aux;
+  __asm__ __volatile__("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi), "=c"(aux) :: "memory");
+  return (uint64(hi) << 32) | lo;
+}
+
+inline uint64 cpuid_mfence_lfence_rdtsc() {
+  uint lo, hi;
+  __asm__ __volatile__("mfence\n\tlfence\n\trdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+  return (uint64(hi) << 32) | lo;
+}
+
+inline uint64 cpuid_tsc_read(cpuid_tsc_read_kind kind) {
+  switch (kind) {
+    case CPUID_TSC_RDTSC:               return cpuid_rdtsc();
+    case CPUID_TSC_LFENCE_RDTSC:        return cpuid_lfence_rdtsc();
+    case CPUID_TSC_RDTSCP_LFENCE:       return cpuid_rdtscp_lfence();
+    case CPUID_TSC_MFENCE_LFENCE_RDTSC: return cpuid_mfence_lfence_rdtsc();
+  }
+  return cpuid_rdtsc();
+}
+
+inline uint64 cpuid_tsc_cycles_to_ns(const cpuid_tsc_clock& clock, uint64 cycles) {
+  uint64 hi = cycles >> 32;
+  uint64 lo = cycles & 0xFFFFFFFFULL;
+  return ((hi * clock.mult) << (32 - clock.shift))
+       + ((lo * clock.mult) >> clock.shift);
+}
+
+// CLOCK_MONOTONIC-compatible nanoseconds. Returns false, leaving `ns`
+// alone, if the TSC is not invariant.
+inline bool cpuid_tsc_now_ns(const cpuid_tsc_clock& clock, uint64& ns) {
+  if (!clock.invariant) return false;
+  ns = clock.base_ns + cpuid_tsc_cycles_to_ns(clock, cpuid_rdtsc() - clock.base_tsc);
+  return true;
+}
+
+#endif
@@ -0,0 +1,78 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Samples every CPU's effective frequency and busy ratio from
+// APERF/MPERF at a fixed interval, for watching a workload from the
+// side: cores running heavy AVX code show up below base frequency.
+
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "cpuid_freq.h"
+#include "json/json.h"
+
+using Json::Value;
+
+int main(int argc, char** argv) {
+  int interval_ms = 100;
+  int samples = 10;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--interval-ms=", 14)) interval_ms = atoi(argv[i] + 14);
+    else if (!strncmp(argv[i], "--samples=", 10)) samples = atoi(argv[i] + 10);
+    else {
+      fprintf(stderr, "usage: %s [--interval-ms=N] [--samples=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  cpuid_info info;
+  cpuid_introspect(info);
+  cpuid_enumerate_logical_processors(info);
+
+  cpuid_tsc_clock clock;
+  if (!cpuid_tsc_clock_init(clock, info)) {
+    fprintf(stderr, "%s: could not determine the TSC frequency\n", argv[0]);
+    return 1;
+  }
+
+  cpuid_freq_sampler sampler;
+  bool ok = cpuid_freq_init(sampler, info, clock);
+
+  Value root;
+  root["method"]      = Value(cpuid_freq_method_name(sampler.method));
+  root["turbo_boost"] = Value(cpuid_has_feature(info, "turbo-boost"));
+  root["tsc_mhz"]     = Value(clock.tsc_hz / 1e6);
+  root["base_mhz"]    = Value(sampler.base_mhz);
+  root["max_mhz"]     = Value(sampler.max_mhz);
+  root["interval_ms"] = Value(interval_ms);
+  root["samples"]     = Value(Json::arrayValue);
+  if (!ok) {
+    root["unavailable_reason"] = Value(sampler.unavailable_reason);
+  }
+
+  for (int n = 0; ok && n < samples; ++n) {
+    struct timespec pause = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    nanosleep(&pause, NULL);
+
+    std::vector<tag_cpu_frequency> freqs;
+    if (!cpuid_freq_sample(sampler, freqs)) break;
+
+    Value sample(Json::arrayValue);
+    for (size_t i = 0; i < freqs.size(); ++i) {
+      Value cpu;
+      cpu["os_cpu"]        = Value(freqs[i].os_cpu);
+      cpu["effective_mhz"] = Value(freqs[i].effective_mhz);
+      cpu["busy_ratio"]    = Value(freqs[i].busy_ratio);
+      sample.append(cpu);
+    }
+    root["samples"].append(sample);
+  }
+
+  cpuid_freq_free(sampler);
+  std::cout << root.toStyledString() << std::endl;
+  return 0;
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Runs the isa/ benchmarks and prints them as a table of latency and
+// reciprocal throughput per instruction, in core cycles. The harness
+// counts TSC cycles; the add64 latency chain runs at exactly one core
+// cycle per instruction, so it gives the conversion at the frequency
+// the core is actually running.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "bench_cases.h"
+#include "json/json.h"
+
+using Json::Value;
+
+int main(int argc, char** argv) {
+  cpuid_bench_options options;
+  cpuid_bench_default_options(options);
+  options.max_seconds = 0.25;
+  options.use_pmu = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--cpu=", 6)) options.cpu = atoi(argv[i] + 6);
+    else if (!strncmp(argv[i], "--max-seconds=", 14)) options.max_seconds = atof(argv[i] + 14);
+    else {
+      fprintf(stderr, "usage: %s [--cpu=N] [--max-seconds=S]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  cpuid_info info;
+  cpuid_introspect(info);
+  cpuid_enumerate_logical_processors(info);
+  if (options.cpu < 0 && !info.logical_processors.empty()) {
+    options.cpu = info.logical_processors[0].os_cpu;
+  }
+
+  cpuid_bench_registry registry;
+  bench_isa_register(registry, info);
+
+  cpuid_bench_context ctx;
+  if (!cpuid_bench_init(ctx, info, options)) {
+    fprintf(stderr, "%s: could not pin to CPU %d or start the TSC clock\n",
+            argv[0], options.cpu);
+    return 1;
+  }
+
+  // Names are isa/<instruction>/<latency|throughput>; add64 runs first.
+  double tsc_per_core_cycle = 0;
+  Value table(Json::objectValue);
+  for (size_t i = 0; i < registry.size(); ++i) {
+    cpuid_bench_case& c = registry[i];
+    cpuid_bench_result result;
+    cpuid_bench_measure(ctx, c.name.c_str(), c.body, c.arg, result);
+    double tsc_cycles = result.tsc_cycles_per_iteration.median;
+
+    size_t slash = c.name.rfind('/');
+    std::string insn = c.name.substr(4, slash - 4);
+    std::string kind = c.name.substr(slash + 1);
+    if (insn == "add64") {
+      tsc_per_core_cycle = tsc_cycles;
+      continue;
+    }
+
+    Value& row = table[insn];
+    const char* key = kind == "latency" ? "latency" : "reciprocal_throughput";
+    row[key] = Value(tsc_per_core_cycle > 0 ? tsc_cycles / tsc_per_core_cycle : -1);
+    row[std::string(key) + "_ns"] = Value(result.ns_per_iteration);
+    if (!result.stable) row["unstable"] = Value(true);
+  }
+  cpuid_bench_free(ctx);
+
+  Value root;
+  root["vendor_id"]          = Value(info.vendor_id);
+  root["model_name"]         = Value(info.brand_string);
+  root["cpu"]                = Value(options.cpu);
+  root["unit"]               = Value("core_cycles");
+  root["tsc_per_core_cycle"] = Value(tsc_per_core_cycle);
+  root["instructions"]       = table;
+  std::cout << root.toStyledString() << std::endl;
+  return 0;
+}
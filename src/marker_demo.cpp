@@ -0,0 +1,97 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Exercises the region markers: rounds of short-lived threads run a
+// dependent arithmetic loop and a pointer chase, each in its own
+// region, so the report shows one with a high IPC and one bound on
+// memory latency. SIGUSR1 prints the report while it runs; the final
+// one is written at exit.
+
+#include <pthread.h>
+#include <signal.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "cpuid_marker.h"
+
+struct demo_options {
+  int rounds;
+  int iterations;
+  size_t chase_bytes;
+};
+
+demo_options g_demo;
+std::vector<size_t> g_chain;   // a single random cycle through the buffer
+
+volatile uint64 g_sink;
+
+void* demo_worker(void*) {
+  cpuid_marker_thread_init();
+  for (int k = 0; k < g_demo.iterations; ++k) {
+    REGION_START("arithmetic");
+    uint64 x = k;
+    for (int i = 0; i < 10000; ++i) x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    g_sink = x;
+    REGION_STOP("arithmetic");
+
+    REGION_START("pointer_chase");
+    size_t at = k % g_chain.size();
+    for (int i = 0; i < 1000; ++i) at = g_chain[at];
+    g_sink = at;
+    REGION_STOP("pointer_chase");
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int threads = 4;
+  const char* report = NULL;
+  g_demo.rounds = 4;
+  g_demo.iterations = 100;
+  g_demo.chase_bytes = 32 << 20;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--threads=", 10)) threads = atoi(argv[i] + 10);
+    else if (!strncmp(argv[i], "--rounds=", 9)) g_demo.rounds = atoi(argv[i] + 9);
+    else if (!strncmp(argv[i], "--iterations=", 13)) g_demo.iterations = atoi(argv[i] + 13);
+    else if (!strncmp(argv[i], "--report=", 9)) report = argv[i] + 9;
+    else {
+      fprintf(stderr, "usage: %s [--threads=N] [--rounds=N] [--iterations=N] [--report=PATH]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (threads < 1) threads = 1;
+
+  cpuid_info info;
+  cpuid_introspect(info);
+  cpuid_tsc_clock clock;
+  if (!cpuid_tsc_clock_init(clock, info)) {
+    fprintf(stderr, "%s: could not determine the TSC frequency\n", argv[0]);
+    return 1;
+  }
+  if (!cpuid_marker_init(info, clock, report, SIGUSR1)) {
+    fprintf(stderr, "%s: could not set up the markers\n", argv[0]);
+    return 1;
+  }
+
+  // Sattolo's shuffle gives one cycle over every slot.
+  g_chain.resize(g_demo.chase_bytes / sizeof(size_t));
+  for (size_t i = 0; i < g_chain.size(); ++i) g_chain[i] = i;
+  srand(1);
+  for (size_t i = g_chain.size() - 1; i > 0; --i) {
+    size_t j = size_t(rand()) % i;
+    size_t t = g_chain[i]; g_chain[i] = g_chain[j]; g_chain[j] = t;
+  }
+
+  std::vector<pthread_t> workers(threads);
+  for (int r = 0; r < g_demo.rounds; ++r) {
+    int started = 0;
+    for (; started < threads; ++started) {
+      if (pthread_create(&workers[started], NULL, demo_worker, NULL) != 0) break;
+    }
+    for (int i = 0; i < started; ++i) pthread_join(workers[i], NULL);
+  }
+  return 0;
+}
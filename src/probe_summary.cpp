@@ -0,0 +1,129 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Summarizes a file written by the cpuid_probe drainer: per probe, the
+// event count and the distribution of durations in nanoseconds.
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "cpuid_probe.h"
+#include "json/json.h"
+
+using Json::Value;
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s PROBE_FILE\n", argv[0]);
+    return 1;
+  }
+
+  FILE* in = fopen(argv[1], "rb");
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  // Sizes in the file are checked against what is left of it before
+  // anything is allocated or read from them.
+  fseek(in, 0, SEEK_END);
+  long file_size = ftell(in);
+  rewind(in);
+
+  unsigned char raw[CPUID_PROBE_FILE_HEADER_SIZE];
+  cpuid_probe_file_header header;
+  if (fread(raw, sizeof(raw), 1, in) != 1
+      || memcmp(raw, CPUID_PROBE_FILE_MAGIC, 8) != 0) {
+    fprintf(stderr, "%s: not a probe file\n", argv[1]);
+    return 1;
+  }
+  cpuid_probe_decode_header(raw, header);
+  if (header.version > CPUID_PROBE_FILE_VERSION) {
+    fprintf(stderr, "%s: unsupported version %u\n", argv[1], header.version);
+    return 1;
+  }
+
+  std::map<uint, std::string> names;
+  std::map<uint, std::vector<uint64> > durations;
+  std::map<uint, uint> threads;
+  uint64 dropped = 0;
+
+  long remaining = file_size - CPUID_PROBE_FILE_HEADER_SIZE;
+  unsigned char chunk_raw[CPUID_PROBE_CHUNK_HEADER_SIZE];
+  cpuid_probe_chunk_header chunk;
+  std::vector<unsigned char> payload;
+  while (fread(chunk_raw, sizeof(chunk_raw), 1, in) == 1) {
+    remaining -= CPUID_PROBE_CHUNK_HEADER_SIZE;
+    cpuid_probe_decode_chunk(chunk_raw, chunk);
+    if (chunk.payload_bytes > remaining
+        || (chunk.kind == CPUID_PROBE_CHUNK_EVENTS
+            && chunk.count > chunk.payload_bytes / CPUID_PROBE_FILE_EVENT_SIZE)) {
+      fprintf(stderr, "%s: corrupt or truncated chunk\n", argv[1]);
+      break;
+    }
+    payload.resize(chunk.payload_bytes + 1);
+    if (chunk.payload_bytes
+        && fread(&payload[0], 1, chunk.payload_bytes, in) != chunk.payload_bytes) {
+      fprintf(stderr, "%s: truncated chunk\n", argv[1]);
+      break;
+    }
+    remaining -= chunk.payload_bytes;
+
+    switch (chunk.kind) {
+      case CPUID_PROBE_CHUNK_NAME:
+        names[chunk.count] = std::string((const char*) &payload[0], chunk.payload_bytes);
+        break;
+      case CPUID_PROBE_CHUNK_EVENTS:
+        for (uint i = 0; i < chunk.count; ++i) {
+          cpuid_probe_file_event e;
+          cpuid_probe_decode_event(&payload[i * CPUID_PROBE_FILE_EVENT_SIZE], e);
+          durations[e.probe_id].push_back(e.duration_ns);
+          threads[e.thread_index] = 1;
+        }
+        break;
+      case CPUID_PROBE_CHUNK_DROPS:
+        dropped += chunk.count;
+        break;
+      default:
+        break; // newer chunk kinds are skipped
+    }
+  }
+  fclose(in);
+
+  Value root;
+  root["tsc_hz"]  = Value(double(header.tsc_hz));
+  root["threads"] = Value(int(threads.size()));
+  root["dropped"] = Value(double(dropped));
+  root["probes"]  = Value(Json::objectValue);
+
+  // Probes registered under the same name from different sites merge.
+  std::map<std::string, std::vector<uint64> > by_name;
+  std::map<uint, std::vector<uint64> >::iterator it;
+  for (it = durations.begin(); it != durations.end(); ++it) {
+    std::string name = names.count(it->first) ? names[it->first] : "?";
+    std::vector<uint64>& all = by_name[name];
+    all.insert(all.end(), it->second.begin(), it->second.end());
+  }
+
+  std::map<std::string, std::vector<uint64> >::iterator nt;
+  for (nt = by_name.begin(); nt != by_name.end(); ++nt) {
+    tag_sample_distribution d;
+    cpuid_summarize_samples(nt->second, d);
+    double total = d.mean * d.samples;
+
+    Value probe;
+    probe["count"]     = Value(d.samples);
+    probe["total_ns"]  = Value(total);
+    probe["min_ns"]    = Value(d.min);
+    probe["median_ns"] = Value(d.median);
+    probe["p99_ns"]    = Value(d.p99);
+    probe["max_ns"]    = Value(d.max);
+    probe["mean_ns"]   = Value(d.mean);
+    root["probes"][nt->first] = probe;
+  }
+
+  std::cout << root.toStyledString() << std::endl;
+  return 0;
+}
@@ -0,0 +1,113 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Samples a process, or every process, and prints folded stacks for
+// flamegraph.pl or speedscope on stdout. A command after "--" is started
+// stopped, profiled from its first instruction, and run to completion.
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "cpuid_sampler.h"
+
+volatile sig_atomic_t interrupted = 0;
+
+void on_interrupt(int) { interrupted = 1; }
+
+int usage(const char* argv0) {
+  fprintf(stderr, "usage: %s [--seconds=S] [--frequency=HZ] [--no-callchain]"
+                  " (--pid=P | --all | -- command args...)\n", argv0);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  cpuid_sampler_options options;
+  cpuid_sampler_default_options(options);
+  double seconds = 0;   // 0: until the command exits or ^C
+  bool have_target = false;
+  char** command = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--seconds=", 10)) seconds = atof(argv[i] + 10);
+    else if (!strncmp(argv[i], "--frequency=", 12)) options.frequency_hz = atoi(argv[i] + 12);
+    else if (!strcmp(argv[i], "--no-callchain")) options.callchain = false;
+    else if (!strncmp(argv[i], "--pid=", 6)) { options.pid = atoi(argv[i] + 6); have_target = true; }
+    else if (!strcmp(argv[i], "--all")) { options.pid = -1; have_target = true; }
+    else if (!strcmp(argv[i], "--") && i + 1 < argc) { command = argv + i + 1; break; }
+    else return usage(argv[0]);
+  }
+  if (have_target == (command != NULL) || (have_target && options.pid == 0)) {
+    return usage(argv[0]);
+  }
+
+  cpuid_info info;
+  cpuid_introspect(info);
+  cpuid_enumerate_logical_processors(info);
+
+  // The child blocks on a pipe until the events are open, so nothing it
+  // runs escapes them.
+  int go[2] = { -1, -1 };
+  pid_t child = 0;
+  if (command) {
+    if (pipe(go) != 0) { perror("pipe"); return 1; }
+    child = fork();
+    if (child < 0) { perror("fork"); return 1; }
+    if (child == 0) {
+      char c;
+      close(go[1]);
+      if (read(go[0], &c, 1) != 1) _exit(127);
+      close(go[0]);
+      execvp(command[0], command);
+      perror(command[0]);
+      _exit(127);
+    }
+    close(go[0]);
+    options.pid = child;
+  }
+
+  cpuid_sampler sampler;
+  if (!cpuid_sampler_start(sampler, info, options)) {
+    fprintf(stderr, "%s: %s\n", argv[0], sampler.reason.c_str());
+    if (child > 0) {
+      kill(child, SIGKILL);
+      waitpid(child, NULL, 0);
+    }
+    return 1;
+  }
+  signal(SIGINT, on_interrupt);
+  signal(SIGTERM, on_interrupt);
+  cpuid_sampler_refresh_maps(sampler);
+  if (child > 0) {
+    if (write(go[1], "g", 1) != 1) perror("write");
+    close(go[1]);
+  }
+
+  int status = 0;
+  struct timespec tick = { 0, 100 * 1000000L };
+  for (int n = 0; !interrupted && (seconds <= 0 || n * 0.1 < seconds); ++n) {
+    nanosleep(&tick, NULL);
+    if (child > 0 && waitpid(child, &status, WNOHANG) == child) {
+      child = 0;
+      break;
+    }
+    cpuid_sampler_refresh_maps(sampler);
+  }
+  cpuid_sampler_stop(sampler);
+
+  cpuid_sampler_write_folded(sampler, stdout);
+  fprintf(stderr, "%s: %llu samples, %llu lost, event %s, period %llu\n", argv[0],
+          (unsigned long long) sampler.samples, (unsigned long long) sampler.lost,
+          sampler.event.c_str(), (unsigned long long) sampler.period);
+  cpuid_sampler_free(sampler);
+
+  if (child > 0) {
+    waitpid(child, &status, 0);
+  }
+  return command && WIFEXITED(status) ? WEXITSTATUS(status) : 0;
+}
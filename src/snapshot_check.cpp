@@ -0,0 +1,169 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Checks the snapshot reader against this machine: a snapshot built
+// here must attach and load back the same, and each kind of damage
+// must be refused for the right reason. Damaged copies get their
+// checksums recomputed, so that the check under test is the one that
+// catches them. Exits non-zero if anything is wrong.
+
+#include <cstdio>
+#include <cstring>
+
+#include "cpuid_le.h"
+#include "cpuid_snapshot.h"
+
+typedef std::vector<unsigned char> bytes;
+
+int g_failures;
+
+void check(bool ok, const char* what) {
+  printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+  if (!ok) ++g_failures;
+}
+
+// CRC-32 as in zlib, written out again so the check does not trust the
+// reader's own.
+uint check_crc32(uint crc, const unsigned char* p, size_t n) {
+  crc = ~crc;
+  for (size_t i = 0; i < n; ++i) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+unsigned char* section_entry(bytes& s, uint id) {
+  uint64 table = cpuid_get_le64(&s[24]);
+  uint count = cpuid_get_le32(&s[32]);
+  uint entry_size = cpuid_get_le32(&s[36]);
+  for (uint i = 0; i < count; ++i) {
+    unsigned char* e = &s[table + uint64(i) * entry_size];
+    if (cpuid_get_le32(e) == id) return e;
+  }
+  return NULL;
+}
+
+// Recomputes every section checksum, then the table's, then the header's.
+void resign(bytes& s) {
+  uint64 table = cpuid_get_le64(&s[24]);
+  uint count = cpuid_get_le32(&s[32]);
+  uint entry_size = cpuid_get_le32(&s[36]);
+  for (uint i = 0; i < count; ++i) {
+    unsigned char* e = &s[table + uint64(i) * entry_size];
+    uint64 offset = cpuid_get_le64(e + 8);
+    uint64 size = cpuid_get_le64(e + 16);
+    if (offset <= s.size() && size <= s.size() - offset) {
+      cpuid_put_le32(e + 28, check_crc32(0, size ? &s[offset] : NULL, size));
+    }
+  }
+  cpuid_put_le32(&s[44], check_crc32(0, &s[table], uint64(count) * entry_size));
+  uint header_size = cpuid_get_le32(&s[12]);
+  cpuid_put_le32(&s[40], 0);
+  cpuid_put_le32(&s[40], check_crc32(0, &s[0], header_size));
+}
+
+// Swaps the first two records of a section.
+void swap_records(bytes& s, uint id) {
+  unsigned char* e = section_entry(s, id);
+  uint record_size = cpuid_get_le32(e + 4);
+  unsigned char* a = &s[cpuid_get_le64(e + 8)];
+  for (uint i = 0; i < record_size; ++i) {
+    unsigned char t = a[i]; a[i] = a[record_size + i]; a[record_size + i] = t;
+  }
+}
+
+void expect_rejected(const bytes& damaged, const char* reason, const char* what) {
+  cpuid_snapshot s;
+  bool attached = cpuid_snapshot_attach(s, &damaged[0], damaged.size());
+  bool ok = !attached && !strncmp(s.reason.c_str(), reason, strlen(reason));
+  check(ok, what);
+  if (!ok) {
+    printf("  expected \"%s\", got \"%s\"\n", reason,
+           attached ? "(attached)" : s.reason.c_str());
+  }
+}
+
+int main() {
+  cpuid_info info;
+  if (!cpuid_introspect(info)) {
+    fprintf(stderr, "snapshot_check: unknown vendor\n");
+    return 1;
+  }
+  cpuid_enumerate_logical_processors(info);
+  std::vector<tag_cpuid_leaf> leaves;
+  cpuid_dump_leaves(info, leaves);
+
+  bytes good;
+  cpuid_snapshot_build(info, leaves, good);
+
+  cpuid_snapshot s;
+  bool attached = cpuid_snapshot_attach(s, &good[0], good.size());
+  check(attached, "a fresh snapshot attaches");
+  if (!attached) {
+    printf("  %s\n", s.reason.c_str());
+    return 1;
+  }
+
+  cpuid_info loaded;
+  cpuid_snapshot_load(s, loaded);
+  check(!strcmp(loaded.vendor_id, info.vendor_id)
+        && !strcmp(loaded.brand_string, info.brand_string), "vendor and brand round-trip");
+  check(loaded.features == info.features, "features round-trip");
+  check(loaded.logical_processors.size() == info.logical_processors.size(),
+        "logical processors round-trip");
+  check(loaded.processor_cache_parameters.size() == info.processor_cache_parameters.size(),
+        "caches round-trip");
+
+  bool found = cpuid_snapshot_count(s, CPUID_SNAPSHOT_LEAVES) == leaves.size();
+  for (size_t i = 0; found && i < leaves.size(); ++i) {
+    tag_cpuid_leaf l;
+    found = cpuid_snapshot_find_leaf(s, leaves[i].leaf, leaves[i].subleaf, l)
+         && !memcmp(&l, &leaves[i], sizeof(l));
+  }
+  check(found, "every leaf is found by (leaf, subleaf)");
+
+  bytes damaged = good;
+  damaged[0] ^= 0xFF;
+  expect_rejected(damaged, "not a cpuid snapshot", "bad magic is refused");
+
+  damaged = good;
+  cpuid_put_le16(&damaged[8], CPUID_SNAPSHOT_MAJOR + 1);
+  resign(damaged);
+  expect_rejected(damaged, "snapshot version", "another major version is refused");
+
+  damaged = good;
+  damaged[20] ^= 0x01;    // file_size, under the header checksum
+  expect_rejected(damaged, "header checksum mismatch", "a corrupt header is refused");
+
+  damaged = good;
+  unsigned char* e = section_entry(damaged, CPUID_SNAPSHOT_LEAVES);
+  damaged[cpuid_get_le64(e + 8) + 8] ^= 0x01;
+  expect_rejected(damaged, "section checksum mismatch", "a corrupt section is refused");
+
+  damaged = good;
+  damaged.resize(good.size() - 8);
+  expect_rejected(damaged, "snapshot is truncated", "a truncated file is refused");
+
+  damaged = good;
+  e = section_entry(damaged, CPUID_SNAPSHOT_CACHES);
+  cpuid_put_le64(e + 8, (good.size() + 8) & ~7ULL);
+  resign(damaged);
+  expect_rejected(damaged, "section outside the snapshot", "an out-of-bounds section is refused");
+
+  if (cpuid_snapshot_count(s, CPUID_SNAPSHOT_LEAVES) >= 2) {
+    damaged = good;
+    swap_records(damaged, CPUID_SNAPSHOT_LEAVES);
+    resign(damaged);
+    expect_rejected(damaged, "leaf records are not sorted", "unsorted leaves are refused");
+  }
+  if (cpuid_snapshot_count(s, CPUID_SNAPSHOT_FEATURE_NAMES) >= 2) {
+    damaged = good;
+    swap_records(damaged, CPUID_SNAPSHOT_FEATURE_NAMES);
+    resign(damaged);
+    expect_rejected(damaged, "feature names are not sorted", "unsorted names are refused");
+  }
+
+  return g_failures ? 1 : 0;
+}
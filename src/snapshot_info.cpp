@@ -0,0 +1,91 @@
+// Copyright (c) 2009 Ben Karel. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE.txt file or at http://eschew.org/txt/bsd.txt
+
+// Summarizes a snapshot written by testcpuid --format=bin, reading it
+// in place through the mapping. With --leaf=LEAF[.SUBLEAF] it prints
+// that leaf's raw registers as well.
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "cpuid_json.h"
+#include "cpuid_snapshot.h"
+
+void write_hex(cpuid_json_writer& w, const char* key, uint v) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "0x%08x", v);
+  cpuid_json_member(w, key, (const char*) buf);
+}
+
+int main(int argc, char** argv) {
+  const char* path = NULL;
+  bool want_leaf = false;
+  uint leaf = 0, subleaf = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--leaf=", 7)) {
+      char* end;
+      leaf = strtoul(argv[i] + 7, &end, 0);
+      if (*end == '.') subleaf = strtoul(end + 1, NULL, 0);
+      want_leaf = true;
+    } else if (!path && argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      path = NULL;
+      break;
+    }
+  }
+  if (!path) {
+    fprintf(stderr, "usage: %s [--leaf=LEAF[.SUBLEAF]] SNAPSHOT\n", argv[0]);
+    return 1;
+  }
+
+  cpuid_snapshot s;
+  if (!cpuid_snapshot_open(s, path)) {
+    fprintf(stderr, "%s: %s\n", argv[0], s.reason.c_str());
+    return 1;
+  }
+
+  static char buffer[16 * 1024];
+  cpuid_json_writer w;
+  cpuid_json_init_fd(w, STDOUT_FILENO, buffer, sizeof(buffer), 3);
+  cpuid_json_begin_object(w);
+  cpuid_json_member(w, "major", s.major);
+  cpuid_json_member(w, "minor", s.minor);
+  cpuid_json_member(w, "vendor_id", cpuid_snapshot_vendor_id(s));
+  cpuid_json_member(w, "model_name", cpuid_snapshot_brand_string(s));
+  cpuid_json_member(w, "leaves", cpuid_snapshot_count(s, CPUID_SNAPSHOT_LEAVES));
+  cpuid_json_member(w, "caches", cpuid_snapshot_count(s, CPUID_SNAPSHOT_CACHES));
+  cpuid_json_member(w, "logical_processors",
+                    cpuid_snapshot_count(s, CPUID_SNAPSHOT_LOGICAL_PROCESSORS));
+
+  cpuid_json_key(w, "features");
+  cpuid_json_begin_array(w);
+  for (uint i = 0; i < cpuid_snapshot_count(s, CPUID_SNAPSHOT_FEATURE_NAMES); ++i) {
+    const char* name = cpuid_snapshot_feature_name(s, i);
+    if (cpuid_snapshot_feature(s, name) == 1) cpuid_json_value(w, name);
+  }
+  cpuid_json_end_array(w);
+
+  tag_cpuid_leaf l;
+  if (want_leaf && cpuid_snapshot_find_leaf(s, leaf, subleaf, l)) {
+    cpuid_json_key(w, "leaf");
+    cpuid_json_begin_object(w);
+    write_hex(w, "leaf", l.leaf);
+    write_hex(w, "subleaf", l.subleaf);
+    write_hex(w, "eax", l.eax);
+    write_hex(w, "ebx", l.ebx);
+    write_hex(w, "ecx", l.ecx);
+    write_hex(w, "edx", l.edx);
+    cpuid_json_end_object(w);
+  } else if (want_leaf) {
+    cpuid_json_member(w, "leaf", "not recorded");
+  }
+  cpuid_json_end_object(w);
+  bool ok = cpuid_json_finish(w);
+
+  cpuid_snapshot_close(s);
+  return ok ? 0 : 1;
+}